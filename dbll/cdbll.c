@@ -0,0 +1,334 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "cdbll.h"
+
+/* Routines for a concurrent linked list (see cdbll.h) */
+
+#define MARKED(p) (((uintptr_t) (p)) & 1)
+#define MARK(p) ((struct cdbll_node *) (((uintptr_t) (p)) | 1))
+#define UNMARK(p) ((struct cdbll_node *) (((uintptr_t) (p)) & ~(uintptr_t) 1))
+
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define CAS(p, e, v) __atomic_compare_exchange_n((p), (e), (v), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+/*
+   Epoch-based reclamation.
+
+   Every thread that touches a list owns a record. While pinned, the
+   record holds the global epoch observed on entry. The global epoch
+   only advances once every pinned thread has observed the current
+   one, so a node retired at epoch e is unreachable by all threads
+   once the global epoch reaches e + 2.
+ */
+
+struct ebr_rec {
+  unsigned long state;        /* epoch << 1 | pinned */
+  int nest;                   /* pin nesting depth, owner only */
+  int in_use;                 /* record is owned by a live thread */
+  struct cdbll_node *retired; /* newest first */
+  size_t nretired;
+  struct ebr_rec *next;       /* all records, never removed */
+};
+
+static unsigned long ebr_epoch;
+static struct ebr_rec *ebr_recs;
+static __thread struct ebr_rec *ebr_self;
+static pthread_key_t ebr_key;
+static pthread_once_t ebr_once = PTHREAD_ONCE_INIT;
+
+/* release the record of an exiting thread, its retired nodes are
+   freed by whichever thread picks the record up next */
+static void ebr_release(void *arg)
+{
+  struct ebr_rec *r = arg;
+
+  r->nest = 0;
+  STORE(&r->state, 0);
+  STORE(&r->in_use, 0);
+}
+
+static void ebr_init()
+{
+  pthread_key_create(&ebr_key, ebr_release);
+}
+
+static struct ebr_rec *ebr_get()
+{
+  struct ebr_rec *r;
+
+  if(ebr_self != NULL)
+    return ebr_self;
+
+  pthread_once(&ebr_once, ebr_init);
+
+  for(r = LOAD(&ebr_recs); r != NULL; r = r->next) {
+    int expected = 0;
+    if(LOAD(&r->in_use) == 0 && CAS(&r->in_use, &expected, 1))
+      break;
+  }
+
+  if(r == NULL) {
+    r = calloc(1, sizeof(struct ebr_rec));
+    if(r == NULL)
+      abort();
+
+    r->in_use = 1;
+    r->next = LOAD(&ebr_recs);
+    while(!CAS(&ebr_recs, &r->next, r))
+      ;
+  }
+
+  pthread_setspecific(ebr_key, r);
+  ebr_self = r;
+  return r;
+}
+
+static void ebr_try_advance()
+{
+  unsigned long e = LOAD(&ebr_epoch);
+  struct ebr_rec *r;
+
+  for(r = LOAD(&ebr_recs); r != NULL; r = r->next) {
+    unsigned long s = LOAD(&r->state);
+    if((s & 1) && (s >> 1) != e)
+      return;
+  }
+
+  CAS(&ebr_epoch, &e, e + 1);
+}
+
+static void ebr_collect(struct ebr_rec *r)
+{
+  struct cdbll_node **pp = &r->retired;
+  struct cdbll_node *n, *next;
+  unsigned long e;
+
+  ebr_try_advance();
+  e = LOAD(&ebr_epoch);
+
+  /* the list is newest first, so everything after the first old enough
+     node is old enough as well */
+  while(*pp != NULL && (*pp)->repoch + 2 > e)
+    pp = &(*pp)->rnext;
+
+  n = *pp;
+  *pp = NULL;
+
+  while(n != NULL) {
+    next = n->rnext;
+    free(n);
+    r->nretired--;
+    n = next;
+  }
+}
+
+static void ebr_retire(struct cdbll_node *n)
+{
+  struct ebr_rec *r = ebr_get();
+
+  n->repoch = LOAD(&ebr_epoch);
+  n->rnext = r->retired;
+  r->retired = n;
+
+  if(++r->nretired >= CDBLL_COLLECT_THRESHOLD)
+    ebr_collect(r);
+}
+
+void cdbll_pin()
+{
+  struct ebr_rec *r = ebr_get();
+
+  if(r->nest++ == 0)
+    STORE(&r->state, (LOAD(&ebr_epoch) << 1) | 1);
+}
+
+void cdbll_unpin()
+{
+  struct ebr_rec *r = ebr_self;
+
+  if(--r->nest == 0)
+    STORE(&r->state, 0);
+}
+
+/* create an empty concurrent list */
+/* returns NULL if memory allocation failed */
+struct cdbll *cdbll_create()
+{
+  struct cdbll *list = malloc(sizeof(struct cdbll));
+  if(list == NULL)
+    return NULL;
+
+  list->head.user_data = NULL;
+  list->head.next = NULL;
+  return list;
+}
+
+/* see cdbll.h */
+void cdbll_free(struct cdbll *list)
+{
+  struct cdbll_node *curr = UNMARK(list->head.next);
+
+  while(curr != NULL) {
+    struct cdbll_node *next = UNMARK(curr->next);
+    free(curr);
+    curr = next;
+  }
+
+  free(list);
+}
+
+/* unlink removed nodes from the front of the list up to `target`
+   (which must already be marked); whichever thread's CAS unlinks a
+   node retires it */
+static void cdbll_unlink(struct cdbll *list, struct cdbll_node *target)
+{
+  struct cdbll_node *pred, *curr, *succ;
+
+ retry:
+  pred = &list->head;
+  curr = UNMARK(LOAD(&pred->next));
+
+  while(curr != NULL) {
+    succ = LOAD(&curr->next);
+
+    if(MARKED(succ)) {
+      struct cdbll_node *expected = curr;
+
+      if(!CAS(&pred->next, &expected, UNMARK(succ)))
+        goto retry;
+
+      ebr_retire(curr);
+      if(curr == target)
+        return;
+
+      curr = UNMARK(succ);
+      continue;
+    }
+
+    pred = curr;
+    curr = succ;
+  }
+}
+
+/* see cdbll.h */
+struct cdbll_node *cdbll_insert_after(struct cdbll *list, struct cdbll_node *node, void *user_data)
+{
+  struct cdbll_node *n = malloc(sizeof(struct cdbll_node));
+  struct cdbll_node *succ;
+
+  if(n == NULL)
+    return NULL;
+
+  if(node == NULL)
+    node = &list->head;
+
+  n->user_data = user_data;
+
+  cdbll_pin();
+  succ = LOAD(&node->next);
+  do {
+    if(MARKED(succ)) {
+      cdbll_unpin();
+      free(n);
+      return NULL;
+    }
+    n->next = succ;
+  } while(!CAS(&node->next, &succ, n));
+  cdbll_unpin();
+
+  return n;
+}
+
+/* see cdbll.h */
+struct cdbll_node *cdbll_append(struct cdbll *list, void *user_data)
+{
+  struct cdbll_node *n = malloc(sizeof(struct cdbll_node));
+  struct cdbll_node *pred, *succ;
+
+  if(n == NULL)
+    return NULL;
+
+  n->user_data = user_data;
+  n->next = NULL;
+
+  cdbll_pin();
+ retry:
+  pred = &list->head;
+  for(;;) {
+    succ = LOAD(&pred->next);
+
+    if(succ == NULL) {
+      if(CAS(&pred->next, &succ, n))
+        break;
+      goto retry;
+    }
+
+    /* pred was removed while we were on it, help unlink it and start over */
+    if(MARKED(succ)) {
+      cdbll_unlink(list, pred);
+      goto retry;
+    }
+
+    pred = UNMARK(succ);
+  }
+  cdbll_unpin();
+
+  return n;
+}
+
+/* see cdbll.h */
+int cdbll_remove(struct cdbll *list, struct cdbll_node *node)
+{
+  struct cdbll_node *succ;
+
+  cdbll_pin();
+  succ = LOAD(&node->next);
+  do {
+    if(MARKED(succ)) {
+      cdbll_unpin();
+      return 0;
+    }
+  } while(!CAS(&node->next, &succ, MARK(succ)));
+
+  cdbll_unlink(list, node);
+  cdbll_unpin();
+  return 1;
+}
+
+/* see cdbll.h */
+struct cdbll_node *cdbll_next(struct cdbll *list, struct cdbll_node *node)
+{
+  struct cdbll_node *curr = UNMARK(LOAD(&node->next));
+
+  while(curr != NULL && MARKED(LOAD(&curr->next)))
+    curr = UNMARK(LOAD(&curr->next));
+
+  return curr;
+}
+
+/* see cdbll.h */
+struct cdbll_node *cdbll_first(struct cdbll *list)
+{
+  return cdbll_next(list, &list->head);
+}
+
+/* see cdbll.h */
+int cdbll_iterate(struct cdbll *list,
+				  void *ctx,
+				  int (*f)(struct cdbll *, struct cdbll_node *, void *))
+{
+  struct cdbll_node *curr, *succ;
+
+  cdbll_pin();
+  for(curr = UNMARK(LOAD(&list->head.next)); curr != NULL; curr = UNMARK(succ)) {
+    /* one load per node: skip removed nodes but keep following their links */
+    succ = LOAD(&curr->next);
+    if(!MARKED(succ) && f != NULL && f(list, curr, ctx) == 0)
+      break;
+  }
+  cdbll_unpin();
+
+  return 1;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+/* Concurrent linked list with lock-free readers and CAS-based writers */
+
+/* Nodes are linked through next only. A node is removed in two steps:
+   the low bit of its next pointer is set (logical removal), then it is
+   unlinked from its predecessor with a CAS (physical removal). Unlinked
+   nodes are freed through epoch-based reclamation, so a node is never
+   freed while a thread that could still reach it is pinned. */
+
+/* Invariant: a node whose next pointer is marked is never marked again
+   or unmarked, and nothing is inserted after it */
+
+struct cdbll_node {
+  void *user_data;            /* pointer to user data */
+  struct cdbll_node *next;    /* next node, low bit set once removed */
+  struct cdbll_node *rnext;   /* link on the retire list of the thread that unlinked it */
+  unsigned long repoch;       /* global epoch at which it was retired */
+};
+
+struct cdbll {
+  struct cdbll_node head;     /* sentinel, head.next is the first node */
+};
+
+/* nodes retired by a thread before it tries to free old ones */
+#define CDBLL_COLLECT_THRESHOLD 64
+
+struct cdbll *cdbll_create();
+
+/* frees the list and all nodes still linked into it */
+/* no other thread may be using the list */
+void cdbll_free(struct cdbll *list);
+
+/* enter and leave an epoch-protected region; calls nest */
+/* node pointers obtained inside a region stay valid (though possibly
+   removed) until the outermost cdbll_unpin */
+void cdbll_pin();
+void cdbll_unpin();
+
+/* insert a new node after `node`, or at the front if node is NULL */
+/* return NULL if node has been removed or memory could not be allocated */
+struct cdbll_node *cdbll_insert_after(struct cdbll *list, struct cdbll_node *node, void *user_data);
+
+/* insert a new node at the end of the list (walks the list) */
+struct cdbll_node *cdbll_append(struct cdbll *list, void *user_data);
+
+/* remove `node`; return 1 if this call removed it, 0 if it was already removed */
+/* the caller must hold a pin, or otherwise know that node has not been freed */
+int cdbll_remove(struct cdbll *list, struct cdbll_node *node);
+
+/* first node that is not removed, NULL if there is none (caller must be pinned) */
+struct cdbll_node *cdbll_first(struct cdbll *list);
+
+/* next node after `node` that is not removed (caller must be pinned) */
+struct cdbll_node *cdbll_next(struct cdbll *list, struct cdbll_node *node);
+
+/* call f on every node that is not removed, without taking locks */
+/* if f returns 0, stop iteration; returns 1 */
+int cdbll_iterate(struct cdbll *list,
+				  void *ctx,
+				  int (*f)(struct cdbll *, struct cdbll_node *, void *));
@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dbll.h"
+#include "cdbll.h"
+
+/* Mixed read/write throughput of cdbll against a mutex-protected dbll */
+
+/* usage: cdbll_bench [threads] [write percent] [seconds] [list size] */
+
+/* a read iterates over the whole list, a write inserts a node at the
+   front and removes the first node again */
+
+struct bench {
+  struct dbll *ll;
+  pthread_mutex_t lock;
+  struct cdbll *cl;
+  int write_pct;
+  int stop;
+};
+
+struct thread_result {
+  struct bench *b;
+  unsigned seed;
+  unsigned long reads;
+  unsigned long writes;
+};
+
+static int value = 1;
+
+static int dbll_sum(struct dbll *ll, struct llnode *n, void *ctx) {
+  *(long *) ctx += *(int *) n->user_data;
+  return 1;
+}
+
+static int cdbll_sum(struct cdbll *ll, struct cdbll_node *n, void *ctx) {
+  *(long *) ctx += *(int *) n->user_data;
+  return 1;
+}
+
+static void *mutex_worker(void *arg) {
+  struct thread_result *r = arg;
+  struct bench *b = r->b;
+  long sum = 0;
+
+  while(!__atomic_load_n(&b->stop, __ATOMIC_RELAXED)) {
+	if((int) (rand_r(&r->seed) % 100) < b->write_pct) {
+	  pthread_mutex_lock(&b->lock);
+	  dbll_insert_before(b->ll, NULL, &value);
+	  dbll_remove(b->ll, b->ll->first);
+	  pthread_mutex_unlock(&b->lock);
+	  r->writes++;
+	} else {
+	  pthread_mutex_lock(&b->lock);
+	  dbll_iterate(b->ll, NULL, NULL, &sum, dbll_sum);
+	  pthread_mutex_unlock(&b->lock);
+	  r->reads++;
+	}
+  }
+
+  return (void *) sum;
+}
+
+static void *cdbll_worker(void *arg) {
+  struct thread_result *r = arg;
+  struct bench *b = r->b;
+  long sum = 0;
+
+  while(!__atomic_load_n(&b->stop, __ATOMIC_RELAXED)) {
+	if((int) (rand_r(&r->seed) % 100) < b->write_pct) {
+	  cdbll_insert_after(b->cl, NULL, &value);
+	  cdbll_pin();
+	  cdbll_remove(b->cl, cdbll_first(b->cl));
+	  cdbll_unpin();
+	  r->writes++;
+	} else {
+	  cdbll_iterate(b->cl, &sum, cdbll_sum);
+	  r->reads++;
+	}
+  }
+
+  return (void *) sum;
+}
+
+static void run(const char *name, struct bench *b, void *(*worker)(void *), int nthreads, int seconds) {
+  pthread_t tids[nthreads];
+  struct thread_result res[nthreads];
+  struct timespec t0, t1;
+  unsigned long reads = 0, writes = 0;
+  double elapsed;
+  int i;
+
+  b->stop = 0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  for(i = 0; i < nthreads; i++) {
+	res[i].b = b;
+	res[i].seed = i + 1;
+	res[i].reads = res[i].writes = 0;
+	pthread_create(&tids[i], NULL, worker, &res[i]);
+  }
+
+  sleep(seconds);
+  __atomic_store_n(&b->stop, 1, __ATOMIC_RELAXED);
+
+  for(i = 0; i < nthreads; i++) {
+	pthread_join(tids[i], NULL);
+	reads += res[i].reads;
+	writes += res[i].writes;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+  printf("%-12s threads=%-3d write%%=%-3d reads/s=%-12.0f writes/s=%-12.0f total ops/s=%.0f\n",
+		 name, nthreads, b->write_pct, reads / elapsed, writes / elapsed, (reads + writes) / elapsed);
+}
+
+int main(int argc, char *argv[]) {
+  int nthreads = argc > 1 ? atoi(argv[1]) : 4;
+  int write_pct = argc > 2 ? atoi(argv[2]) : 10;
+  int seconds = argc > 3 ? atoi(argv[3]) : 2;
+  int size = argc > 4 ? atoi(argv[4]) : 1000;
+  struct bench b;
+  int i;
+
+  b.ll = dbll_create();
+  b.cl = cdbll_create();
+  b.write_pct = write_pct;
+  pthread_mutex_init(&b.lock, NULL);
+
+  for(i = 0; i < size; i++) {
+	dbll_append(b.ll, &value);
+	cdbll_append(b.cl, &value);
+  }
+
+  run("mutex-dbll", &b, mutex_worker, nthreads, seconds);
+  run("cdbll", &b, cdbll_worker, nthreads, seconds);
+
+  dbll_free(b.ll);
+  cdbll_free(b.cl);
+  pthread_mutex_destroy(&b.lock);
+  return 0;
+}
@@ -4,9 +4,27 @@
 
 /* Routines to create and manipulate a doubly-linked list */
 
+static void *dbll_malloc(size_t size, void *ctx)
+{
+  return malloc(size);
+}
+
+static void dbll_mfree(void *ptr, size_t size, void *ctx)
+{
+  free(ptr);
+}
+
 /* create a doubly-linked list */
 /* returns an empty list or NULL if memory allocation failed */
 struct dbll *dbll_create()
+{
+  return dbll_create_with_allocator(dbll_malloc, dbll_mfree, NULL);
+}
+
+/* see dbll.h */
+struct dbll *dbll_create_with_allocator(void *(*alloc_fn)(size_t, void *),
+										void (*free_fn)(void *, size_t, void *),
+										void *ctx)
 {
   struct dbll* this = (struct dbll*)malloc(sizeof(struct dbll));
   if(this == NULL){
@@ -16,21 +34,80 @@ struct dbll *dbll_create()
  // struct llnode *toLast = (struct llnode*)malloc(sizeof(struct llnode));
   this->first = NULL;
   this->last = NULL;
+  this->finger = NULL;
+  this->skip = NULL;
+  this->slabs = NULL;
+  this->pack = NULL;
+  this->pack_next = NULL;
+  this->alloc_fn = alloc_fn;
+  this->free_fn = free_fn;
+  this->alloc_ctx = ctx;
 
   return this;
 }
 
+/* the relayout block holding node, or NULL if it was allocated alone */
+static struct dbll_slab *dbll_slab_of(struct dbll *list, struct llnode *node)
+{
+  struct dbll_slab *s;
+
+  for(s = list->slabs; s != NULL; s = s->next){
+    if(node >= s->nodes && node < s->nodes + s->cap){
+      return s;
+    }
+  }
+  return NULL;
+}
+
+static void dbll_slab_release(struct dbll *list, struct dbll_slab *slab)
+{
+  struct dbll_slab **pp = &list->slabs;
+
+  while(*pp != slab){
+    pp = &(*pp)->next;
+  }
+  *pp = slab->next;
+  if(list->free_fn != NULL){
+    list->free_fn(slab, sizeof(struct dbll_slab) + slab->cap * sizeof(struct llnode), list->alloc_ctx);
+  }
+}
+
+/* free a node that is no longer in the list */
+static void dbll_node_free(struct dbll *list, struct llnode *node)
+{
+  struct dbll_slab *s = dbll_slab_of(list, node);
+
+  if(s == NULL){
+    if(list->free_fn != NULL){
+      list->free_fn(node, sizeof(struct llnode), list->alloc_ctx);
+    }
+  }
+  else if(--s->live == 0 && s != list->pack){
+    dbll_slab_release(list, s);
+  }
+}
+
 /* frees all memory associated with a doubly-linked list */
 /* this must also free all memory associated with the linked list nodes */
 /* assumes user data has already been freed */
 void dbll_free(struct dbll *list)
 {
-  struct llnode *curr = list->first;
+  /* nodes from an allocator without free_fn go away with its memory */
+  struct llnode *curr = list->free_fn != NULL ? list->first : NULL;
   while(curr != NULL){
     struct llnode *next = curr->next;
-    free(curr);
+    if(list->slabs == NULL || dbll_slab_of(list, curr) == NULL){
+      list->free_fn(curr, sizeof(struct llnode), list->alloc_ctx);
+    }
     curr = next;
   }
+  while(list->slabs != NULL){
+    dbll_slab_release(list, list->slabs);
+  }
+  if(list->skip != NULL){
+    free(list->skip->nodes);
+    free(list->skip);
+  }
   free(list);
 }
 
@@ -88,6 +165,46 @@ int dbll_iterate(struct dbll *list,
   
 
 
+/* see dbll.h */
+int dbll_iterate_batch(struct dbll *list,
+					   struct llnode *start,
+					   struct llnode *end,
+					   void *ctx,
+					   int (*f)(struct dbll *, void **, size_t, void *))
+{
+  void *batch[DBLL_BATCH];
+  struct llnode *curr = start != NULL ? start : list->first;
+  size_t n;
+
+  if(end == NULL){
+    end = list->last;
+  }
+
+  while(curr != NULL){
+    /* a node's address is only known once its predecessor is loaded,
+       so the walk itself cannot run ahead; the payload loads f will do
+       are started here instead, so that they overlap with the walk */
+    for(n = 0; n < DBLL_BATCH && curr != NULL; n++){
+      __builtin_prefetch(curr->user_data);
+      batch[n] = curr->user_data;
+      if(curr == end){
+        curr = NULL;
+        end = NULL;
+        n++;
+        break;
+      }
+      curr = curr->next;
+    }
+
+    if(f(list, batch, n, ctx) == 0){
+      return 1;
+    }
+  }
+
+  /* end was NULL (so found) or has been reached */
+  return end == NULL;
+}
+
 /* similar to dbll_iterate, except that the list is traversed using
    the prev pointer of each node (i.e. in the reverse direction).
 
@@ -134,10 +251,8 @@ int dbll_iterate_reverse(struct dbll *list,
 }
 
 
-/* Remove `llnode` from `list` */
-/* Memory associated with `node` must be freed */
-/* You can assume user_data will be freed by somebody else (or has already been freed) */
-void dbll_remove(struct dbll *list, struct llnode *node)
+/* take `node` out of `list` without freeing it */
+static void dbll_unlink(struct dbll *list, struct llnode *node)
 {
   struct llnode* pprev = node->prev;
   struct llnode* pnext = node->next;
@@ -155,9 +270,53 @@ void dbll_remove(struct dbll *list, struct llnode *node)
   else{
     list->last = pprev;
   }
-  free(node);
+}
 
-  
+/* Remove `llnode` from `list` */
+/* Memory associated with `node` must be freed */
+/* You can assume user_data will be freed by somebody else (or has already been freed) */
+void dbll_remove(struct dbll *list, struct llnode *node)
+{
+  /* keep dbll_insert_sorted from starting at a freed node */
+  if(list->finger == node){
+    list->finger = node->next != NULL ? node->next : node->prev;
+  }
+  if(list->skip != NULL){
+    list->skip->stale = 1;
+  }
+  if(list->pack_next == node){
+    list->pack_next = node->next;
+  }
+  dbll_unlink(list, node);
+  dbll_node_free(list, node);
+}
+
+/* Move `node` (already in `list`) so that it comes right before `pos` */
+/* if pos is NULL, move node to the beginning of the list */
+/* the node is relinked in place, no memory is allocated or freed */
+void dbll_move_before(struct dbll *list, struct llnode *node, struct llnode *pos)
+{
+  if(pos == NULL){
+    pos = list->first;
+  }
+  if(node == pos){
+    return;
+  }
+  if(list->pack_next == node){
+    list->pack_next = node->next;
+  }
+
+  dbll_unlink(list, node);
+
+  node->next = pos;
+  node->prev = pos->prev;
+  if(pos->prev != NULL){
+    pos->prev->next = node;
+  }
+  else{
+    list->first = node;
+  }
+  pos->prev = node;
 }
 
 /* Create and return a new node containing `user_data` */
@@ -166,18 +325,20 @@ void dbll_remove(struct dbll *list, struct llnode *node)
 /* return NULL if memory could not be allocated */
 struct llnode *dbll_insert_after(struct dbll *list, struct llnode *node, void *user_data)
 {
-   struct llnode *toInsert = malloc(sizeof(struct llnode));
+   struct llnode *toInsert = list->alloc_fn(sizeof(struct llnode), list->alloc_ctx);
   if(toInsert == NULL){
     return NULL;
   }
   toInsert->user_data = user_data;
 
   if(node != NULL){
-    struct llnode *pnext = malloc(sizeof(struct llnode));
-    pnext = node->next;
-    if(node->next != NULL){
+    struct llnode *pnext = node->next;
+    if(pnext != NULL){
       pnext->prev = toInsert;
     }
+    else{
+      list->last = toInsert;
+    }
     toInsert->next = pnext;
     node->next = toInsert;
     toInsert->prev = node;
@@ -205,7 +366,7 @@ struct llnode *dbll_insert_after(struct dbll *list, struct llnode *node, void *u
 /* return NULL if memory could not be allocated */
 struct llnode *dbll_insert_before(struct dbll *list, struct llnode *node, void *user_data)
 {
-  struct llnode *toInsert = malloc(sizeof(struct llnode));
+  struct llnode *toInsert = list->alloc_fn(sizeof(struct llnode), list->alloc_ctx);
   if(toInsert == NULL){
     return NULL;
   }
@@ -213,8 +374,7 @@ struct llnode *dbll_insert_before(struct dbll *list, struct llnode *node, void *
   toInsert->user_data = user_data;
 
   if(node != NULL){
-    struct llnode *pprev = malloc(sizeof(struct llnode));
-    pprev = node->prev;
+    struct llnode *pprev = node->prev;
     if(pprev != NULL){
       pprev->next = toInsert;
     }
@@ -228,6 +388,9 @@ struct llnode *dbll_insert_before(struct dbll *list, struct llnode *node, void *
       struct llnode *temp = list->first;
       toInsert->next = temp;
       toInsert->prev = NULL;
+      if(temp != NULL){
+          temp->prev = toInsert;
+      }
       list->first = toInsert;
       if(list->last == NULL){
           list->last = toInsert;
@@ -244,7 +407,7 @@ struct llnode *dbll_insert_before(struct dbll *list, struct llnode *node, void *
 /* this function is a convenience function and can use the dbll_insert_after function */
 struct llnode *dbll_append(struct dbll *list, void *user_data)
 { 
-  struct llnode *toAppend = (struct llnode*)malloc(sizeof(struct llnode));
+  struct llnode *toAppend = (struct llnode*)list->alloc_fn(sizeof(struct llnode), list->alloc_ctx);
   if(toAppend == NULL){
     return NULL;
 
@@ -262,3 +425,229 @@ struct llnode *dbll_append(struct dbll *list, void *user_data)
   return toAppend;
  
 }
+
+/* sample every DBLL_SKIP_STRIDE-th node of list into its skip index */
+/* return 0 if memory could not be allocated */
+static int dbll_skip_build(struct dbll *list)
+{
+  struct dbll_skip *s = list->skip;
+  struct llnode *curr;
+  size_t count = 0, need;
+
+  for(curr = list->first; curr != NULL; curr = curr->next){
+    count++;
+  }
+  need = count / DBLL_SKIP_STRIDE + 1;
+
+  if(s == NULL){
+    s = calloc(1, sizeof(struct dbll_skip));
+    if(s == NULL){
+      return 0;
+    }
+    list->skip = s;
+  }
+  if(s->cap < need){
+    struct llnode **nodes = realloc(s->nodes, need * sizeof(struct llnode *));
+    if(nodes == NULL){
+      return 0;
+    }
+    s->nodes = nodes;
+    s->cap = need;
+  }
+
+  s->n = 0;
+  count = 0;
+  for(curr = list->first; curr != NULL; curr = curr->next){
+    if(count++ % DBLL_SKIP_STRIDE == 0){
+      s->nodes[s->n++] = curr;
+    }
+  }
+  s->count = count;
+  s->ops = 0;
+  s->stale = 0;
+  return 1;
+}
+
+/* set *pos to the last sampled node that is <= user_data (NULL if
+   there is none), rebuilding the index first if it is stale or its
+   samples have drifted apart */
+/* return 0 if there is no usable index; a rebuild walks the whole
+   list, so it waits until enough inserts have been made to pay for it */
+static int dbll_skip_seek(struct dbll *list, void *user_data,
+						  int (*cmp)(const void *, const void *),
+						  struct llnode **pos)
+{
+  struct dbll_skip *s = list->skip;
+  size_t lo = 0, hi, mid;
+
+  if(s == NULL || s->stale || s->ops >= s->count){
+    if(s != NULL && s->ops < s->count / DBLL_SKIP_STRIDE){
+      return 0;
+    }
+    if(!dbll_skip_build(list)){
+      return 0;
+    }
+    s = list->skip;
+  }
+
+  /* first sample that is > user_data */
+  hi = s->n;
+  while(lo < hi){
+    mid = lo + (hi - lo) / 2;
+    if(cmp(user_data, s->nodes[mid]->user_data) >= 0){
+      lo = mid + 1;
+    }
+    else{
+      hi = mid;
+    }
+  }
+
+  *pos = lo > 0 ? s->nodes[lo - 1] : NULL;
+  return 1;
+}
+
+/* see dbll.h */
+struct llnode *dbll_insert_sorted(struct dbll *list, void *user_data,
+								  int (*cmp)(const void *, const void *),
+								  struct llnode *hint)
+{
+  struct llnode *pos = hint != NULL ? hint : list->finger;
+  struct llnode *node, *sample;
+  size_t steps = 0;
+
+  if(pos == NULL){
+    pos = list->first;
+  }
+  if(list->skip != NULL){
+    list->skip->ops++;
+  }
+
+  /* back to a node that is <= user_data, or NULL if there is none */
+  while(pos != NULL && cmp(user_data, pos->user_data) < 0){
+    if(++steps == DBLL_SKIP_WALK && dbll_skip_seek(list, user_data, cmp, &pos)){
+      break;
+    }
+    pos = pos->prev;
+  }
+
+  if(pos == NULL && list->first != NULL && cmp(user_data, list->first->user_data) >= 0){
+    pos = list->first;
+  }
+
+  /* forward to the last node that is <= user_data */
+  while(pos != NULL && pos->next != NULL && cmp(user_data, pos->next->user_data) >= 0){
+    pos = pos->next;
+    if(++steps == DBLL_SKIP_WALK && dbll_skip_seek(list, user_data, cmp, &sample) &&
+       sample != NULL && cmp(sample->user_data, pos->user_data) > 0){
+      pos = sample;
+    }
+  }
+
+  if(pos == NULL){
+    node = dbll_insert_before(list, NULL, user_data);
+  }
+  else{
+    node = dbll_insert_after(list, pos, user_data);
+  }
+
+  if(node != NULL){
+    list->finger = node;
+  }
+  return node;
+}
+
+/* see dbll.h */
+int dbll_relayout_step(struct dbll *list, size_t budget, void *ctx,
+					   void (*remap)(struct dbll *, struct llnode *, struct llnode *, void *))
+{
+  struct dbll_slab *s = list->pack;
+  struct llnode *node, *to;
+  size_t count = 0;
+
+  if(s == NULL){
+    for(node = list->first; node != NULL; node = node->next){
+      count++;
+    }
+    if(count == 0){
+      return 1;
+    }
+
+    s = list->alloc_fn(sizeof(struct dbll_slab) + count * sizeof(struct llnode), list->alloc_ctx);
+    if(s == NULL){
+      return -1;
+    }
+    s->cap = count;
+    s->used = 0;
+    s->live = 0;
+    s->next = list->slabs;
+    list->slabs = s;
+    list->pack = s;
+    list->pack_next = list->first;
+  }
+
+  while(budget > 0 && list->pack_next != NULL && s->used < s->cap){
+    node = list->pack_next;
+    list->pack_next = node->next;
+
+    /* moved ahead of the pass by dbll_move_before */
+    if(node >= s->nodes && node < s->nodes + s->used){
+      continue;
+    }
+
+    to = &s->nodes[s->used++];
+    *to = *node;
+    s->live++;
+    if(to->prev != NULL){
+      to->prev->next = to;
+    }
+    else{
+      list->first = to;
+    }
+    if(to->next != NULL){
+      to->next->prev = to;
+    }
+    else{
+      list->last = to;
+    }
+
+    if(list->finger == node){
+      list->finger = to;
+    }
+    if(list->skip != NULL){
+      list->skip->stale = 1;
+    }
+    if(remap != NULL){
+      remap(list, node, to, ctx);
+    }
+    dbll_node_free(list, node);
+    budget--;
+  }
+
+  if(list->pack_next != NULL && s->used < s->cap){
+    return 0;
+  }
+
+  list->pack = NULL;
+  list->pack_next = NULL;
+  if(s->live == 0){
+    dbll_slab_release(list, s);
+  }
+  return 1;
+}
+
+/* see dbll.h */
+int dbll_relayout(struct dbll *list, void *ctx,
+				  void (*remap)(struct dbll *, struct llnode *, struct llnode *, void *))
+{
+  struct dbll_slab *s = list->pack;
+
+  if(s != NULL){
+    list->pack = NULL;
+    list->pack_next = NULL;
+    if(s->live == 0){
+      dbll_slab_release(list, s);
+    }
+  }
+
+  return dbll_relayout_step(list, (size_t) -1, ctx, remap) == 1;
+}
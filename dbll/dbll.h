@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 
 /* structure that holds each node of a doubly-linked list */
 /* Must satisfy the following invariants at all times */
@@ -12,30 +13,127 @@ struct llnode {
   struct llnode *prev;  /* prev node in linked list, NULL if this is the first node */
 };
 
+/* every DBLL_SKIP_STRIDE-th node of a sorted list, in list order, so
+   that dbll_insert_sorted can binary search for a starting point */
+/* Invariant: unless stale, every sampled node is still in the list */
+struct dbll_skip {
+  struct llnode **nodes;
+  size_t n;                   /* samples in nodes */
+  size_t cap;
+  size_t count;               /* list length when the samples were taken */
+  size_t ops;                 /* dbll_insert_sorted calls since then */
+  int stale;                  /* a node was removed since then */
+};
+
+/* nodes a dbll_insert_sorted search walks before using the skip index */
+#define DBLL_SKIP_WALK 8
+/* nodes per skip index sample */
+#define DBLL_SKIP_STRIDE 16
+
+/* block of nodes allocated at once by dbll_relayout; it is freed when
+   the last of its nodes leaves it */
+struct dbll_slab {
+  struct dbll_slab *next;
+  size_t cap;                 /* nodes in the block */
+  size_t used;                /* nodes filled so far */
+  size_t live;                /* filled nodes that are still in the list */
+  struct llnode nodes[];
+};
+
 /* structure for the doubly-linked list */
 /* Invariant: first and last are both NULL in an empty list */
 struct dbll {
   struct llnode *first;
   struct llnode *last;
+  struct llnode *finger;      /* node last inserted by dbll_insert_sorted, or NULL */
+  struct dbll_skip *skip;     /* built by dbll_insert_sorted once it needs it, or NULL */
+  struct dbll_slab *slabs;    /* node blocks made by dbll_relayout, newest first */
+  struct dbll_slab *pack;     /* block an unfinished relayout pass is filling, or NULL */
+  struct llnode *pack_next;   /* node that pass moves next */
+  void *(*alloc_fn)(size_t, void *);  /* node memory, see dbll_create_with_allocator */
+  void (*free_fn)(void *, size_t, void *);  /* NULL if nodes are never freed one by one */
+  void *alloc_ctx;
 };
 
 struct dbll *dbll_create();
 
+/* create a list whose nodes (and dbll_relayout blocks) are allocated
+   with alloc_fn(size, ctx) and freed with free_fn(ptr, size, ctx), size
+   being the one they were allocated with, e.g. from a struct
+   memory_pool or an arena; the list header and the skip index still
+   use malloc */
+/* if free_fn is NULL, nodes are never freed: dbll_remove just unlinks
+   them and dbll_free does not walk the list, so that the memory can be
+   dropped at once with the arena it came from */
+/* returns an empty list or NULL if memory allocation failed */
+struct dbll *dbll_create_with_allocator(void *(*alloc_fn)(size_t, void *),
+										void (*free_fn)(void *, size_t, void *),
+										void *ctx);
+
 struct llnode *dbll_append(struct dbll *list, void *user_data);
 
 void dbll_remove(struct dbll *list, struct llnode *node);
 
+void dbll_move_before(struct dbll *list, struct llnode *node, struct llnode *pos);
+
 struct llnode *dbll_insert_after(struct dbll *list, struct llnode *node, void *user_data);
 struct llnode *dbll_insert_before(struct dbll *list, struct llnode *node, void *user_data);
 
 void dbll_free(struct dbll *list);
 
+/* insert user_data into a list kept sorted by cmp (which compares two
+   user_data pointers like qsort), after any nodes that compare equal */
+/* the search starts from hint if it is not NULL, else from the node
+   inserted last, and walks towards the insertion point; long walks
+   continue from the closest sample of a skip index, so inserts near
+   the previous one cost O(1) and others O(log n) */
+/* the list must be sorted; nodes may be added by other functions as
+   long as it stays sorted */
+/* return NULL if memory could not be allocated */
+struct llnode *dbll_insert_sorted(struct dbll *list, void *user_data,
+								  int (*cmp)(const void *, const void *),
+								  struct llnode *hint);
+
+/* copy every node into one contiguous block, in list order, so that a
+   walk over the list reads memory sequentially; the old nodes are freed */
+/* remap (if not NULL) is called for every node that moves, with its old
+   and new address, before the old one is freed */
+/* an unfinished dbll_relayout_step pass is abandoned and the whole list
+   is packed again */
+/* return 0 if memory could not be allocated; the list is unchanged then */
+int dbll_relayout(struct dbll *list, void *ctx,
+				  void (*remap)(struct dbll *, struct llnode *, struct llnode *, void *));
+
+/* incremental dbll_relayout: move at most `budget` nodes, starting a
+   pass (and allocating its block) if none is in progress */
+/* the list may be changed freely between steps; nodes added behind the
+   pass, or once its block is full, are left where they are */
+/* return 1 when the pass is complete, 0 if nodes remain to be moved,
+   -1 if memory could not be allocated */
+int dbll_relayout_step(struct dbll *list, size_t budget, void *ctx,
+					   void (*remap)(struct dbll *, struct llnode *, struct llnode *, void *));
+
 int dbll_iterate(struct dbll *list,
 				 struct llnode *start,
 				 struct llnode *end,
 				 void *ctx,
 				 int (*f)(struct dbll *, struct llnode *, void *));
 
+/* user_data pointers handed to a dbll_iterate_batch callback at once */
+#define DBLL_BATCH 64
+
+/* like dbll_iterate, but f receives the user_data of up to DBLL_BATCH
+   consecutive nodes per call, in list order, so that per-element work
+   runs in a plain loop; payloads are prefetched as the nodes are
+   walked */
+/* if f returns 0, stop iteration and return 1 */
+/* return 0 if the end of the list was reached without encountering end */
+int dbll_iterate_batch(struct dbll *list,
+					   struct llnode *start,
+					   struct llnode *end,
+					   void *ctx,
+					   int (*f)(struct dbll *, void **, size_t, void *));
+
 int dbll_iterate_reverse(struct dbll *list,
 						 struct llnode *start,
 						 struct llnode *end,
@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "dbll.h"
+#include "th_perf.h"
+
+/* ns per element summing a payload field over a list: dbll_iterate, a
+   hand-written loop over next pointers, and dbll_iterate_batch */
+
+/* usage: dbll_batch_bench [max list size] */
+
+/* "sequential" lists have nodes and payloads in allocation order;
+   "scattered" ones are relinked in random order and point at payloads
+   in random order, so that every step is a cache miss on large lists;
+   "relayout" lists are scattered ones after dbll_relayout, whose cost
+   per node is printed as well */
+
+/* hardware counters per element go to stderr (see th_perf.h) */
+
+struct payload {
+  double value;
+  char pad[56];               /* one payload per cache line */
+};
+
+static struct th_perf perf;
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int sum_one(struct dbll *ll, struct llnode *n, void *ctx) {
+  *(double *) ctx += ((struct payload *) n->user_data)->value;
+  return 1;
+}
+
+static int sum_batch(struct dbll *ll, void **data, size_t n, void *ctx) {
+  double s = 0;
+  size_t i;
+
+  for(i = 0; i < n; i++)
+	s += ((struct payload *) data[i])->value;
+  *(double *) ctx += s;
+  return 1;
+}
+
+static void shuffle(long *a, long n) {
+  long i, j, t;
+  for(i = n - 1; i > 0; i--) {
+	j = ((long) rand() * RAND_MAX + rand()) % (i + 1);
+	t = a[i]; a[i] = a[j]; a[j] = t;
+  }
+}
+
+static struct dbll *build(struct payload *payloads, long n, int scattered) {
+  struct dbll *ll = dbll_create();
+  struct llnode **nodes = malloc(n * sizeof(*nodes));
+  long *perm = malloc(n * sizeof(long));
+  long i;
+
+  for(i = 0; i < n; i++)
+	perm[i] = i;
+  if(scattered)
+	shuffle(perm, n);
+
+  for(i = 0; i < n; i++)
+	nodes[i] = dbll_append(ll, &payloads[perm[i]]);
+
+  if(scattered) {
+	/* relink the nodes in another random order */
+	shuffle(perm, n);
+	for(i = 0; i < n; i++)
+	  dbll_move_before(ll, nodes[perm[i]], NULL);
+  }
+
+  free(perm);
+  free(nodes);
+  return ll;
+}
+
+static double timed(struct dbll *ll, long n, int how, const char *label) {
+  double sum = 0;
+  struct llnode *curr;
+  long reps = 10000000 / n > 0 ? 10000000 / n : 1, r;
+
+  th_perf_reset(&perf);
+  for(r = 0; r < reps; r++) {
+	th_perf_start(&perf);
+	switch(how) {
+	case 0:
+	  dbll_iterate(ll, NULL, NULL, &sum, sum_one);
+	  break;
+	case 1:
+	  for(curr = ll->first; curr != NULL; curr = curr->next)
+		sum += ((struct payload *) curr->user_data)->value;
+	  break;
+	case 2:
+	  dbll_iterate_batch(ll, NULL, NULL, &sum, sum_batch);
+	  break;
+	}
+	th_perf_stop(&perf);
+  }
+  th_perf_report(&perf, label, n * reps);
+
+  if(sum != (double) n * (n - 1) / 2 * reps)
+	fprintf(stderr, "%s: wrong sum %f\n", label, sum);
+  return (double) perf.ns / (n * reps);
+}
+
+int main(int argc, char *argv[]) {
+  long max = argc > 1 ? atol(argv[1]) : 4000000;
+  const char *layouts[] = { "sequential", "scattered", "relayout" };
+  char label[128];
+  double t[3], t0, t_relayout = 0;
+  long n, i;
+  int s;
+
+  th_perf_init(&perf);
+  printf("%-10s %-11s %14s %14s %14s\n", "size", "layout", "iterate", "loop", "iterate_batch");
+
+  for(n = 10000; n <= max; n *= 10) {
+	struct payload *payloads = malloc(n * sizeof(struct payload));
+	for(i = 0; i < n; i++)
+	  payloads[i].value = i;
+
+	for(s = 0; s < 3; s++) {
+	  struct dbll *ll;
+
+	  srand(1);
+	  ll = build(payloads, n, s > 0);
+	  if(s == 2) {
+		t0 = now_ns();
+		dbll_relayout(ll, NULL, NULL);
+		t_relayout = (now_ns() - t0) / n;
+	  }
+	  snprintf(label, sizeof(label), "dbll_iterate, %s, size %ld", layouts[s], n);
+	  t[0] = timed(ll, n, 0, label);
+	  snprintf(label, sizeof(label), "loop, %s, size %ld", layouts[s], n);
+	  t[1] = timed(ll, n, 1, label);
+	  snprintf(label, sizeof(label), "dbll_iterate_batch, %s, size %ld", layouts[s], n);
+	  t[2] = timed(ll, n, 2, label);
+	  printf("%-10ld %-11s %14.2f %14.2f %14.2f\n", n, layouts[s], t[0], t[1], t[2]);
+	  dbll_free(ll);
+	}
+	printf("%-10ld dbll_relayout %.2f ns/node\n", n, t_relayout);
+
+	free(payloads);
+	if(n * 10 > max && n != max)
+	  n = max / 10;
+  }
+
+  th_perf_close(&perf);
+  return 0;
+}
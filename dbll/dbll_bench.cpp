@@ -0,0 +1,314 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <vector>
+
+extern "C" {
+#include "dbll.h"
+}
+#include "th_perf.h"
+
+/* ns/op for every dbll operation, next to std::list and std::vector
+   doing the same work, written as CSV */
+
+/* usage: dbll_bench [csv file] [max list size] */
+
+/* CSV columns: impl,op,where,size,ops,ns_per_op */
+
+/* hardware counters per element for forward iteration go to stderr
+   (see th_perf.h) */
+
+/* whole-list operations (append, iterate, free) are repeated until at
+   least MIN_OPS elements have been processed; positional operations
+   (insert, remove) do up to POS_OPS operations on a list of `size`
+   elements, fewer for std::vector where each one is O(size) */
+
+static const long MIN_OPS = 1000000;
+static const long POS_OPS = 1000;
+static const long VECTOR_BUDGET = 100000000; /* elements moved per positional vector test */
+
+static FILE *out;
+static int values[1024];
+static struct th_perf perf;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double elapsed_ns(bench_clock::time_point t0) {
+  return std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count();
+}
+
+static void emit(const char *impl, const char *op, const char *where, long size, long ops, double ns) {
+  fprintf(out, "%s,%s,%s,%ld,%ld,%.2f\n", impl, op, where, size, ops, ns / ops);
+  fflush(out);
+}
+
+static void report_iterate(const char *impl, long size, long ops) {
+  char label[64];
+  snprintf(label, sizeof(label), "%s iterate forward, size %ld", impl, size);
+  th_perf_report(&perf, label, ops);
+}
+
+static void *payload(long i) {
+  return &values[i % 1024];
+}
+
+static int sum_values(struct dbll *ll, struct llnode *n, void *ctx) {
+  *(long *) ctx += *(int *) n->user_data;
+  return 1;
+}
+
+static struct dbll *build_dbll(long n) {
+  struct dbll *ll = dbll_create();
+  for(long i = 0; i < n; i++)
+	dbll_append(ll, payload(i));
+  return ll;
+}
+
+static struct llnode *dbll_at(struct dbll *ll, long i) {
+  struct llnode *curr = ll->first;
+  while(i-- > 0)
+	curr = curr->next;
+  return curr;
+}
+
+static volatile long sink;
+
+/* dbll */
+
+static void bench_dbll(long n) {
+  long reps = MIN_OPS / n > 0 ? MIN_OPS / n : 1;
+  long pos_ops = n < POS_OPS ? n : POS_OPS;
+  double t_append = 0, t_fwd = 0, t_rev = 0, t_free = 0;
+
+  th_perf_reset(&perf);
+  for(long r = 0; r < reps; r++) {
+	auto t0 = bench_clock::now();
+	struct dbll *ll = build_dbll(n);
+	t_append += elapsed_ns(t0);
+
+	long sum = 0;
+	t0 = bench_clock::now();
+	th_perf_start(&perf);
+	dbll_iterate(ll, NULL, NULL, &sum, sum_values);
+	th_perf_stop(&perf);
+	t_fwd += elapsed_ns(t0);
+
+	t0 = bench_clock::now();
+	dbll_iterate_reverse(ll, NULL, NULL, &sum, sum_values);
+	t_rev += elapsed_ns(t0);
+	sink = sum;
+
+	t0 = bench_clock::now();
+	dbll_free(ll);
+	t_free += elapsed_ns(t0);
+  }
+
+  report_iterate("dbll", n, n * reps);
+  emit("dbll", "append", "tail", n, n * reps, t_append);
+  emit("dbll", "iterate", "forward", n, n * reps, t_fwd);
+  emit("dbll", "iterate", "reverse", n, n * reps, t_rev);
+  emit("dbll", "free", "all", n, n * reps, t_free);
+
+  const char *wheres[] = { "head", "middle", "tail" };
+  for(int w = 0; w < 3; w++) {
+	struct dbll *ll = build_dbll(n);
+	struct llnode *at = w == 0 ? ll->first : w == 1 ? dbll_at(ll, n / 2) : ll->last;
+
+	auto t0 = bench_clock::now();
+	for(long i = 0; i < pos_ops; i++)
+	  dbll_insert_before(ll, at, payload(i));
+	emit("dbll", "insert_before", wheres[w], n, pos_ops, elapsed_ns(t0));
+
+	t0 = bench_clock::now();
+	for(long i = 0; i < pos_ops; i++)
+	  dbll_insert_after(ll, at, payload(i));
+	emit("dbll", "insert_after", wheres[w], n, pos_ops, elapsed_ns(t0));
+
+	/* remove up to pos_ops nodes starting at the position, moving towards
+	   the tail (towards the head for "tail"), from the list the inserts
+	   left, as for std::list and std::vector */
+	long removed = 0;
+	t0 = bench_clock::now();
+	for(; removed < pos_ops && at != NULL; removed++) {
+	  struct llnode *next = w == 2 ? at->prev : at->next;
+	  dbll_remove(ll, at);
+	  at = next;
+	}
+	emit("dbll", "remove", wheres[w], n, removed, elapsed_ns(t0));
+
+	dbll_free(ll);
+  }
+}
+
+/* std::list */
+
+static void bench_list(long n) {
+  long reps = MIN_OPS / n > 0 ? MIN_OPS / n : 1;
+  long pos_ops = n < POS_OPS ? n : POS_OPS;
+  double t_append = 0, t_fwd = 0, t_rev = 0, t_free = 0;
+
+  th_perf_reset(&perf);
+  for(long r = 0; r < reps; r++) {
+	auto t0 = bench_clock::now();
+	auto *l = new std::list<void *>;
+	for(long i = 0; i < n; i++)
+	  l->push_back(payload(i));
+	t_append += elapsed_ns(t0);
+
+	long sum = 0;
+	t0 = bench_clock::now();
+	th_perf_start(&perf);
+	for(auto it = l->begin(); it != l->end(); ++it)
+	  sum += *(int *) *it;
+	th_perf_stop(&perf);
+	t_fwd += elapsed_ns(t0);
+
+	t0 = bench_clock::now();
+	for(auto it = l->rbegin(); it != l->rend(); ++it)
+	  sum += *(int *) *it;
+	t_rev += elapsed_ns(t0);
+	sink = sum;
+
+	t0 = bench_clock::now();
+	delete l;
+	t_free += elapsed_ns(t0);
+  }
+
+  report_iterate("std::list", n, n * reps);
+  emit("std::list", "append", "tail", n, n * reps, t_append);
+  emit("std::list", "iterate", "forward", n, n * reps, t_fwd);
+  emit("std::list", "iterate", "reverse", n, n * reps, t_rev);
+  emit("std::list", "free", "all", n, n * reps, t_free);
+
+  const char *wheres[] = { "head", "middle", "tail" };
+  for(int w = 0; w < 3; w++) {
+	std::list<void *> l;
+	for(long i = 0; i < n; i++)
+	  l.push_back(payload(i));
+
+	auto at = l.begin();
+	if(w == 1) std::advance(at, n / 2);
+	if(w == 2) at = std::prev(l.end());
+
+	auto t0 = bench_clock::now();
+	for(long i = 0; i < pos_ops; i++)
+	  l.insert(at, payload(i));
+	emit("std::list", "insert_before", wheres[w], n, pos_ops, elapsed_ns(t0));
+
+	t0 = bench_clock::now();
+	for(long i = 0; i < pos_ops; i++)
+	  l.insert(std::next(at), payload(i));
+	emit("std::list", "insert_after", wheres[w], n, pos_ops, elapsed_ns(t0));
+
+	long removed = 0;
+	t0 = bench_clock::now();
+	for(; removed < pos_ops && at != l.end(); removed++) {
+	  if(w == 2) {
+		auto prev = at == l.begin() ? l.end() : std::prev(at);
+		l.erase(at);
+		at = prev;
+	  } else {
+		at = l.erase(at);
+	  }
+	}
+	emit("std::list", "remove", wheres[w], n, removed, elapsed_ns(t0));
+  }
+}
+
+/* std::vector */
+
+static void bench_vector(long n) {
+  long reps = MIN_OPS / n > 0 ? MIN_OPS / n : 1;
+  long pos_ops = n < POS_OPS ? n : POS_OPS;
+  double t_append = 0, t_fwd = 0, t_rev = 0, t_free = 0;
+
+  for(long r = 0; r < reps; r++) {
+	auto t0 = bench_clock::now();
+	auto *v = new std::vector<void *>;
+	for(long i = 0; i < n; i++)
+	  v->push_back(payload(i));
+	t_append += elapsed_ns(t0);
+
+	long sum = 0;
+	t0 = bench_clock::now();
+	for(auto it = v->begin(); it != v->end(); ++it)
+	  sum += *(int *) *it;
+	t_fwd += elapsed_ns(t0);
+
+	t0 = bench_clock::now();
+	for(auto it = v->rbegin(); it != v->rend(); ++it)
+	  sum += *(int *) *it;
+	t_rev += elapsed_ns(t0);
+	sink = sum;
+
+	t0 = bench_clock::now();
+	delete v;
+	t_free += elapsed_ns(t0);
+  }
+
+  emit("std::vector", "append", "tail", n, n * reps, t_append);
+  emit("std::vector", "iterate", "forward", n, n * reps, t_fwd);
+  emit("std::vector", "iterate", "reverse", n, n * reps, t_rev);
+  emit("std::vector", "free", "all", n, n * reps, t_free);
+
+  long vec_ops = VECTOR_BUDGET / n;
+  if(vec_ops < 1) vec_ops = 1;
+  if(vec_ops > pos_ops) vec_ops = pos_ops;
+
+  const char *wheres[] = { "head", "middle", "tail" };
+  for(int w = 0; w < 3; w++) {
+	std::vector<void *> v;
+	for(long i = 0; i < n; i++)
+	  v.push_back(payload(i));
+
+	/* positions are indices, fixed relative to the original elements */
+	long at = w == 0 ? 0 : w == 1 ? n / 2 : n - 1;
+
+	auto t0 = bench_clock::now();
+	for(long i = 0; i < vec_ops; i++, at++)
+	  v.insert(v.begin() + at, payload(i));
+	emit("std::vector", "insert_before", wheres[w], n, vec_ops, elapsed_ns(t0));
+
+	t0 = bench_clock::now();
+	for(long i = 0; i < vec_ops; i++)
+	  v.insert(v.begin() + at + 1, payload(i));
+	emit("std::vector", "insert_after", wheres[w], n, vec_ops, elapsed_ns(t0));
+
+	long removed = 0;
+	t0 = bench_clock::now();
+	for(; removed < vec_ops && at >= 0 && at < (long) v.size(); removed++) {
+	  v.erase(v.begin() + at);
+	  if(w == 2) at--;
+	}
+	emit("std::vector", "remove", wheres[w], n, removed, elapsed_ns(t0));
+  }
+}
+
+int main(int argc, char *argv[]) {
+  long max_size = argc > 2 ? atol(argv[2]) : 10000000;
+
+  out = stdout;
+  if(argc > 1 && (out = fopen(argv[1], "w")) == NULL) {
+	perror(argv[1]);
+	return 1;
+  }
+
+  for(int i = 0; i < 1024; i++)
+	values[i] = i;
+
+  th_perf_init(&perf);
+  fprintf(out, "impl,op,where,size,ops,ns_per_op\n");
+
+  for(long n = 10; n <= max_size; n *= 10) {
+	bench_dbll(n);
+	bench_list(n);
+	bench_vector(n);
+  }
+
+  th_perf_close(&perf);
+  if(out != stdout)
+	fclose(out);
+
+  return 0;
+}
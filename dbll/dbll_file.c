@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dbll_file.h"
+
+/* Routines to save a doubly-linked list to a file and map it back (see dbll_file.h) */
+
+#define DBLL_FILE_PAD(n) (((n) + 7) & ~(size_t) 7)
+
+/* bytes taken by one record */
+static size_t dbll_file_stride(size_t payload_size)
+{
+  return sizeof(struct dbll_frec) + DBLL_FILE_PAD(payload_size);
+}
+
+/* see dbll_file.h */
+int dbll_save(struct dbll *list, size_t payload_size, const char *path)
+{
+  struct dbll_fheader hdr;
+  struct dbll_frec rec;
+  struct llnode *curr;
+  static const char zero[8];
+  size_t stride = dbll_file_stride(payload_size);
+  size_t pad = DBLL_FILE_PAD(payload_size) - payload_size;
+  FILE *f;
+  int ok;
+
+  if(payload_size > UINT32_MAX)
+    return 0;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, DBLL_FILE_MAGIC, sizeof(hdr.magic));
+  hdr.version = DBLL_FILE_VERSION;
+  hdr.payload_size = payload_size;
+  for(curr = list->first; curr != NULL; curr = curr->next)
+    hdr.count++;
+  if(hdr.count > 0) {
+    hdr.first = sizeof(hdr);
+    hdr.last = sizeof(hdr) + (hdr.count - 1) * stride;
+  }
+
+  f = fopen(path, "wb");
+  if(f == NULL)
+    return 0;
+
+  ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+
+  /* records are written in list order, so every link is one stride */
+  for(curr = list->first; ok && curr != NULL; curr = curr->next) {
+    rec.next = curr->next ? (int64_t) stride : 0;
+    rec.prev = curr->prev ? -(int64_t) stride : 0;
+    ok = fwrite(&rec, sizeof(rec), 1, f) == 1 &&
+      (payload_size == 0 || fwrite(curr->user_data, payload_size, 1, f) == 1) &&
+      (pad == 0 || fwrite(zero, pad, 1, f) == 1);
+  }
+
+  if(fclose(f) != 0)
+    ok = 0;
+  if(!ok)
+    remove(path);
+  return ok;
+}
+
+/* see dbll_file.h */
+struct dbll_map *dbll_map_file(const char *path)
+{
+  struct dbll_map *m;
+  const struct dbll_fheader *hdr;
+  struct stat st;
+  size_t stride;
+  void *base;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0)
+    return NULL;
+
+  if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct dbll_fheader)) {
+    close(fd);
+    return NULL;
+  }
+
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED)
+    return NULL;
+
+  /* the records must exactly fill the rest of the file */
+  hdr = base;
+  stride = dbll_file_stride(hdr->payload_size);
+  if(memcmp(hdr->magic, DBLL_FILE_MAGIC, sizeof(hdr->magic)) != 0 ||
+     hdr->version != DBLL_FILE_VERSION ||
+     hdr->count != ((size_t) st.st_size - sizeof(*hdr)) / stride ||
+     sizeof(*hdr) + hdr->count * stride != (size_t) st.st_size ||
+     hdr->first != (hdr->count ? sizeof(*hdr) : 0) ||
+     hdr->last != (hdr->count ? sizeof(*hdr) + (hdr->count - 1) * stride : 0)) {
+    munmap(base, st.st_size);
+    return NULL;
+  }
+
+  m = malloc(sizeof(struct dbll_map));
+  if(m == NULL) {
+    munmap(base, st.st_size);
+    return NULL;
+  }
+
+  m->base = base;
+  m->len = st.st_size;
+  m->hdr = hdr;
+  m->stride = stride;
+  return m;
+}
+
+/* see dbll_file.h */
+void dbll_unmap(struct dbll_map *m)
+{
+  munmap((void *) m->base, m->len);
+  free(m);
+}
+
+/* see dbll_file.h */
+int dbll_map_iterate(struct dbll_map *m,
+					 void *ctx,
+					 int (*f)(struct dbll_map *, const struct dbll_frec *, void *))
+{
+  const struct dbll_frec *r;
+
+  for(r = dbll_map_first(m); r != NULL; r = dbll_map_next(m, r)) {
+    if(!f(m, r, ctx))
+      return 1;
+  }
+  return 1;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "dbll.h"
+
+/* On-disk lists: dbll_save writes a list with fixed-size payloads to a
+   file, dbll_map_file maps it back as a read-only list without
+   allocating or parsing anything per node */
+
+/* The file is a header followed by one record per node, in list order.
+   A record holds its links as byte offsets relative to itself followed
+   by a copy of the node's payload padded to 8 bytes. Since records are
+   in list order, every link is one record's size; readers step by that
+   size between the header's first and last record and never follow the
+   stored links, so a corrupt record cannot lead a walk out of the file.
+   Integers are in host byte order; files are not portable between
+   architectures. */
+
+#define DBLL_FILE_MAGIC "DBLLFIL"
+#define DBLL_FILE_VERSION 1
+
+struct dbll_fheader {
+  char magic[8];              /* DBLL_FILE_MAGIC */
+  uint32_t version;           /* DBLL_FILE_VERSION */
+  uint32_t payload_size;      /* bytes of payload per record */
+  uint64_t count;             /* number of records */
+  uint64_t first;             /* offset of the first record in the file, 0 if empty */
+  uint64_t last;              /* offset of the last record in the file, 0 if empty */
+};
+
+struct dbll_frec {
+  int64_t next;               /* offset from this record to the next one, 0 for the last (not read) */
+  int64_t prev;               /* offset from this record to the previous one, 0 for the first (not read) */
+  /* payload follows */
+};
+
+/* a mapped file */
+struct dbll_map {
+  const char *base;
+  size_t len;
+  const struct dbll_fheader *hdr;
+  size_t stride;              /* bytes per record */
+};
+
+/* write the nodes of list to path, taking payload_size bytes from each
+   node's user_data */
+/* return 1 on success, 0 if the file could not be written */
+int dbll_save(struct dbll *list, size_t payload_size, const char *path);
+
+/* map a file written by dbll_save */
+/* only the header and the file size are checked, so records are read
+   lazily as they are visited */
+/* return NULL if the file cannot be mapped or is not a list file */
+struct dbll_map *dbll_map_file(const char *path);
+
+void dbll_unmap(struct dbll_map *m);
+
+static inline const struct dbll_frec *dbll_map_first(const struct dbll_map *m)
+{
+  return m->hdr->first ? (const struct dbll_frec *) (m->base + m->hdr->first) : NULL;
+}
+
+static inline const struct dbll_frec *dbll_map_last(const struct dbll_map *m)
+{
+  return m->hdr->last ? (const struct dbll_frec *) (m->base + m->hdr->last) : NULL;
+}
+
+static inline const struct dbll_frec *dbll_map_next(const struct dbll_map *m, const struct dbll_frec *r)
+{
+  return (uint64_t) ((const char *) r - m->base) == m->hdr->last ? NULL : (const struct dbll_frec *) ((const char *) r + m->stride);
+}
+
+static inline const struct dbll_frec *dbll_map_prev(const struct dbll_map *m, const struct dbll_frec *r)
+{
+  return (uint64_t) ((const char *) r - m->base) == m->hdr->first ? NULL : (const struct dbll_frec *) ((const char *) r - m->stride);
+}
+
+/* payload of a record, aligned to 8 bytes */
+static inline const void *dbll_map_data(const struct dbll_frec *r)
+{
+  return r + 1;
+}
+
+/* call f on every record from first to last; if f returns 0, stop */
+/* return 1 */
+int dbll_map_iterate(struct dbll_map *m,
+					 void *ctx,
+					 int (*f)(struct dbll_map *, const struct dbll_frec *, void *));
@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "dbll.h"
+#include "dbll_file.h"
+
+/* Startup cost of getting a large list back: parsing text input into
+   malloc'd payloads and dbll_append, against dbll_map_file of a file
+   written by dbll_save, with the file in the page cache and evicted */
+
+/* usage: dbll_file_bench [items] [directory for the files] */
+
+struct item {
+  long id;
+  double value;
+};
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* drop the file from the page cache */
+static void evict(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if(fd >= 0) {
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+  }
+}
+
+static int sum_record(struct dbll_map *m, const struct dbll_frec *r, void *ctx) {
+  *(double *) ctx += ((const struct item *) dbll_map_data(r))->value;
+  return 1;
+}
+
+static double parse_and_append(const char *path, long *n, double *sum) {
+  double t0 = now_ms();
+  FILE *f = fopen(path, "r");
+  struct dbll *ll = dbll_create();
+  struct llnode *curr;
+  struct item it;
+
+  *n = 0;
+  while(fscanf(f, "%ld %lf", &it.id, &it.value) == 2) {
+	struct item *p = malloc(sizeof(*p));
+	*p = it;
+	dbll_append(ll, p);
+	(*n)++;
+  }
+  fclose(f);
+
+  *sum = 0;
+  for(curr = ll->first; curr != NULL; curr = curr->next)
+	*sum += ((struct item *) curr->user_data)->value;
+  t0 = now_ms() - t0;
+
+  for(curr = ll->first; curr != NULL; curr = curr->next)
+	free(curr->user_data);
+  dbll_free(ll);
+  return t0;
+}
+
+static double map_and_iterate(const char *path, long *n, double *sum) {
+  double t0 = now_ms();
+  struct dbll_map *m = dbll_map_file(path);
+
+  *sum = 0;
+  dbll_map_iterate(m, sum, sum_record);
+  *n = m->hdr->count;
+  t0 = now_ms() - t0;
+
+  dbll_unmap(m);
+  return t0;
+}
+
+int main(int argc, char *argv[]) {
+  long items = argc > 1 ? atol(argv[1]) : 10000000;
+  const char *dir = argc > 2 ? argv[2] : ".";
+  char text[4096], bin[4096];
+  struct dbll *ll;
+  struct item *data;
+  FILE *f;
+  double sum, ms;
+  long i, n;
+
+  snprintf(text, sizeof(text), "%s/dbll_file_bench.txt", dir);
+  snprintf(bin, sizeof(bin), "%s/dbll_file_bench.map", dir);
+
+  data = malloc(items * sizeof(*data));
+  ll = dbll_create();
+  f = fopen(text, "w");
+  srand(1);
+  for(i = 0; i < items; i++) {
+	data[i].id = i;
+	data[i].value = rand() % 1000 / 8.0;
+	fprintf(f, "%ld %g\n", data[i].id, data[i].value);
+	dbll_append(ll, &data[i]);
+  }
+  fclose(f);
+  if(!dbll_save(ll, sizeof(struct item), bin)) {
+	perror(bin);
+	return 1;
+  }
+  dbll_free(ll);
+  free(data);
+
+  printf("%-22s %10s %10s %14s\n", "", "items", "ms", "ns/item");
+
+  ms = parse_and_append(text, &n, &sum);
+  printf("%-22s %10ld %10.1f %14.1f\n", "parse+dbll_append", n, ms, ms * 1e6 / n);
+
+  evict(bin);
+  ms = map_and_iterate(bin, &n, &sum);
+  printf("%-22s %10ld %10.1f %14.1f\n", "dbll_map_file cold", n, ms, ms * 1e6 / n);
+
+  ms = map_and_iterate(bin, &n, &sum);
+  printf("%-22s %10ld %10.1f %14.1f\n", "dbll_map_file warm", n, ms, ms * 1e6 / n);
+
+  remove(text);
+  remove(bin);
+  return 0;
+}
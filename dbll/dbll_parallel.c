@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "dbll_parallel.h"
+
+/* Routines to iterate over a doubly-linked list from several threads */
+
+/*
+   A serial pre-pass walks [start, end] once and records every
+   DBLL_PAR_GRAIN-th node. Each recorded node starts a chunk of at most
+   DBLL_PAR_GRAIN nodes. Chunks are dealt out to workers as contiguous
+   ranges; a worker that runs out of its own range steals chunks from
+   the ranges of the other workers.
+ */
+
+struct par_range {
+  size_t next;               /* next unclaimed chunk, advanced atomically */
+  size_t hi;                 /* one past the last chunk of this range */
+  char pad[64 - 2 * sizeof(size_t)]; /* keep ranges on separate cache lines */
+};
+
+struct par_job {
+  struct dbll *list;
+  struct llnode *end;
+  struct llnode **chunks;    /* first node of each chunk */
+  size_t nchunks;
+  struct par_range *ranges;  /* one per worker */
+  int nworkers;
+  int stop;                  /* set once f returns 0 */
+  int (*f)(struct dbll *, struct llnode *, void *);
+  void *shared_ctx;
+  void **ctxs;               /* per-worker contexts, or NULL to use shared_ctx */
+};
+
+struct par_worker {
+  struct par_job *job;
+  int id;
+};
+
+/* walk start..end and record the first node of every chunk in
+   *chunks and their number in *nchunks */
+/* returns 1, 0 if end is not reachable from start, or -1 if memory
+   could not be allocated */
+static int par_split(struct llnode *start, struct llnode *end, struct llnode ***chunks, size_t *nchunks)
+{
+  size_t cap = 64, n = 0, count = 0;
+  struct llnode **c = malloc(cap * sizeof(*c));
+  struct llnode *curr;
+
+  if(c == NULL)
+    return -1;
+
+  for(curr = start; curr != NULL; curr = curr->next, count++) {
+    if(count % DBLL_PAR_GRAIN == 0) {
+      if(n == cap) {
+        struct llnode **nc = realloc(c, 2 * cap * sizeof(*c));
+        if(nc == NULL) {
+          free(c);
+          return -1;
+        }
+        c = nc;
+        cap *= 2;
+      }
+      c[n++] = curr;
+    }
+
+    if(curr == end) {
+      *chunks = c;
+      *nchunks = n;
+      return 1;
+    }
+  }
+
+  free(c);
+  return 0;
+}
+
+/* claim one chunk from range r, returns 0 if the range is exhausted */
+static int par_claim(struct par_range *r, size_t *chunk)
+{
+  if(__atomic_load_n(&r->next, __ATOMIC_RELAXED) >= r->hi)
+    return 0;
+
+  *chunk = __atomic_fetch_add(&r->next, 1, __ATOMIC_RELAXED);
+  return *chunk < r->hi;
+}
+
+static void par_run_chunk(struct par_job *job, size_t chunk, void *ctx)
+{
+  struct llnode *curr = job->chunks[chunk];
+  int i;
+
+  for(i = 0; i < DBLL_PAR_GRAIN; i++) {
+    if(__atomic_load_n(&job->stop, __ATOMIC_RELAXED))
+      return;
+
+    if(job->f(job->list, curr, ctx) == 0) {
+      __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+      return;
+    }
+
+    if(curr == job->end)
+      return;
+
+    curr = curr->next;
+  }
+}
+
+static void *par_worker_main(void *arg)
+{
+  struct par_worker *w = arg;
+  struct par_job *job = w->job;
+  void *ctx = job->ctxs ? job->ctxs[w->id] : job->shared_ctx;
+  size_t chunk;
+  int i;
+
+  /* own range first, then steal from the others in round-robin order */
+  for(i = 0; i < job->nworkers; i++) {
+    struct par_range *r = &job->ranges[(w->id + i) % job->nworkers];
+
+    while(!__atomic_load_n(&job->stop, __ATOMIC_RELAXED) && par_claim(r, &chunk))
+      par_run_chunk(job, chunk, ctx);
+  }
+
+  return NULL;
+}
+
+static int par_iterate(struct dbll *list,
+                       struct llnode *start,
+                       struct llnode *end,
+                       void *ctx,
+                       void **ctxs,
+                       int (*f)(struct dbll *, struct llnode *, void *),
+                       int nthreads)
+{
+  struct par_job job;
+  struct par_worker *workers;
+  pthread_t *tids;
+  int i, started, ret;
+
+  if(start == NULL)
+    start = list->first;
+  if(end == NULL)
+    end = list->last;
+
+  if(start == NULL) /* empty list */
+    return 1;
+
+  ret = par_split(start, end, &job.chunks, &job.nchunks);
+  if(ret <= 0)
+    return ret;
+
+  if(f == NULL) {
+    free(job.chunks);
+    return 1;
+  }
+
+  if((size_t) nthreads > job.nchunks)
+    nthreads = job.nchunks;
+
+  job.list = list;
+  job.end = end;
+  job.nworkers = nthreads;
+  job.stop = 0;
+  job.f = f;
+  job.shared_ctx = ctx;
+  job.ctxs = ctxs;
+  job.ranges = malloc(nthreads * sizeof(*job.ranges));
+  workers = malloc(nthreads * sizeof(*workers));
+  tids = malloc(nthreads * sizeof(*tids));
+
+  if(job.ranges == NULL || workers == NULL || tids == NULL) {
+    free(job.ranges);
+    free(workers);
+    free(tids);
+    free(job.chunks);
+    return -1;
+  }
+
+  for(i = 0; i < nthreads; i++) {
+    job.ranges[i].next = job.nchunks * i / nthreads;
+    job.ranges[i].hi = job.nchunks * (i + 1) / nthreads;
+    workers[i].job = &job;
+    workers[i].id = i;
+  }
+
+  /* the calling thread is worker 0; if a thread cannot be started,
+     its range is simply stolen by the workers that did start */
+  for(started = 1; started < nthreads; started++) {
+    if(pthread_create(&tids[started], NULL, par_worker_main, &workers[started]) != 0)
+      break;
+  }
+
+  par_worker_main(&workers[0]);
+
+  for(i = 1; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  free(tids);
+  free(workers);
+  free(job.ranges);
+  free(job.chunks);
+  return 1;
+}
+
+/* see dbll_parallel.h */
+int dbll_parallel_iterate(struct dbll *list,
+						  struct llnode *start,
+						  struct llnode *end,
+						  void *ctx,
+						  int (*f)(struct dbll *, struct llnode *, void *),
+						  int nthreads)
+{
+  if(nthreads <= 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = ncpu > 0 ? (int) ncpu : 1;
+  }
+
+  return par_iterate(list, start, end, ctx, NULL, f, nthreads);
+}
+
+/* see dbll_parallel.h */
+int dbll_parallel_iterate_local(struct dbll *list,
+								struct llnode *start,
+								struct llnode *end,
+								void **ctxs,
+								int (*f)(struct dbll *, struct llnode *, void *),
+								int nthreads)
+{
+  if(nthreads <= 0)
+    return -1;
+
+  return par_iterate(list, start, end, NULL, ctxs, f, nthreads);
+}
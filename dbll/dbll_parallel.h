@@ -0,0 +1,39 @@
+#pragma once
+#include "dbll.h"
+
+/* Parallel iteration over a doubly-linked list */
+
+/* The list must not be modified while a parallel iteration is running */
+
+/* number of consecutive nodes handed to a worker as one unit of work */
+#define DBLL_PAR_GRAIN 32
+
+/* like dbll_iterate, but calls f on the nodes between start and end
+   (inclusive) from up to nthreads threads; all threads share ctx, so
+   f must synchronize any updates it makes to it */
+
+/* if nthreads <= 0, one thread per online CPU is used */
+
+/* order of calls to f is unspecified; if any call to f returns 0, the
+   remaining work is abandoned as soon as possible and 1 is returned */
+
+/* return 0 (without calling f) if end is not reachable from start */
+/* return -1 (without calling f) if memory could not be allocated */
+/* return 1 on successful iteration */
+int dbll_parallel_iterate(struct dbll *list,
+						  struct llnode *start,
+						  struct llnode *end,
+						  void *ctx,
+						  int (*f)(struct dbll *, struct llnode *, void *),
+						  int nthreads);
+
+/* like dbll_parallel_iterate, but worker i passes ctxs[i] to f; ctxs
+   must have nthreads entries (nthreads must be > 0 here). Reductions
+   keep a partial result per context and combine them afterwards. */
+/* return -1 (without calling f) if nthreads <= 0 */
+int dbll_parallel_iterate_local(struct dbll *list,
+								struct llnode *start,
+								struct llnode *end,
+								void **ctxs,
+								int (*f)(struct dbll *, struct llnode *, void *),
+								int nthreads);
@@ -0,0 +1,104 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "dbll.h"
+
+/* ns per insert into a sorted list: a dbll_iterate walk from the first
+   node, against dbll_insert_sorted with keys close to the previous one
+   and with random keys */
+
+/* usage: dbll_sorted_bench [max list size] */
+
+/* the walk is O(n) per insert, so it is only run up to WALK_MAX nodes */
+#define WALK_MAX 20000
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_long(const void *a, const void *b) {
+  long x = *(const long *) a, y = *(const long *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* dbll_iterate callback: stop at the first node with a larger key */
+struct find {
+  long key;
+  struct llnode *found;
+};
+
+static int find_first_node(struct dbll *ll, struct llnode *n, void *ctx) {
+  struct find *f = ctx;
+  if(*(long *) n->user_data > f->key) {
+	f->found = n;
+	return 0;
+  }
+  return 1;
+}
+
+static double walk(long *keys, long n) {
+  struct dbll *ll = dbll_create();
+  double t0 = now_ns();
+  long i;
+
+  for(i = 0; i < n; i++) {
+	struct find f = { keys[i], NULL };
+	if(ll->first != NULL)
+	  dbll_iterate(ll, NULL, NULL, &f, find_first_node);
+	if(f.found != NULL)
+	  dbll_insert_before(ll, f.found, &keys[i]);
+	else
+	  dbll_append(ll, &keys[i]);
+  }
+  t0 = now_ns() - t0;
+  dbll_free(ll);
+  return t0 / n;
+}
+
+static double sorted(long *keys, long n) {
+  struct dbll *ll = dbll_create();
+  double t0 = now_ns();
+  long i;
+
+  for(i = 0; i < n; i++)
+	dbll_insert_sorted(ll, &keys[i], cmp_long, NULL);
+  t0 = now_ns() - t0;
+  dbll_free(ll);
+  return t0 / n;
+}
+
+int main(int argc, char *argv[]) {
+  long max = argc > 1 ? atol(argv[1]) : 1000000;
+  long n, i;
+
+  printf("%-10s %-8s %14s %14s\n", "size", "keys", "walk ns/op", "sorted ns/op");
+
+  for(n = 1000; n <= max; n *= 10) {
+	long *random = malloc(n * sizeof(long));
+	long *near = malloc(n * sizeof(long));
+
+	srand(1);
+	for(i = 0; i < n; i++) {
+	  random[i] = rand();
+	  /* runs of 100 ascending keys starting at random places */
+	  near[i] = i % 100 == 0 ? rand() : near[i - 1] + 1;
+	}
+
+	if(n <= WALK_MAX) {
+	  printf("%-10ld %-8s %14.1f %14.1f\n", n, "near", walk(near, n), sorted(near, n));
+	  printf("%-10ld %-8s %14.1f %14.1f\n", n, "random", walk(random, n), sorted(random, n));
+	} else {
+	  printf("%-10ld %-8s %14s %14.1f\n", n, "near", "-", sorted(near, n));
+	  printf("%-10ld %-8s %14s %14.1f\n", n, "random", "-", sorted(random, n));
+	}
+
+	free(random);
+	free(near);
+  }
+
+  return 0;
+}
@@ -1,8 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "dbll.h"
+#include "dbll_parallel.h"
+#include "cdbll.h"
+#include "dbllq.h"
+#include "dbll_file.h"
 #include "test_helper.h"
 
 int test_dbll_insert_before() {
@@ -166,6 +172,14 @@ int test_dbll_insert_after() {
 	}
   }
 
+  if(ret) {
+	struct llnode *plast = ll->last;
+	struct llnode *t = dbll_insert_after(ll, ll->last, &test_data[0]);
+
+	ret = th_check(ll->last == t, "insert_after: inserting after last node makes it ll->last (%p == %p)", ll->last, t) && ret;
+	ret = th_check(t->prev == plast && plast->next == t, "insert_after: new last node is linked to old last node (%p)", plast) && ret;
+  }
+
   dbll_free(ll);
   fprintf(stderr, "=== DONE\n\n");
   return ret;
@@ -368,6 +382,346 @@ int test_dbll_rev_iteration() {
   return ret;
 }
 
+int count_nodes(struct dbll *ll, struct llnode *n, void *ctx) {
+  __atomic_fetch_add((int *) ctx, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+int test_dbll_parallel_iteration() {
+  struct dbll *ll;
+
+  int N = 1000, T = 4;
+  struct llnode *n[N];
+
+  int ret = 0;
+  int test_data[N];
+  int sums[T];
+  void *ctxs[T];
+
+  ll = dbll_create();
+
+  if(!(ret = th_check(ll != NULL, "par_iter: dbll_create return value (%p) must be non-NULL", ll)))
+	return 0;
+
+  int i = 0;
+
+  for(i = 0;  i < N; i++) {
+	test_data[i] = i;
+	n[i] = dbll_append(ll, &test_data[i]);
+
+	if(n[i] == NULL) break;
+  }
+
+  if(!(ret = th_check(i == N, "par_iter: dbll_append of %d nodes must succeed, %d succeeded", N, i))) return ret;
+
+  int iret, sum = 0, count = 0;
+
+  for(i = 0; i < T; i++) {
+	sums[i] = 0;
+	ctxs[i] = &sums[i];
+  }
+
+  iret = dbll_parallel_iterate_local(ll, NULL, NULL, ctxs, compute_sum, T);
+
+  ret = th_check(iret == 1, "par_iter: iterate_local should return 1 as return value") && ret;
+  for(i = 0; i < T; i++)
+	sum += sums[i];
+
+  ret = th_check(sum == (N-1)*N/2, "par_iter: per-thread compute_sum must combine to %d, computed %d", (N-1)*N/2, sum) && ret;
+
+  iret = dbll_parallel_iterate_local(ll, NULL, NULL, ctxs, compute_sum, 0);
+  ret = th_check(iret == -1, "par_iter: iterate_local should return -1 for 0 threads, returned %d", iret) && ret;
+
+
+  iret = dbll_parallel_iterate(ll, n[10], n[109], &count, count_nodes, T);
+
+  ret = th_check(iret == 1, "par_iter: iterate should return 1 as return value") && ret;
+  ret = th_check(count == 100, "par_iter: iterate from n[10] to n[109] must visit %d nodes, visited %d", 100, count) && ret;
+
+
+  count = 0;
+  iret = dbll_parallel_iterate(ll, n[500], n[10], &count, count_nodes, T);
+
+  ret = th_check(iret == 0, "par_iter: iterate should return 0 when end is not reachable") && ret;
+  ret = th_check(count == 0, "par_iter: iterate must not visit nodes when end is not reachable, visited %d", count) && ret;
+
+
+  struct node_search_query q = { .val_greater_than = N, .n = NULL };
+
+  iret = dbll_parallel_iterate(ll, NULL, NULL, &q, find_first_node, 1);
+
+  ret = th_check(iret == 1, "par_iter: iterate should return 1 as return value") && ret;
+  ret = th_check(q.n == NULL, "par_iter: iterate+find_first_node must be NULL, is %p", q.n) && ret;
+
+  fprintf(stderr, "=== DONE\n\n");
+  dbll_free(ll);
+  return ret;
+}
+
+int cdbll_sum(struct cdbll *ll, struct cdbll_node *n, void *ctx) {
+  *(int *) ctx += *(int *) n->user_data;
+  return 1;
+}
+
+struct cdbll_worker_args {
+  struct cdbll *ll;
+  int *data;
+  int n;
+};
+
+void *cdbll_worker(void *arg) {
+  struct cdbll_worker_args *a = arg;
+  struct cdbll_node *nodes[a->n];
+  int i;
+
+  for(i = 0; i < a->n; i++)
+	nodes[i] = cdbll_append(a->ll, &a->data[i]);
+
+  /* remove the odd-valued half again */
+  for(i = 1; i < a->n; i += 2)
+	cdbll_remove(a->ll, nodes[i]);
+
+  return NULL;
+}
+
+int test_cdbll() {
+  struct cdbll *ll;
+
+  int N = 5;
+  struct cdbll_node *n[N];
+
+  int ret = 0;
+  int test_data[] = {0, 1, 2, 3, 4};
+
+  ll = cdbll_create();
+
+  if(!(ret = th_check(ll != NULL, "cdbll: cdbll_create return value (%p) must be non-NULL", ll)))
+	return 0;
+
+  /* builds 0 1 2 3 4 */
+  n[4] = cdbll_append(ll, &test_data[4]);
+  n[1] = cdbll_insert_after(ll, NULL, &test_data[1]);
+  n[0] = cdbll_insert_after(ll, NULL, &test_data[0]);
+  n[2] = cdbll_insert_after(ll, n[1], &test_data[2]);
+  n[3] = cdbll_insert_after(ll, n[2], &test_data[3]);
+
+  cdbll_pin();
+  struct cdbll_node *curr = cdbll_first(ll);
+  int i;
+
+  for(i = 0; i < N; i++) {
+	ret = th_check(curr == n[i], "cdbll: node %d (%p) must be n[%d] (%p)", i, curr, i, n[i]) && ret;
+	curr = curr ? cdbll_next(ll, curr) : NULL;
+  }
+
+  ret = th_check(curr == NULL, "cdbll: list must end after %d nodes (%p)", N, curr) && ret;
+  cdbll_unpin();
+
+  ret = th_check(cdbll_remove(ll, n[2]) == 1, "cdbll: removing n[2] must succeed") && ret;
+  ret = th_check(cdbll_remove(ll, n[0]) == 1, "cdbll: removing first node must succeed") && ret;
+
+  int sum = 0;
+  cdbll_iterate(ll, &sum, cdbll_sum);
+  ret = th_check(sum == 1 + 3 + 4, "cdbll: iterate+sum after removal must compute %d, computed %d", 8, sum) && ret;
+
+  cdbll_pin();
+  ret = th_check(cdbll_remove(ll, n[4]) == 1, "cdbll: removing last node must succeed") && ret;
+  ret = th_check(cdbll_remove(ll, n[4]) == 0, "cdbll: removing a removed node must return 0") && ret;
+  ret = th_check(cdbll_insert_after(ll, n[4], &test_data[0]) == NULL, "cdbll: insert_after a removed node must fail") && ret;
+  cdbll_unpin();
+
+  cdbll_free(ll);
+
+  /* concurrent appends and removals */
+  int T = 4, M = 1000;
+  pthread_t tids[T];
+  struct cdbll_worker_args args[T];
+  int values[M];
+
+  for(i = 0; i < M; i++)
+	values[i] = i;
+
+  ll = cdbll_create();
+
+  for(i = 0; i < T; i++) {
+	args[i].ll = ll;
+	args[i].data = values;
+	args[i].n = M;
+	pthread_create(&tids[i], NULL, cdbll_worker, &args[i]);
+  }
+
+  for(i = 0; i < T; i++)
+	pthread_join(tids[i], NULL);
+
+  int expected = 0;
+  for(i = 0; i < M; i += 2)
+	expected += T * i;
+
+  sum = 0;
+  cdbll_iterate(ll, &sum, cdbll_sum);
+  ret = th_check(sum == expected, "cdbll: concurrent append/remove must leave sum %d, found %d", expected, sum) && ret;
+
+  cdbll_free(ll);
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+struct dbllq_worker_args {
+  struct dbllq *q;
+  int *data;
+  int n;
+  long sum;
+};
+
+void *dbllq_producer(void *arg) {
+  struct dbllq_worker_args *a = arg;
+  int i;
+
+  for(i = 0; i < a->n; i++)
+	dbllq_push(a->q, &a->data[i]);
+
+  return NULL;
+}
+
+void *dbllq_consumer(void *arg) {
+  struct dbllq_worker_args *a = arg;
+  void *v;
+
+  while(dbllq_pop(a->q, &v))
+	a->sum += *(int *) v;
+
+  return NULL;
+}
+
+int test_dbllq() {
+  struct dbllq *q;
+
+  int N = 5;
+  int ret = 0;
+  int test_data[] = {0, 1, 2, 3, 4};
+  void *items[] = {&test_data[2], &test_data[3], &test_data[4]};
+  void *out[N];
+  void *v;
+  int i;
+
+  q = dbllq_create();
+
+  if(!(ret = th_check(q != NULL, "dbllq: dbllq_create return value (%p) must be non-NULL", q)))
+	return 0;
+
+  ret = th_check(dbllq_trypop(q, &v) == 0, "dbllq: trypop on an empty queue must return 0") && ret;
+
+  ret = th_check(dbllq_push(q, &test_data[0]), "dbllq: push must succeed") && ret;
+  ret = th_check(dbllq_push(q, &test_data[1]), "dbllq: push must succeed") && ret;
+  ret = th_check(dbllq_push_batch(q, items, 3), "dbllq: push_batch must succeed") && ret;
+
+  ret = th_check(dbllq_trypop(q, &v) == 1 && v == &test_data[0], "dbllq: trypop must return the oldest item (%p), returned %p", &test_data[0], v) && ret;
+
+  size_t n = dbllq_pop_batch(q, out, N);
+  ret = th_check(n == N - 1, "dbllq: pop_batch must return %d items, returned %lu", N - 1, n) && ret;
+
+  for(i = 0; i < (int) n; i++)
+	ret = th_check(out[i] == &test_data[i + 1], "dbllq: pop_batch item %d (%p) must be %p", i, out[i], &test_data[i + 1]) && ret;
+
+  ret = th_check(dbllq_pop_batch(q, out, N) == 0, "dbllq: pop_batch on an empty queue must return 0") && ret;
+
+  dbllq_free(q);
+
+  /* blocking producers and consumers */
+  int T = 2, M = 1000;
+  pthread_t prod[T], cons[T];
+  struct dbllq_worker_args pargs[T], cargs[T];
+  int values[M];
+  long sum = 0, expected = 0;
+
+  for(i = 0; i < M; i++) {
+	values[i] = i;
+	expected += T * i;
+  }
+
+  q = dbllq_create();
+
+  for(i = 0; i < T; i++) {
+	cargs[i].q = q;
+	cargs[i].sum = 0;
+	pthread_create(&cons[i], NULL, dbllq_consumer, &cargs[i]);
+  }
+
+  for(i = 0; i < T; i++) {
+	pargs[i].q = q;
+	pargs[i].data = values;
+	pargs[i].n = M;
+	pthread_create(&prod[i], NULL, dbllq_producer, &pargs[i]);
+  }
+
+  for(i = 0; i < T; i++)
+	pthread_join(prod[i], NULL);
+
+  dbllq_close(q);
+
+  for(i = 0; i < T; i++) {
+	pthread_join(cons[i], NULL);
+	sum += cargs[i].sum;
+  }
+
+  ret = th_check(sum == expected, "dbllq: consumers must receive every item (sum %ld), received sum %ld", expected, sum) && ret;
+
+  dbllq_free(q);
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+int test_dbll_move_before() {
+  struct dbll *ll;
+
+  int N = 5;
+  struct llnode *n[N];
+
+  int ret = 0;
+  int test_data[] = {0, 1, 2, 3, 4};
+
+  ll = dbll_create();
+
+  if(!(ret = th_check(ll != NULL, "move_before: dbll_create return value (%p) must be non-NULL", ll)))
+	return 0;
+
+  int i = 0;
+
+  for(i = 0;  i < N; i++) {
+	n[i] = dbll_append(ll, &test_data[i]);
+
+	ret = th_check(n[i] != NULL, "move_before: dbll_append return value (n[%d] == %p) must be non-NULL",
+				   i, n[i]) && ret;
+  }
+
+  if(!ret) return ret;
+
+  /* 4 0 1 2 3 */
+  dbll_move_before(ll, n[4], NULL);
+
+  ret = th_check(ll->first == n[4], "move_before: ll->first (%p) is moved node n[4] (%p)", ll->first, n[4]) && ret;
+  ret = th_check(ll->last == n[3], "move_before: ll->last (%p) is n[3] (%p)", ll->last, n[3]) && ret;
+  ret = th_check(n[4]->prev == NULL && n[4]->next == n[0], "move_before: n[4] links (%p, %p) are (NULL, n[0])", n[4]->prev, n[4]->next) && ret;
+  ret = th_check(n[0]->prev == n[4], "move_before: n[0]->prev (%p) is n[4] (%p)", n[0]->prev, n[4]) && ret;
+  ret = th_check(n[3]->next == NULL, "move_before: n[3]->next (%p) is NULL", n[3]->next) && ret;
+
+  /* 4 0 2 1 3 */
+  dbll_move_before(ll, n[2], n[1]);
+
+  ret = th_check(n[0]->next == n[2] && n[2]->next == n[1] && n[1]->next == n[3],
+				 "move_before: n[2] is between n[0] and n[1]") && ret;
+  ret = th_check(n[3]->prev == n[1] && n[1]->prev == n[2] && n[2]->prev == n[0],
+				 "move_before: prev links are maintained after moving n[2]") && ret;
+
+  /* moving a node before itself does nothing */
+  dbll_move_before(ll, n[4], NULL);
+  ret = th_check(ll->first == n[4] && n[4]->next == n[0], "move_before: moving first node to the front keeps the list unchanged") && ret;
+
+  dbll_free(ll);
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
 int test_dbll_remove() {
   struct dbll *ll;
 
@@ -573,6 +927,451 @@ int test_dbll_create_and_free() {
   return ret;
 }
 
+struct batch_ctx {
+  long sum;
+  int calls;
+  int max_n;
+  int stop_after;             /* calls before returning 0, or -1 */
+  void *prev;                 /* last element seen */
+  int in_order;
+};
+
+static int sum_batch(struct dbll *ll, void **data, size_t n, void *ctx) {
+  struct batch_ctx *b = ctx;
+  size_t i;
+
+  b->calls++;
+  if((int) n > b->max_n)
+	b->max_n = n;
+  for(i = 0; i < n; i++) {
+	if(b->prev != NULL && (int *) data[i] != (int *) b->prev + 1)
+	  b->in_order = 0;
+	b->prev = data[i];
+	b->sum += *(int *) data[i];
+  }
+  return b->stop_after < 0 || b->calls < b->stop_after;
+}
+
+int test_dbll_iterate_batch() {
+  struct dbll *ll;
+  struct llnode *n, *start = NULL, *end = NULL;
+  int N = 200;
+  int values[N];
+  struct batch_ctx b;
+  int ret = 1;
+  int i, r;
+
+  ll = dbll_create();
+
+  memset(&b, 0, sizeof(b));
+  b.stop_after = -1;
+  r = dbll_iterate_batch(ll, NULL, NULL, &b, sum_batch);
+  ret = th_check(r == 1 && b.calls == 0, "dbll_iterate_batch: empty list must not call f (%d calls)", b.calls) && ret;
+
+  for(i = 0; i < N; i++) {
+	values[i] = i;
+	n = dbll_append(ll, &values[i]);
+	if(i == 10) start = n;
+	if(i == 150) end = n;
+  }
+
+  memset(&b, 0, sizeof(b));
+  b.stop_after = -1;
+  b.in_order = 1;
+  r = dbll_iterate_batch(ll, NULL, NULL, &b, sum_batch);
+  ret = th_check(r == 1 && b.sum == N * (N - 1) / 2, "dbll_iterate_batch: whole list must sum to %d, got %ld", N * (N - 1) / 2, b.sum) && ret;
+  ret = th_check(b.in_order, "dbll_iterate_batch: elements must come in list order") && ret;
+  ret = th_check(b.max_n == DBLL_BATCH && b.calls == (N + DBLL_BATCH - 1) / DBLL_BATCH, "dbll_iterate_batch: batches must hold up to %d elements (%d calls of up to %d)", DBLL_BATCH, b.calls, b.max_n) && ret;
+
+  memset(&b, 0, sizeof(b));
+  b.stop_after = -1;
+  r = dbll_iterate_batch(ll, start, end, &b, sum_batch);
+  ret = th_check(r == 1 && b.sum == (10 + 150) * 141 / 2, "dbll_iterate_batch: start..end must sum to %d, got %ld", (10 + 150) * 141 / 2, b.sum) && ret;
+
+  memset(&b, 0, sizeof(b));
+  b.stop_after = -1;
+  r = dbll_iterate_batch(ll, end, start, &b, sum_batch);
+  ret = th_check(r == 0, "dbll_iterate_batch: must return 0 if end is not reached") && ret;
+
+  memset(&b, 0, sizeof(b));
+  b.stop_after = 1;
+  r = dbll_iterate_batch(ll, NULL, NULL, &b, sum_batch);
+  ret = th_check(r == 1 && b.calls == 1, "dbll_iterate_batch: must stop when f returns 0 (%d calls)", b.calls) && ret;
+
+  dbll_free(ll);
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+static int cmp_int(const void *a, const void *b) {
+  return *(const int *) a - *(const int *) b;
+}
+
+/* 1 if the list is in key order, with equal keys in insertion order */
+static int is_sorted(struct dbll *ll) {
+  struct llnode *curr;
+  for(curr = ll->first; curr != NULL && curr->next != NULL; curr = curr->next) {
+	int *a = curr->user_data, *b = curr->next->user_data;
+	if(*a > *b || (*a == *b && a > b))
+	  return 0;
+  }
+  return 1;
+}
+
+int test_dbll_insert_sorted() {
+  struct dbll *ll;
+  struct llnode *n, *next;
+  int M = 2000;
+  int keys[M];
+  int lo = -1, hi = 1000;
+  int ret = 1;
+  int i, len, bad = 0;
+
+  ll = dbll_create();
+
+  /* equal keys keep their order, so keys[] must be filled in order */
+  srand(42);
+  for(i = 0; i < M / 2; i++) {
+	keys[i] = rand() % 500;
+	n = dbll_insert_sorted(ll, &keys[i], cmp_int, NULL);
+	bad += n == NULL || ll->finger != n;
+  }
+  ret = th_check(bad == 0, "dbll_insert_sorted: every insert must return the new node and move the finger (%d did not)", bad) && ret;
+  ret = th_check(is_sorted(ll), "dbll_insert_sorted: random inserts must keep the list sorted") && ret;
+  ret = th_check(ll->skip != NULL, "dbll_insert_sorted: long walks must build the skip index") && ret;
+
+  /* remove every third node, including the finger */
+  dbll_remove(ll, ll->finger);
+  for(i = 0, n = ll->first; n != NULL; n = next, i++) {
+	next = n->next;
+	if(i % 3 == 0)
+	  dbll_remove(ll, n);
+  }
+  ret = th_check(ll->skip == NULL || ll->skip->stale, "dbll_insert_sorted: removing nodes must mark the skip index stale") && ret;
+
+  /* runs of nearby keys, from the finger and from hints */
+  for(i = M / 2; i < M; i++) {
+	keys[i] = (i / 50) * 7 % 500 + i % 3;
+	n = dbll_insert_sorted(ll, &keys[i], cmp_int, i % 4 == 0 ? ll->last : NULL);
+	bad += n == NULL;
+  }
+  ret = th_check(bad == 0, "dbll_insert_sorted: hinted inserts must succeed (%d failed)", bad) && ret;
+  ret = th_check(is_sorted(ll), "dbll_insert_sorted: inserts after removals must keep the list sorted") && ret;
+
+  for(len = 0, n = ll->first; n != NULL; n = n->next)
+	len++;
+  ret = th_check(len == M - 1 - (M / 2 - 1 + 2) / 3, "dbll_insert_sorted: list must have %d nodes, has %d", M - 1 - (M / 2 - 1 + 2) / 3, len) && ret;
+
+  /* smaller than everything and larger than everything */
+  n = dbll_insert_sorted(ll, &lo, cmp_int, ll->last);
+  ret = th_check(n == ll->first, "dbll_insert_sorted: smallest key must become the first node") && ret;
+  n = dbll_insert_sorted(ll, &hi, cmp_int, ll->first);
+  ret = th_check(n == ll->last, "dbll_insert_sorted: largest key must become the last node") && ret;
+  ret = th_check(is_sorted(ll), "dbll_insert_sorted: list must still be sorted") && ret;
+
+  dbll_free(ll);
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+struct relayout_ctx {
+  struct llnode **handles;    /* node holding value i, kept up to date by remap */
+  int calls;
+  int bad;
+};
+
+static void remap_handle(struct dbll *ll, struct llnode *old, struct llnode *new, void *ctx) {
+  struct relayout_ctx *r = ctx;
+  int v = *(int *) new->user_data;
+
+  r->bad += r->handles[v] != old || new->user_data != old->user_data;
+  r->handles[v] = new;
+  r->calls++;
+}
+
+/* number of nodes, or -1 if the links are inconsistent */
+static int check_links(struct dbll *ll) {
+  struct llnode *curr, *prev = NULL;
+  int len = 0;
+
+  for(curr = ll->first; curr != NULL; prev = curr, curr = curr->next, len++) {
+	if(curr->prev != prev)
+	  return -1;
+  }
+  return prev == ll->last ? len : -1;
+}
+
+int test_dbll_relayout() {
+  struct dbll *ll;
+  struct llnode *n, *next;
+  int N = 1000;
+  int values[N], order[N];
+  struct llnode *handles[N];
+  struct relayout_ctx r;
+  int ret = 1;
+  int i, len, steps, contiguous, r1;
+
+  ll = dbll_create();
+
+  ret = th_check(dbll_relayout(ll, NULL, NULL) && ll->slabs == NULL, "dbll_relayout: empty list must need no block") && ret;
+
+  /* scatter the nodes: insert around random nodes, then drop some */
+  srand(3);
+  for(i = 0; i < N; i++) {
+	values[i] = i;
+	n = i == 0 ? NULL : handles[rand() % i];
+	handles[i] = rand() % 2 ? dbll_insert_after(ll, n, &values[i]) : dbll_insert_before(ll, n, &values[i]);
+  }
+  for(i = 0; i < N; i += 7) {
+	dbll_remove(ll, handles[i]);
+	handles[i] = NULL;
+  }
+  for(len = 0, n = ll->first; n != NULL; n = n->next)
+	order[len++] = *(int *) n->user_data;
+
+  memset(&r, 0, sizeof(r));
+  r.handles = handles;
+  r1 = dbll_relayout(ll, &r, remap_handle);
+  ret = th_check(r1 == 1, "dbll_relayout: must succeed") && ret;
+  ret = th_check(r.calls == len && r.bad == 0, "dbll_relayout: remap must be called once per node with its old address (%d calls, %d bad)", r.calls, r.bad) && ret;
+
+  i = check_links(ll);
+  ret = th_check(i == len, "dbll_relayout: links must stay consistent (%d nodes, expected %d)", i, len) && ret;
+
+  for(i = 0, contiguous = 1, n = ll->first; n != NULL; n = n->next, i++) {
+	contiguous &= n->next == NULL || n->next == n + 1;
+	ret = th_check(*(int *) n->user_data == order[i], "dbll_relayout: node %d must keep its value %d", i, order[i]) && ret;
+	ret = th_check(handles[order[i]] == n, "dbll_relayout: handle of %d must follow its node", order[i]) && ret;
+  }
+  ret = th_check(contiguous && ll->slabs != NULL && ll->slabs->next == NULL, "dbll_relayout: nodes must be packed into one block in list order") && ret;
+
+  /* incremental pass, changing the list between steps: add at both
+	 ends, remove the node the pass would move next and move another */
+  memset(&r, 0, sizeof(r));
+  r.handles = handles;
+  for(i = 0; i < N; i += 7)
+	handles[i] = dbll_append(ll, &values[i]);
+  len = check_links(ll);
+
+  steps = 0;
+  while((r1 = dbll_relayout_step(ll, 50, &r, remap_handle)) == 0) {
+	steps++;
+	n = ll->pack_next;
+	if(n != NULL && n->next != NULL) {
+	  handles[*(int *) n->user_data] = NULL;
+	  dbll_remove(ll, n);
+	  len--;
+	}
+	if(ll->pack_next != NULL)
+	  dbll_move_before(ll, ll->pack_next, ll->first);
+	if(steps == 3) {
+	  dbll_remove(ll, ll->last);
+	  len--;
+	}
+  }
+  ret = th_check(r1 == 1 && steps > 1, "dbll_relayout_step: pass must finish after several steps (%d, returned %d)", steps, r1) && ret;
+  ret = th_check(r.bad == 0, "dbll_relayout_step: remap must see every move (%d bad)", r.bad) && ret;
+  i = check_links(ll);
+  ret = th_check(i == len, "dbll_relayout_step: links must stay consistent (%d nodes, expected %d)", i, len) && ret;
+  ret = th_check(ll->pack == NULL && ll->pack_next == NULL, "dbll_relayout_step: finished pass must leave no block in progress") && ret;
+
+  /* blocks go away with their last node */
+  for(n = ll->first; n != NULL; n = next) {
+	next = n->next;
+	dbll_remove(ll, n);
+  }
+  ret = th_check(ll->slabs == NULL, "dbll_relayout: removing every node must free the blocks") && ret;
+
+  /* lists that still own blocks are freed whole */
+  for(i = 0; i < N; i++)
+	dbll_insert_before(ll, NULL, &values[i]);
+  dbll_relayout(ll, NULL, NULL);
+  dbll_append(ll, &values[0]);
+  dbll_relayout_step(ll, 10, NULL, NULL);
+  dbll_free(ll);
+
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+struct count_alloc {
+  int allocs;
+  int frees;
+};
+
+static void *count_malloc(size_t size, void *ctx) {
+  ((struct count_alloc *) ctx)->allocs++;
+  return malloc(size);
+}
+
+static void count_free(void *ptr, size_t size, void *ctx) {
+  ((struct count_alloc *) ctx)->frees++;
+  free(ptr);
+}
+
+struct arena {
+  char *base;
+  size_t used;
+  size_t size;
+};
+
+static void *arena_alloc(size_t size, void *ctx) {
+  struct arena *a = ctx;
+  void *b;
+
+  size = (size + 15) & ~(size_t) 15;
+  if(a->size - a->used < size)
+	return NULL;
+  b = a->base + a->used;
+  a->used += size;
+  return b;
+}
+
+int test_dbll_allocator() {
+  struct dbll *ll;
+  struct llnode *n, *next;
+  struct count_alloc c = { 0, 0 };
+  struct arena a;
+  int N = 100;
+  int values[N];
+  int ret = 1;
+  int i, outside;
+
+  ll = dbll_create_with_allocator(count_malloc, count_free, &c);
+  for(i = 0; i < N; i++) {
+	values[i] = i;
+	n = i % 2 ? dbll_append(ll, &values[i]) : dbll_insert_before(ll, ll->first, &values[i]);
+  }
+  dbll_insert_after(ll, ll->first, &values[0]);
+  ret = th_check(c.allocs == N + 1 && c.frees == 0, "dbll_allocator: every node must come from alloc_fn (%d allocs)", c.allocs) && ret;
+
+  for(i = 0, n = ll->first; n != NULL; n = next, i++) {
+	next = n->next;
+	if(i % 5 == 0)
+	  dbll_remove(ll, n);
+  }
+  ret = th_check(c.frees == (N + 1 + 4) / 5, "dbll_allocator: removed nodes must go to free_fn (%d frees)", c.frees) && ret;
+
+  dbll_relayout(ll, NULL, NULL);
+  dbll_append(ll, &values[1]);
+  dbll_free(ll);
+  ret = th_check(c.allocs == c.frees, "dbll_allocator: dbll_free must give back everything (%d allocs, %d frees)", c.allocs, c.frees) && ret;
+
+  /* arena without free_fn */
+  a.size = 64 * 1024;
+  a.used = 0;
+  a.base = malloc(a.size);
+  ll = dbll_create_with_allocator(arena_alloc, NULL, &a);
+  for(i = 0; i < N; i++)
+	dbll_append(ll, &values[i]);
+  dbll_remove(ll, ll->first);
+  dbll_relayout(ll, NULL, NULL);
+  dbll_remove(ll, ll->last);
+
+  for(i = 0, outside = 0, n = ll->first; n != NULL; n = n->next, i++)
+	outside += (char *) n < a.base || (char *) n >= a.base + a.used;
+  ret = th_check(i == N - 2 && outside == 0, "dbll_allocator: arena list must hold %d nodes from the arena (%d nodes, %d outside)", N - 2, i, outside) && ret;
+
+  dbll_free(ll);
+  free(a.base);
+
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+struct file_item {
+  int key;
+  char name[8];
+};
+
+static int count_records(struct dbll_map *m, const struct dbll_frec *r, void *ctx) {
+  return ++*(int *) ctx < 3;
+}
+
+int test_dbll_file() {
+  struct dbll *ll;
+  struct dbll_map *m;
+  const struct dbll_frec *r;
+  const struct file_item *item;
+  const char *path = "dbll_test.map";
+  int N = 5;
+  struct file_item items[N];
+  char buf[sizeof(struct dbll_fheader) + 10];
+  int64_t link;
+  int ret = 1;
+  int i, n;
+  FILE *f;
+
+  ll = dbll_create();
+  for(i = 0; i < N; i++) {
+	items[i].key = i * 10;
+	snprintf(items[i].name, sizeof(items[i].name), "item%d", i);
+	dbll_append(ll, &items[i]);
+  }
+
+  ret = th_check(dbll_save(ll, sizeof(struct file_item), path), "dbll_file: dbll_save must succeed") && ret;
+  dbll_free(ll);
+
+  m = dbll_map_file(path);
+  if(!(ret = th_check(m != NULL, "dbll_file: dbll_map_file return value (%p) must be non-NULL", m) && ret))
+	return 0;
+
+  ret = th_check(m->hdr->count == N, "dbll_file: mapped list must have %d records, has %lu", N, (unsigned long) m->hdr->count) && ret;
+
+  for(i = 0, r = dbll_map_first(m); r != NULL; r = dbll_map_next(m, r), i++) {
+	item = dbll_map_data(r);
+	ret = th_check(i < N && item->key == i * 10 && strcmp(item->name, items[i].name) == 0,
+				   "dbll_file: record %d must hold (%d, %s), holds (%d, %s)", i, i * 10, items[i].name, item->key, item->name) && ret;
+  }
+  ret = th_check(i == N, "dbll_file: forward walk must visit %d records, visited %d", N, i) && ret;
+
+  for(i = N - 1, r = dbll_map_last(m); r != NULL; r = dbll_map_prev(m, r), i--)
+	ret = th_check(((const struct file_item *) dbll_map_data(r))->key == i * 10, "dbll_file: reverse walk must see record %d", i) && ret;
+  ret = th_check(i == -1, "dbll_file: reverse walk must end at the first record") && ret;
+
+  n = 0;
+  i = dbll_map_iterate(m, &n, count_records);
+  ret = th_check(i == 1 && n == 3, "dbll_file: dbll_map_iterate must stop when f returns 0 (%d calls)", n) && ret;
+
+  dbll_unmap(m);
+
+  /* a corrupt stored link is not followed */
+  f = fopen(path, "r+b");
+  fseek(f, sizeof(struct dbll_fheader) + sizeof(struct dbll_frec) + ((sizeof(struct file_item) + 7) & ~(size_t) 7), SEEK_SET);
+  link = 1 << 30;
+  fwrite(&link, sizeof(link), 1, f);
+  fclose(f);
+  m = dbll_map_file(path);
+  if(!(ret = th_check(m != NULL, "dbll_file: dbll_map_file of a file with a corrupt link must succeed") && ret))
+	return 0;
+  for(i = 0, r = dbll_map_first(m); r != NULL && i <= N; r = dbll_map_next(m, r), i++)
+	ret = th_check(((const struct file_item *) dbll_map_data(r))->key == i * 10, "dbll_file: walk past a corrupt link must see record %d", i) && ret;
+  ret = th_check(i == N, "dbll_file: walk past a corrupt link must visit %d records, visited %d", N, i) && ret;
+  dbll_unmap(m);
+
+  /* a truncated file is rejected */
+  f = fopen(path, "rb");
+  n = fread(buf, 1, sizeof(struct dbll_fheader) + 10, f);
+  fclose(f);
+  f = fopen(path, "wb");
+  fwrite(buf, 1, n, f);
+  fclose(f);
+  ret = th_check(dbll_map_file(path) == NULL, "dbll_file: dbll_map_file must reject a truncated file") && ret;
+
+  /* empty lists round-trip */
+  ll = dbll_create();
+  ret = th_check(dbll_save(ll, sizeof(struct file_item), path), "dbll_file: dbll_save of an empty list must succeed") && ret;
+  dbll_free(ll);
+  m = dbll_map_file(path);
+  ret = th_check(m != NULL && dbll_map_first(m) == NULL && dbll_map_last(m) == NULL, "dbll_file: mapped empty list must have no records") && ret;
+  if(m != NULL)
+	dbll_unmap(m);
+
+  remove(path);
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
 int main(void) {
   if(!test_dbll_create_and_free())
 	exit(1);
@@ -595,6 +1394,33 @@ int main(void) {
   if(!test_dbll_insert_before())
 	exit(1);
 
+  if(!test_dbll_move_before())
+	exit(1);
+
+  if(!test_dbll_parallel_iteration())
+	exit(1);
+
+  if(!test_cdbll())
+	exit(1);
+
+  if(!test_dbllq())
+	exit(1);
+
+  if(!test_dbll_iterate_batch())
+	exit(1);
+
+  if(!test_dbll_insert_sorted())
+	exit(1);
+
+  if(!test_dbll_file())
+	exit(1);
+
+  if(!test_dbll_relayout())
+	exit(1);
+
+  if(!test_dbll_allocator())
+	exit(1);
+
   printf("ALL DONE\n");
   return 0;
 }
@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include "dbllq.h"
+
+/* Routines for a multi-producer/multi-consumer queue (see dbllq.h) */
+
+/* next is read by consumers while a producer may be writing it (when the
+   queue holds a single item), so it is always accessed atomically */
+#define LOAD_NEXT(n) __atomic_load_n(&(n)->next, __ATOMIC_ACQUIRE)
+#define STORE_NEXT(n, v) __atomic_store_n(&(n)->next, (v), __ATOMIC_RELEASE)
+
+/* get a chain of n nodes linked through prev, recycling where possible */
+/* returns NULL if memory could not be allocated */
+static struct llnode *dbllq_get_nodes(struct dbllq *q, size_t n)
+{
+  struct llnode *chain = NULL, *node;
+  size_t got = 0;
+
+  pthread_mutex_lock(&q->free_lock);
+  while(got < n && q->free_nodes != NULL) {
+    node = q->free_nodes;
+    q->free_nodes = node->prev;
+    q->nfree--;
+    node->prev = chain;
+    chain = node;
+    got++;
+  }
+  pthread_mutex_unlock(&q->free_lock);
+
+  for(; got < n; got++) {
+    node = malloc(sizeof(struct llnode));
+    if(node == NULL)
+      break;
+    node->prev = chain;
+    chain = node;
+  }
+
+  if(got < n) {
+    while(chain != NULL) {
+      node = chain->prev;
+      free(chain);
+      chain = node;
+    }
+  }
+
+  return chain;
+}
+
+/* recycle a chain of nodes linked through prev */
+static void dbllq_put_nodes(struct dbllq *q, struct llnode *chain)
+{
+  struct llnode *node;
+
+  pthread_mutex_lock(&q->free_lock);
+  while(chain != NULL && q->nfree < DBLLQ_MAX_FREE) {
+    node = chain->prev;
+    chain->prev = q->free_nodes;
+    q->free_nodes = chain;
+    q->nfree++;
+    chain = node;
+  }
+  pthread_mutex_unlock(&q->free_lock);
+
+  while(chain != NULL) {
+    node = chain->prev;
+    free(chain);
+    chain = node;
+  }
+}
+
+/* create an empty queue */
+/* returns NULL if memory allocation failed */
+struct dbllq *dbllq_create()
+{
+  struct dbllq *q = malloc(sizeof(struct dbllq));
+  if(q == NULL)
+    return NULL;
+
+  q->head = malloc(sizeof(struct llnode));
+  if(q->head == NULL) {
+    free(q);
+    return NULL;
+  }
+
+  q->head->user_data = NULL;
+  q->head->next = NULL;
+  q->head->prev = NULL;
+  q->tail = q->head;
+  q->waiters = 0;
+  q->closed = 0;
+  q->free_nodes = NULL;
+  q->nfree = 0;
+
+  pthread_mutex_init(&q->head_lock, NULL);
+  pthread_mutex_init(&q->tail_lock, NULL);
+  pthread_mutex_init(&q->free_lock, NULL);
+  pthread_cond_init(&q->nonempty, NULL);
+
+  return q;
+}
+
+/* see dbllq.h */
+void dbllq_free(struct dbllq *q)
+{
+  struct llnode *curr, *next;
+
+  for(curr = q->head; curr != NULL; curr = next) {
+    next = curr->next;
+    free(curr);
+  }
+
+  for(curr = q->free_nodes; curr != NULL; curr = next) {
+    next = curr->prev;
+    free(curr);
+  }
+
+  pthread_mutex_destroy(&q->head_lock);
+  pthread_mutex_destroy(&q->tail_lock);
+  pthread_mutex_destroy(&q->free_lock);
+  pthread_cond_destroy(&q->nonempty);
+  free(q);
+}
+
+/* wake consumers blocked on an empty queue after n items were pushed */
+static void dbllq_wake(struct dbllq *q, size_t n)
+{
+  /* pairs with the increment in dbllq_pop: either the consumer sees the
+     new item or we see the consumer */
+  if(__atomic_load_n(&q->waiters, __ATOMIC_SEQ_CST) == 0)
+    return;
+
+  pthread_mutex_lock(&q->head_lock);
+  if(n == 1)
+    pthread_cond_signal(&q->nonempty);
+  else
+    pthread_cond_broadcast(&q->nonempty);
+  pthread_mutex_unlock(&q->head_lock);
+}
+
+/* see dbllq.h */
+int dbllq_push(struct dbllq *q, void *user_data)
+{
+  struct llnode *node = dbllq_get_nodes(q, 1);
+  if(node == NULL)
+    return 0;
+
+  node->user_data = user_data;
+  node->next = NULL;
+
+  pthread_mutex_lock(&q->tail_lock);
+  __atomic_store_n(&q->tail->next, node, __ATOMIC_SEQ_CST);
+  q->tail = node;
+  pthread_mutex_unlock(&q->tail_lock);
+
+  dbllq_wake(q, 1);
+  return 1;
+}
+
+/* see dbllq.h */
+int dbllq_push_batch(struct dbllq *q, void **user_data, size_t n)
+{
+  struct llnode *chain, *first = NULL, *last = NULL, *node;
+  size_t i;
+
+  if(n == 0)
+    return 1;
+
+  chain = dbllq_get_nodes(q, n);
+  if(chain == NULL)
+    return 0;
+
+  /* link the batch privately, then publish it with a single store */
+  for(i = 0; i < n; i++) {
+    node = chain;
+    chain = chain->prev;
+    node->user_data = user_data[i];
+    node->next = NULL;
+    if(last != NULL)
+      last->next = node;
+    else
+      first = node;
+    last = node;
+  }
+
+  pthread_mutex_lock(&q->tail_lock);
+  __atomic_store_n(&q->tail->next, first, __ATOMIC_SEQ_CST);
+  q->tail = last;
+  pthread_mutex_unlock(&q->tail_lock);
+
+  dbllq_wake(q, n);
+  return 1;
+}
+
+/* pop one item with head_lock held, returns the old dummy or NULL if empty */
+static struct llnode *dbllq_pop_locked(struct dbllq *q, void **user_data)
+{
+  struct llnode *node = q->head;
+  struct llnode *next = LOAD_NEXT(node);
+
+  if(next == NULL)
+    return NULL;
+
+  /* next becomes the new dummy */
+  *user_data = next->user_data;
+  q->head = next;
+  return node;
+}
+
+/* see dbllq.h */
+int dbllq_trypop(struct dbllq *q, void **user_data)
+{
+  struct llnode *node;
+
+  pthread_mutex_lock(&q->head_lock);
+  node = dbllq_pop_locked(q, user_data);
+  pthread_mutex_unlock(&q->head_lock);
+
+  if(node == NULL)
+    return 0;
+
+  node->prev = NULL;
+  dbllq_put_nodes(q, node);
+  return 1;
+}
+
+/* see dbllq.h */
+int dbllq_pop(struct dbllq *q, void **user_data)
+{
+  struct llnode *node;
+
+  pthread_mutex_lock(&q->head_lock);
+  for(;;) {
+    __atomic_fetch_add(&q->waiters, 1, __ATOMIC_SEQ_CST);
+    node = dbllq_pop_locked(q, user_data);
+
+    if(node != NULL || q->closed) {
+      __atomic_fetch_sub(&q->waiters, 1, __ATOMIC_SEQ_CST);
+      break;
+    }
+
+    pthread_cond_wait(&q->nonempty, &q->head_lock);
+    __atomic_fetch_sub(&q->waiters, 1, __ATOMIC_SEQ_CST);
+  }
+  pthread_mutex_unlock(&q->head_lock);
+
+  if(node == NULL)
+    return 0;
+
+  node->prev = NULL;
+  dbllq_put_nodes(q, node);
+  return 1;
+}
+
+/* see dbllq.h */
+size_t dbllq_pop_batch(struct dbllq *q, void **user_data, size_t max)
+{
+  struct llnode *chain = NULL, *node;
+  size_t n = 0;
+
+  pthread_mutex_lock(&q->head_lock);
+  while(n < max && (node = dbllq_pop_locked(q, &user_data[n])) != NULL) {
+    node->prev = chain;
+    chain = node;
+    n++;
+  }
+  pthread_mutex_unlock(&q->head_lock);
+
+  dbllq_put_nodes(q, chain);
+  return n;
+}
+
+/* see dbllq.h */
+void dbllq_close(struct dbllq *q)
+{
+  pthread_mutex_lock(&q->head_lock);
+  q->closed = 1;
+  pthread_cond_broadcast(&q->nonempty);
+  pthread_mutex_unlock(&q->head_lock);
+}
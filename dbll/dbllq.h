@@ -0,0 +1,57 @@
+#pragma once
+#include <stddef.h>
+#include <pthread.h>
+#include "dbll.h"
+
+/* Multi-producer/multi-consumer FIFO queue built from llnodes */
+
+/* This is the two-lock queue of Michael and Scott: producers only take
+   tail_lock and consumers only take head_lock, so one producer and one
+   consumer never contend. Only next is used in queued nodes; prev
+   links recycled nodes together on the free list. */
+
+/* Invariant: head is a dummy node, head->next is the oldest item */
+/* Invariant: tail is the most recently pushed node (head if empty) */
+
+struct dbllq {
+  struct llnode *head;        /* dummy node, protected by head_lock */
+  struct llnode *tail;        /* protected by tail_lock */
+  pthread_mutex_t head_lock;
+  pthread_mutex_t tail_lock;
+  pthread_cond_t nonempty;    /* signalled under head_lock */
+  int waiters;                /* consumers blocked in dbllq_pop */
+  int closed;
+
+  struct llnode *free_nodes;  /* recycled nodes, linked through prev */
+  size_t nfree;
+  pthread_mutex_t free_lock;
+};
+
+/* recycled nodes kept per queue before they are returned to malloc */
+#define DBLLQ_MAX_FREE 4096
+
+struct dbllq *dbllq_create();
+
+/* frees the queue and its nodes; items still queued are dropped */
+void dbllq_free(struct dbllq *q);
+
+/* add user_data at the tail, return 0 if memory could not be allocated */
+int dbllq_push(struct dbllq *q, void *user_data);
+
+/* add n items at the tail in order, taking tail_lock once */
+/* return 0 (pushing nothing) if memory could not be allocated */
+int dbllq_push_batch(struct dbllq *q, void **user_data, size_t n);
+
+/* remove the oldest item into *user_data, return 0 if the queue is empty */
+int dbllq_trypop(struct dbllq *q, void **user_data);
+
+/* like dbllq_trypop, but wait while the queue is empty */
+/* return 0 only once the queue is closed and empty */
+int dbllq_pop(struct dbllq *q, void **user_data);
+
+/* remove up to max of the oldest items, taking head_lock once */
+/* returns the number of items removed, does not block */
+size_t dbllq_pop_batch(struct dbllq *q, void **user_data, size_t max);
+
+/* wake all blocked consumers; dbllq_pop returns 0 once the queue drains */
+void dbllq_close(struct dbllq *q);
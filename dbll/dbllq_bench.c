@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "dbll.h"
+#include "dbllq.h"
+
+/* Producer/consumer scaling and latency of dbllq against a dbll used as
+   a FIFO behind one global lock */
+
+/* usage: dbllq_bench [items per producer] */
+
+#define BATCH 32
+
+enum mode { LOCKED_DBLL, DBLLQ, DBLLQ_BATCH };
+static const char *mode_names[] = { "locked-dbll", "dbllq", "dbllq-batch" };
+
+struct locked_fifo {
+  struct dbll *ll;
+  pthread_mutex_t lock;
+  pthread_cond_t nonempty;
+  int closed;
+};
+
+struct bench {
+  enum mode mode;
+  struct dbllq *q;
+  struct locked_fifo fifo;
+  int items;                  /* per producer */
+  long remaining;             /* items not yet consumed */
+};
+
+struct worker {
+  struct bench *b;
+  uint64_t *stamps;           /* producer: push timestamps, one per item */
+  uint64_t *lat;              /* consumer: observed latencies */
+  long nlat;
+  long cap;
+};
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void record(struct worker *w, uint64_t *stamp, uint64_t t) {
+  if(w->nlat == w->cap) {
+	w->cap = w->cap ? 2 * w->cap : 4096;
+	w->lat = realloc(w->lat, w->cap * sizeof(uint64_t));
+  }
+  w->lat[w->nlat++] = t - *stamp;
+}
+
+static void *producer(void *arg) {
+  struct worker *w = arg;
+  struct bench *b = w->b;
+  void *batch[BATCH];
+  int i, n = 0;
+
+  for(i = 0; i < b->items; i++) {
+	w->stamps[i] = now_ns();
+
+	switch(b->mode) {
+	case LOCKED_DBLL:
+	  pthread_mutex_lock(&b->fifo.lock);
+	  dbll_append(b->fifo.ll, &w->stamps[i]);
+	  pthread_cond_signal(&b->fifo.nonempty);
+	  pthread_mutex_unlock(&b->fifo.lock);
+	  break;
+	case DBLLQ:
+	  dbllq_push(b->q, &w->stamps[i]);
+	  break;
+	case DBLLQ_BATCH:
+	  batch[n++] = &w->stamps[i];
+	  if(n == BATCH || i == b->items - 1) {
+		dbllq_push_batch(b->q, batch, n);
+		n = 0;
+	  }
+	  break;
+	}
+  }
+
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  struct worker *w = arg;
+  struct bench *b = w->b;
+  void *batch[BATCH];
+  void *v;
+  size_t i, n;
+
+  switch(b->mode) {
+  case LOCKED_DBLL:
+	for(;;) {
+	  pthread_mutex_lock(&b->fifo.lock);
+	  while(b->fifo.ll->first == NULL && !b->fifo.closed)
+		pthread_cond_wait(&b->fifo.nonempty, &b->fifo.lock);
+	  if(b->fifo.ll->first == NULL) {
+		pthread_mutex_unlock(&b->fifo.lock);
+		break;
+	  }
+	  v = b->fifo.ll->first->user_data;
+	  dbll_remove(b->fifo.ll, b->fifo.ll->first);
+	  pthread_mutex_unlock(&b->fifo.lock);
+	  record(w, v, now_ns());
+	}
+	break;
+  case DBLLQ:
+	while(dbllq_pop(b->q, &v))
+	  record(w, v, now_ns());
+	break;
+  case DBLLQ_BATCH:
+	while(__atomic_load_n(&b->remaining, __ATOMIC_RELAXED) > 0) {
+	  n = dbllq_pop_batch(b->q, batch, BATCH);
+	  if(n == 0) {
+		sched_yield();
+		continue;
+	  }
+	  uint64_t t = now_ns();
+	  for(i = 0; i < n; i++)
+		record(w, batch[i], t);
+	  __atomic_fetch_sub(&b->remaining, n, __ATOMIC_RELAXED);
+	}
+	break;
+  }
+
+  return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static void run(enum mode mode, int nprod, int ncons, int items) {
+  struct bench b;
+  pthread_t pt[nprod], ct[ncons];
+  struct worker pw[nprod], cw[ncons];
+  uint64_t t0, t1, *all;
+  long total = (long) nprod * items, n = 0;
+  int i;
+
+  b.mode = mode;
+  b.items = items;
+  b.remaining = total;
+  b.q = dbllq_create();
+  b.fifo.ll = dbll_create();
+  b.fifo.closed = 0;
+  pthread_mutex_init(&b.fifo.lock, NULL);
+  pthread_cond_init(&b.fifo.nonempty, NULL);
+
+  t0 = now_ns();
+
+  for(i = 0; i < ncons; i++) {
+	cw[i].b = &b;
+	cw[i].lat = NULL;
+	cw[i].nlat = cw[i].cap = 0;
+	pthread_create(&ct[i], NULL, consumer, &cw[i]);
+  }
+
+  for(i = 0; i < nprod; i++) {
+	pw[i].b = &b;
+	pw[i].stamps = malloc(items * sizeof(uint64_t));
+	pthread_create(&pt[i], NULL, producer, &pw[i]);
+  }
+
+  for(i = 0; i < nprod; i++)
+	pthread_join(pt[i], NULL);
+
+  dbllq_close(b.q);
+  pthread_mutex_lock(&b.fifo.lock);
+  b.fifo.closed = 1;
+  pthread_cond_broadcast(&b.fifo.nonempty);
+  pthread_mutex_unlock(&b.fifo.lock);
+
+  for(i = 0; i < ncons; i++)
+	pthread_join(ct[i], NULL);
+
+  t1 = now_ns();
+
+  all = malloc(total * sizeof(uint64_t));
+  for(i = 0; i < ncons; i++) {
+	for(long j = 0; j < cw[i].nlat && n < total; j++)
+	  all[n++] = cw[i].lat[j];
+	free(cw[i].lat);
+  }
+  qsort(all, n, sizeof(uint64_t), cmp_u64);
+
+  printf("%-12s P=%-2d C=%-2d items=%-9ld Mops/s=%-8.2f lat_ns p50=%-9lu p99=%-9lu p99.9=%-9lu max=%lu\n",
+		 mode_names[mode], nprod, ncons, n, n / ((t1 - t0) / 1e3),
+		 (unsigned long) all[n / 2], (unsigned long) all[n * 99 / 100],
+		 (unsigned long) all[n * 999 / 1000], (unsigned long) all[n - 1]);
+
+  free(all);
+  for(i = 0; i < nprod; i++)
+	free(pw[i].stamps);
+  dbllq_free(b.q);
+  dbll_free(b.fifo.ll);
+  pthread_mutex_destroy(&b.fifo.lock);
+  pthread_cond_destroy(&b.fifo.nonempty);
+}
+
+int main(int argc, char *argv[]) {
+  int items = argc > 1 ? atoi(argv[1]) : 200000;
+  int configs[][2] = { {1, 1}, {2, 2}, {4, 4}, {8, 8}, {1, 4}, {4, 1} };
+  int c, m;
+
+  for(c = 0; c < (int) (sizeof(configs) / sizeof(configs[0])); c++)
+	for(m = LOCKED_DBLL; m <= DBLLQ_BATCH; m++)
+	  run(m, configs[c][0], configs[c][1], items);
+
+  return 0;
+}
@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lru.h"
+
+/* Routines for an LRU cache on top of a doubly-linked list (see lru.h) */
+
+#define LRU_MIN_TABLE 16
+
+/* FNV-1a */
+static uint64_t lru_hash(const void *key, size_t klen)
+{
+  const unsigned char *k = key;
+  uint64_t h = 14695981039346656037ull;
+  size_t i;
+
+  for(i = 0; i < klen; i++) {
+    h ^= k[i];
+    h *= 1099511628211ull;
+  }
+
+  return h;
+}
+
+static struct lru_shard *lru_shard_of(struct lru_cache *c, uint64_t h)
+{
+  /* the table index uses the low bits, so pick the shard from the high ones */
+  return &c->shards[(h >> 32) % c->nshards];
+}
+
+/* slot holding key, or the empty slot where it would be inserted */
+static size_t lru_find(struct lru_shard *sh, uint64_t h, const void *key, size_t klen)
+{
+  size_t mask = sh->tcap - 1;
+  size_t i = h & mask;
+  struct lru_entry *e;
+
+  while((e = sh->table[i]) != NULL) {
+    if(e->hash == h && e->klen == klen && memcmp(e->key, key, klen) == 0)
+      break;
+    i = (i + 1) & mask;
+  }
+
+  return i;
+}
+
+/* empty slot i, shifting later entries of the probe run back so that
+   no tombstones are needed */
+static void lru_table_delete(struct lru_shard *sh, size_t i)
+{
+  size_t mask = sh->tcap - 1;
+  size_t j = i, home;
+
+  for(;;) {
+    sh->table[i] = NULL;
+
+    for(;;) {
+      j = (j + 1) & mask;
+      if(sh->table[j] == NULL)
+        return;
+
+      /* the entry at j may move to i unless its home slot lies
+         cyclically in (i, j] */
+      home = sh->table[j]->hash & mask;
+      if(i <= j ? (i < home && home <= j) : (i < home || home <= j))
+        continue;
+
+      break;
+    }
+
+    sh->table[i] = sh->table[j];
+    i = j;
+  }
+}
+
+/* double the table, return 0 if memory could not be allocated */
+static int lru_table_grow(struct lru_shard *sh)
+{
+  struct lru_entry **old = sh->table;
+  size_t oldcap = sh->tcap, i;
+
+  sh->table = calloc(2 * oldcap, sizeof(struct lru_entry *));
+  if(sh->table == NULL) {
+    sh->table = old;
+    return 0;
+  }
+
+  sh->tcap = 2 * oldcap;
+  for(i = 0; i < oldcap; i++) {
+    if(old[i] != NULL)
+      sh->table[lru_find(sh, old[i]->hash, old[i]->key, old[i]->klen)] = old[i];
+  }
+
+  free(old);
+  return 1;
+}
+
+/* unlink the entry in slot i from the index and the list and free it */
+static void lru_drop(struct lru_cache *c, struct lru_shard *sh, size_t i)
+{
+  struct lru_entry *e = sh->table[i];
+
+  lru_table_delete(sh, i);
+  dbll_remove(sh->order, e->node);
+  sh->stats.count--;
+  sh->stats.bytes -= e->size;
+
+  if(c->release != NULL)
+    c->release(e->key, e->klen, e->value, c->ctx);
+  free(e);
+}
+
+static void lru_evict(struct lru_cache *c, struct lru_shard *sh)
+{
+  while((sh->capacity && sh->stats.count > sh->capacity) ||
+        (sh->byte_budget && sh->stats.bytes > sh->byte_budget)) {
+    struct lru_entry *e = sh->order->last->user_data;
+
+    lru_drop(c, sh, lru_find(sh, e->hash, e->key, e->klen));
+    sh->stats.evictions++;
+  }
+}
+
+/* see lru.h */
+struct lru_cache *lru_create(size_t capacity, size_t byte_budget, unsigned nshards,
+							 void (*release)(const void *key, size_t klen, void *value, void *ctx),
+							 void *ctx)
+{
+  struct lru_cache *c;
+  unsigned i;
+
+  if(nshards == 0)
+    nshards = 1;
+
+  /* every shard needs a limit of at least 1, 0 would mean no limit */
+  if((capacity > 0 && capacity < nshards) || (byte_budget > 0 && byte_budget < nshards))
+    return NULL;
+
+  c = malloc(sizeof(struct lru_cache));
+  if(c == NULL)
+    return NULL;
+
+  c->shards = calloc(nshards, sizeof(struct lru_shard));
+  if(c->shards == NULL) {
+    free(c);
+    return NULL;
+  }
+
+  c->nshards = nshards;
+  c->release = release;
+  c->ctx = ctx;
+
+  for(i = 0; i < nshards; i++) {
+    struct lru_shard *sh = &c->shards[i];
+
+    pthread_mutex_init(&sh->lock, NULL);
+    sh->order = dbll_create();
+    sh->tcap = LRU_MIN_TABLE;
+    sh->table = calloc(sh->tcap, sizeof(struct lru_entry *));
+    /* the first shards take the remainders, so the limits add up exactly */
+    sh->capacity = capacity / nshards + (i < capacity % nshards);
+    sh->byte_budget = byte_budget / nshards + (i < byte_budget % nshards);
+
+    if(sh->order == NULL || sh->table == NULL) {
+      c->nshards = i + 1;
+      lru_free(c);
+      return NULL;
+    }
+  }
+
+  return c;
+}
+
+/* see lru.h */
+void lru_free(struct lru_cache *c)
+{
+  unsigned i;
+
+  for(i = 0; i < c->nshards; i++) {
+    struct lru_shard *sh = &c->shards[i];
+    size_t j;
+
+    if(sh->table != NULL) {
+      for(j = 0; j < sh->tcap; j++) {
+        struct lru_entry *e = sh->table[j];
+        if(e == NULL)
+          continue;
+        if(c->release != NULL)
+          c->release(e->key, e->klen, e->value, c->ctx);
+        free(e);
+      }
+    }
+
+    if(sh->order != NULL)
+      dbll_free(sh->order);
+    free(sh->table);
+    pthread_mutex_destroy(&sh->lock);
+  }
+
+  free(c->shards);
+  free(c);
+}
+
+/* see lru.h */
+void *lru_get(struct lru_cache *c, const void *key, size_t klen)
+{
+  uint64_t h = lru_hash(key, klen);
+  struct lru_shard *sh = lru_shard_of(c, h);
+  struct lru_entry *e;
+  void *value = NULL;
+
+  pthread_mutex_lock(&sh->lock);
+  e = sh->table[lru_find(sh, h, key, klen)];
+  if(e != NULL) {
+    dbll_move_before(sh->order, e->node, NULL);
+    value = e->value;
+    sh->stats.hits++;
+  } else {
+    sh->stats.misses++;
+  }
+  pthread_mutex_unlock(&sh->lock);
+
+  return value;
+}
+
+/* see lru.h */
+int lru_put(struct lru_cache *c, const void *key, size_t klen, void *value, size_t size)
+{
+  uint64_t h = lru_hash(key, klen);
+  struct lru_shard *sh = lru_shard_of(c, h);
+  struct lru_entry *e;
+  size_t i;
+
+  if(sh->byte_budget && size > sh->byte_budget)
+    return 0;
+
+  pthread_mutex_lock(&sh->lock);
+  i = lru_find(sh, h, key, klen);
+  e = sh->table[i];
+
+  if(e != NULL) {
+    if(c->release != NULL && e->value != value)
+      c->release(e->key, e->klen, e->value, c->ctx);
+
+    sh->stats.bytes += size - e->size;
+    e->value = value;
+    e->size = size;
+    dbll_move_before(sh->order, e->node, NULL);
+  } else {
+    /* keep the load factor below 0.7 */
+    if(10 * (sh->stats.count + 1) > 7 * sh->tcap) {
+      if(!lru_table_grow(sh)) {
+        pthread_mutex_unlock(&sh->lock);
+        return 0;
+      }
+      i = lru_find(sh, h, key, klen);
+    }
+
+    e = malloc(sizeof(struct lru_entry) + klen);
+    if(e == NULL || (e->node = dbll_insert_before(sh->order, NULL, e)) == NULL) {
+      free(e);
+      pthread_mutex_unlock(&sh->lock);
+      return 0;
+    }
+
+    e->hash = h;
+    e->value = value;
+    e->size = size;
+    e->klen = klen;
+    memcpy(e->key, key, klen);
+
+    sh->table[i] = e;
+    sh->stats.count++;
+    sh->stats.bytes += size;
+    sh->stats.inserts++;
+  }
+
+  lru_evict(c, sh);
+  pthread_mutex_unlock(&sh->lock);
+  return 1;
+}
+
+/* see lru.h */
+int lru_remove(struct lru_cache *c, const void *key, size_t klen)
+{
+  uint64_t h = lru_hash(key, klen);
+  struct lru_shard *sh = lru_shard_of(c, h);
+  size_t i;
+  int found;
+
+  pthread_mutex_lock(&sh->lock);
+  i = lru_find(sh, h, key, klen);
+  found = sh->table[i] != NULL;
+  if(found)
+    lru_drop(c, sh, i);
+  pthread_mutex_unlock(&sh->lock);
+
+  return found;
+}
+
+/* see lru.h */
+void lru_get_stats(struct lru_cache *c, struct lru_stats *stats)
+{
+  unsigned i;
+
+  memset(stats, 0, sizeof(*stats));
+
+  for(i = 0; i < c->nshards; i++) {
+    struct lru_shard *sh = &c->shards[i];
+
+    pthread_mutex_lock(&sh->lock);
+    stats->hits += sh->stats.hits;
+    stats->misses += sh->stats.misses;
+    stats->inserts += sh->stats.inserts;
+    stats->evictions += sh->stats.evictions;
+    stats->count += sh->stats.count;
+    stats->bytes += sh->stats.bytes;
+    pthread_mutex_unlock(&sh->lock);
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "dbll.h"
+
+/* LRU cache: a dbll in recency order plus an open-addressing hash index */
+
+/* Keys are byte strings and are copied into the cache. Values are
+   opaque pointers with a caller-supplied size that counts towards the
+   byte budget. Whenever the cache drops a value (eviction, replacement,
+   lru_remove or lru_free) it calls release(key, klen, value, ctx). */
+
+/* Keys are spread over shards, each with its own lock, list and index.
+   Limits are divided evenly between the shards. */
+
+struct lru_entry {
+  uint64_t hash;
+  struct llnode *node;        /* node in the shard's order list */
+  void *value;
+  size_t size;                /* bytes charged against the budget */
+  size_t klen;
+  char key[];                 /* copy of the key */
+};
+
+struct lru_stats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long inserts;
+  unsigned long evictions;
+  size_t count;               /* entries currently cached */
+  size_t bytes;               /* sum of their sizes */
+};
+
+/* Invariant: order->first is the most recently used entry, order->last
+   the least recently used one */
+/* Invariant: every entry is in exactly one table slot and one list node */
+struct lru_shard {
+  pthread_mutex_t lock;
+  struct dbll *order;
+  struct lru_entry **table;   /* linear probing, NULL marks an empty slot */
+  size_t tcap;                /* power of two */
+  size_t capacity;            /* max entries, 0 for no limit */
+  size_t byte_budget;         /* max bytes, 0 for no limit */
+  struct lru_stats stats;
+};
+
+struct lru_cache {
+  struct lru_shard *shards;
+  unsigned nshards;
+  void (*release)(const void *key, size_t klen, void *value, void *ctx);
+  void *ctx;
+};
+
+/* create a cache holding at most `capacity` entries and `byte_budget`
+   bytes (0 means no limit) split over `nshards` shards (at least 1) */
+/* each shard enforces its share of the limits on its own, so the cache
+   can evict while other shards still have room */
+/* release may be NULL; returns NULL if memory allocation failed or a
+   non-zero limit is smaller than nshards */
+struct lru_cache *lru_create(size_t capacity, size_t byte_budget, unsigned nshards,
+							 void (*release)(const void *key, size_t klen, void *value, void *ctx),
+							 void *ctx);
+
+/* release every cached value and free the cache */
+void lru_free(struct lru_cache *c);
+
+/* look up key and mark it most recently used; NULL on a miss */
+/* with several threads, the value may be released by another thread as
+   soon as this returns, unless release leaves freeing it to the caller */
+void *lru_get(struct lru_cache *c, const void *key, size_t klen);
+
+/* insert or replace key, then evict least recently used entries until the
+   shard is within its limits */
+/* return 0 if memory could not be allocated or size alone exceeds the
+   shard's byte budget; the value is not cached (and not released) then */
+int lru_put(struct lru_cache *c, const void *key, size_t klen, void *value, size_t size);
+
+/* drop key from the cache, return 0 if it was not cached */
+int lru_remove(struct lru_cache *c, const void *key, size_t klen);
+
+/* counters summed over all shards */
+void lru_get_stats(struct lru_cache *c, struct lru_stats *stats);
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "dbll.h"
+#include "lru.h"
+#include "test_helper.h"
+
+void count_release(const void *key, size_t klen, void *value, void *ctx) {
+  (*(int *) ctx)++;
+}
+
+int test_lru_capacity() {
+  struct lru_cache *c;
+  struct lru_stats st;
+  int released = 0;
+  int ret = 0;
+  int v[] = {0, 1, 2, 3};
+
+  c = lru_create(3, 0, 1, count_release, &released);
+
+  if(!(ret = th_check(c != NULL, "capacity: lru_create returned non-null (%p)", c)))
+	return 0;
+
+  ret = th_check(lru_put(c, "a", 1, &v[0], 1), "capacity: put a") && ret;
+  ret = th_check(lru_put(c, "b", 1, &v[1], 1), "capacity: put b") && ret;
+  ret = th_check(lru_put(c, "c", 1, &v[2], 1), "capacity: put c") && ret;
+
+  struct llnode *node = c->shards[0].order->last;
+
+  /* a becomes most recently used, so b is evicted next */
+  ret = th_check(lru_get(c, "a", 1) == &v[0], "capacity: get a returns its value") && ret;
+  ret = th_check(c->shards[0].order->first == node, "capacity: hit moves the same node (%p) to the front (%p)", node, c->shards[0].order->first) && ret;
+
+  ret = th_check(lru_put(c, "d", 1, &v[3], 1), "capacity: put d") && ret;
+
+  ret = th_check(lru_get(c, "b", 1) == NULL, "capacity: b was evicted") && ret;
+  ret = th_check(lru_get(c, "a", 1) == &v[0], "capacity: a is still cached") && ret;
+  ret = th_check(lru_get(c, "c", 1) == &v[2], "capacity: c is still cached") && ret;
+  ret = th_check(lru_get(c, "d", 1) == &v[3], "capacity: d is still cached") && ret;
+  ret = th_check(released == 1, "capacity: one value released (%d)", released) && ret;
+
+  /* replacing a value releases the old one */
+  ret = th_check(lru_put(c, "a", 1, &v[1], 1), "capacity: replace a") && ret;
+  ret = th_check(lru_get(c, "a", 1) == &v[1], "capacity: a has the new value") && ret;
+  ret = th_check(released == 2, "capacity: replaced value released (%d)", released) && ret;
+
+  ret = th_check(lru_remove(c, "c", 1) == 1, "capacity: remove c") && ret;
+  ret = th_check(lru_remove(c, "c", 1) == 0, "capacity: remove c again finds nothing") && ret;
+
+  lru_get_stats(c, &st);
+  ret = th_check(st.hits == 5 && st.misses == 1, "capacity: hits (%lu) and misses (%lu) are 5 and 1", st.hits, st.misses) && ret;
+  ret = th_check(st.evictions == 1 && st.inserts == 4, "capacity: evictions (%lu) and inserts (%lu) are 1 and 4", st.evictions, st.inserts) && ret;
+  ret = th_check(st.count == 2 && st.bytes == 2, "capacity: count (%lu) and bytes (%lu) are 2 and 2", st.count, st.bytes) && ret;
+
+  lru_free(c);
+  ret = th_check(released == 5, "capacity: lru_free releases remaining values (%d)", released) && ret;
+
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+int test_lru_bytes() {
+  struct lru_cache *c;
+  struct lru_stats st;
+  int ret = 0;
+  int N = 1000, i;
+  char key[16];
+
+  c = lru_create(0, 100, 1, NULL, NULL);
+
+  if(!(ret = th_check(c != NULL, "bytes: lru_create returned non-null (%p)", c)))
+	return 0;
+
+  ret = th_check(lru_put(c, "big", 3, c, 101) == 0, "bytes: value larger than the budget is refused") && ret;
+
+  for(i = 0; i < N; i++) {
+	snprintf(key, sizeof(key), "k%d", i);
+	if(!lru_put(c, key, strlen(key), c, 10)) break;
+  }
+
+  ret = th_check(i == N, "bytes: %d puts succeed (%d)", N, i) && ret;
+
+  lru_get_stats(c, &st);
+  ret = th_check(st.count == 10 && st.bytes == 100, "bytes: count (%lu) and bytes (%lu) are 10 and 100", st.count, st.bytes) && ret;
+  ret = th_check(st.evictions == N - 10, "bytes: evictions (%lu) are %d", st.evictions, N - 10) && ret;
+
+  for(i = N - 10; i < N; i++) {
+	snprintf(key, sizeof(key), "k%d", i);
+	ret = th_check(lru_get(c, key, strlen(key)) == c, "bytes: most recent key %s is cached", key) && ret;
+  }
+
+  lru_free(c);
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+struct lru_worker_args {
+  struct lru_cache *c;
+  int id;
+};
+
+void *lru_worker(void *arg) {
+  struct lru_worker_args *a = arg;
+  char key[16];
+  int i;
+
+  for(i = 0; i < 10000; i++) {
+	snprintf(key, sizeof(key), "%d-%d", a->id, i % 500);
+	if(lru_get(a->c, key, strlen(key)) == NULL)
+	  lru_put(a->c, key, strlen(key), a, 1);
+  }
+
+  return NULL;
+}
+
+int test_lru_sharded() {
+  struct lru_cache *c;
+  struct lru_stats st;
+  int T = 4, i, ret = 0;
+  pthread_t tids[T];
+  struct lru_worker_args args[T];
+
+  c = lru_create(1024, 0, 8, NULL, NULL);
+
+  if(!(ret = th_check(c != NULL, "sharded: lru_create returned non-null (%p)", c)))
+	return 0;
+
+  for(i = 0; i < T; i++) {
+	args[i].c = c;
+	args[i].id = i;
+	pthread_create(&tids[i], NULL, lru_worker, &args[i]);
+  }
+
+  for(i = 0; i < T; i++)
+	pthread_join(tids[i], NULL);
+
+  lru_get_stats(c, &st);
+  ret = th_check(st.hits + st.misses == T * 10000, "sharded: every lookup is a hit or a miss (%lu + %lu)", st.hits, st.misses) && ret;
+  ret = th_check(st.count <= 1024, "sharded: count (%lu) stays within capacity", st.count) && ret;
+  ret = th_check(st.inserts - st.evictions == st.count, "sharded: inserts - evictions == count (%lu - %lu == %lu)", st.inserts, st.evictions, st.count) && ret;
+
+  lru_free(c);
+
+  /* limits that do not divide evenly are still exact */
+  c = lru_create(10, 0, 3, NULL, NULL);
+  for(i = 0; i < 1000; i++)
+	lru_put(c, &i, sizeof(i), NULL, 1);
+  lru_get_stats(c, &st);
+  ret = th_check(st.count == 10, "sharded: 3 shards hold exactly capacity 10 (%lu)", st.count) && ret;
+  lru_free(c);
+
+  c = lru_create(2, 0, 8, NULL, NULL);
+  ret = th_check(c == NULL, "sharded: lru_create rejects fewer entries than shards") && ret;
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+int main(void) {
+  if(!test_lru_capacity())
+	exit(1);
+
+  if(!test_lru_bytes())
+	exit(1);
+
+  if(!test_lru_sharded())
+	exit(1);
+
+  printf("ALL DONE\n");
+  return 0;
+}
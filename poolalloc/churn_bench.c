@@ -0,0 +1,70 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "poolalloc.h"
+#include "th_perf.h"
+
+/* mpool_alloc/mpool_free churn with eager and deferred coalescing */
+
+/* usage: churn_bench [live blocks] [operations] */
+
+/* keeps `live` blocks allocated and replaces a random one per
+   operation; 9 in 10 sizes come from a few common sizes, the rest are
+   uniform in 16..1024 */
+
+/* hardware counters per operation go to stderr (see th_perf.h) */
+
+static const size_t common[] = { 16, 32, 48, 64, 96, 128, 256, 512 };
+
+static size_t pick_size() {
+  if(rand() % 10 == 0)
+	return 16 + rand() % 1009;
+  return common[rand() % 8];
+}
+
+static double run(size_t threshold, int live, long ops) {
+  struct memory_pool *p = mpool_create((size_t) live * 2048);
+  char **blocks = malloc(live * sizeof(char *));
+  struct th_perf perf;
+  char label[64];
+  long i;
+
+  mpool_set_deferred(p, threshold);
+  srand(1);
+  for(i = 0; i < live; i++)
+	blocks[i] = mpool_alloc(p, pick_size());
+
+  th_perf_init(&perf);
+  th_perf_start(&perf);
+  for(i = 0; i < ops; i++) {
+	int k = rand() % live;
+	mpool_free(p, blocks[k]);
+	blocks[k] = mpool_alloc(p, pick_size());
+	if(blocks[k] == NULL) {
+	  fprintf(stderr, "pool exhausted\n");
+	  exit(1);
+	}
+  }
+  th_perf_stop(&perf);
+
+  snprintf(label, sizeof(label), "free+alloc, threshold %zu", threshold);
+  th_perf_report(&perf, label, ops);
+  th_perf_close(&perf);
+
+  free(blocks);
+  mpool_destroy(p);
+  return (double) perf.ns / ops;
+}
+
+int main(int argc, char *argv[]) {
+  int live = argc > 1 ? atoi(argv[1]) : 2000;
+  long ops = argc > 2 ? atol(argv[2]) : 200000;
+  size_t thresholds[] = { 0, 16, 64, 256, 1024 };
+  int i;
+
+  printf("%-10s %-10s %s\n", "live", "threshold", "ns/op");
+  for(i = 0; i < 5; i++)
+	printf("%-10d %-10zu %.1f\n", live, thresholds[i], run(thresholds[i], live, ops));
+
+  return 0;
+}
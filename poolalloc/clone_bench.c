@@ -0,0 +1,108 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "poolalloc.h"
+
+/* cost of starting from a populated template pool: copying it with
+   memcpy versus mpool_clone of a snapshot */
+
+/* usage: clone_bench [pool size] [clones] */
+
+/* the template is filled with 4KB blocks; each copy then writes one
+   byte into 1 page in 100, as a worker touching a little of its state
+   would. Memory is the growth of Private_Dirty + Private_Clean + Shared
+   in /proc/self/smaps_rollup per copy. */
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* kB of memory the process has faulted in */
+static long resident_kb() {
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  char line[256];
+  long kb, total = 0;
+
+  if(f == NULL)
+	return -1;
+  while(fgets(line, sizeof(line), f) != NULL) {
+	if(sscanf(line, "Private_Dirty: %ld", &kb) == 1 || sscanf(line, "Private_Clean: %ld", &kb) == 1 ||
+	   sscanf(line, "Shared_Dirty: %ld", &kb) == 1 || sscanf(line, "Shared_Clean: %ld", &kb) == 1)
+	  total += kb;
+  }
+  fclose(f);
+  return total;
+}
+
+static void touch(char *start, size_t size) {
+  size_t off;
+  for(off = 0; off < size; off += 100 * 4096)
+	start[off]++;
+}
+
+int main(int argc, char *argv[]) {
+  size_t size = argc > 1 ? strtoul(argv[1], NULL, 0) : 1UL << 30;
+  int clones = argc > 2 ? atoi(argv[2]) : 4;
+  struct memory_pool *t, **c;
+  struct mpool_snapshot *s;
+  size_t n = 0;
+  double t0, copy_ms, snap_ms, clone_ms;
+  long kb0, copy_kb, clone_kb;
+  char *b;
+  int i;
+
+  t = mpool_create_flags(size, MPOOL_MEMFD);
+  if(t == NULL) {
+	fprintf(stderr, "mpool_create_flags failed\n");
+	return 1;
+  }
+  while((b = mpool_alloc(t, 4096)) != NULL) {
+	memset(b, n & 0xff, 4096);
+	n++;
+  }
+  printf("template: %zu MB, %zu blocks\n", size >> 20, n);
+
+  /* memcpy baseline: a malloc'd copy of the pool memory alone, without
+     the block records */
+  c = malloc(clones * sizeof(*c));
+  kb0 = resident_kb();
+  t0 = now_ms();
+  for(i = 0; i < clones; i++) {
+	char *m = malloc(size);
+	memcpy(m, t->start, size);
+	touch(m, size);
+	c[i] = (struct memory_pool *) m;
+  }
+  copy_ms = (now_ms() - t0) / clones;
+  copy_kb = (resident_kb() - kb0) / clones;
+  for(i = 0; i < clones; i++)
+	free(c[i]);
+
+  t0 = now_ms();
+  s = mpool_snapshot(t);
+  snap_ms = now_ms() - t0;
+
+  kb0 = resident_kb();
+  t0 = now_ms();
+  for(i = 0; i < clones; i++) {
+	c[i] = mpool_clone(s);
+	touch(c[i]->start, size);
+  }
+  clone_ms = (now_ms() - t0) / clones;
+  clone_kb = (resident_kb() - kb0) / clones;
+
+  printf("%-10s %12s %12s\n", "", "ms/copy", "kB/copy");
+  printf("%-10s %12.2f %12ld\n", "memcpy", copy_ms, copy_kb);
+  printf("%-10s %12.2f %12ld   (snapshot %.2f ms)\n", "clone", clone_ms, clone_kb, snap_ms);
+
+  for(i = 0; i < clones; i++)
+	mpool_destroy(c[i]);
+  mpool_snapshot_free(s);
+  mpool_destroy(t);
+  free(c);
+  return 0;
+}
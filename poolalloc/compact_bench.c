@@ -0,0 +1,73 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "poolalloc.h"
+
+/* fragmentation recovered by mpool_compact per unit of time */
+
+/* usage: compact_bench [pool size] */
+
+/* fills a pool with handles of 16..4096 bytes, frees a random half and
+   pins 1 in 64 of the rest, then runs a single mpool_compact with a
+   range of budgets on identical copies of that pool */
+
+/* fragmentation is 1 - largest free block / free bytes */
+
+static double frag(struct mpool_stats *st) {
+  return st->free_bytes ? 1.0 - (double) st->largest_free / st->free_bytes : 0;
+}
+
+static struct memory_pool *fragmented(size_t size) {
+  struct memory_pool *p = mpool_create(size);
+  struct mpool_handle **h;
+  size_t n = 0, cap = size / 16, i;
+
+  /* fault the pool in so that page faults are not timed */
+  memset(p->start, 0, size);
+
+  h = malloc(cap * sizeof(*h));
+  srand(1);
+  while(n < cap && (h[n] = mpool_halloc(p, 16 + rand() % 4081)) != NULL)
+	n++;
+
+  /* free from the back: mpool_free searches the alloc_list from the front */
+  for(i = n; i-- > 0; ) {
+	if(rand() % 2)
+	  mpool_hfree(p, h[i]);
+	else if(rand() % 32 == 0)
+	  mpool_pin(p, h[i]);
+  }
+
+  free(h);
+  return p;
+}
+
+int main(int argc, char *argv[]) {
+  size_t size = argc > 1 ? strtoul(argv[1], NULL, 0) : 16 << 20;
+  unsigned long long budgets[] = { 10000, 100000, 1000000, 10000000, 0 };
+  int i;
+
+  printf("%-12s %-10s %-10s %-12s %-12s %-10s %s\n", "budget_ns", "spent_ns", "moved_kb",
+		 "frag_before", "frag_after", "largest_kb", "recovered_kb/ms");
+
+  for(i = 0; i < 5; i++) {
+	struct memory_pool *p = fragmented(size);
+	struct mpool_stats before, after;
+	double ms;
+
+	mpool_get_stats(p, &before);
+	mpool_compact(p, budgets[i]);
+	mpool_get_stats(p, &after);
+
+	/* the halloc that found the pool full already ran a compaction */
+	ms = (after.compact_ns - before.compact_ns) / 1e6;
+	printf("%-12llu %-10llu %-10zu %-12.3f %-12.3f %-10zu %.0f\n", budgets[i], after.compact_ns - before.compact_ns,
+		   (after.compact_moved - before.compact_moved) / 1024, frag(&before), frag(&after), after.largest_free / 1024,
+		   (after.largest_free - before.largest_free) / 1024.0 / ms);
+
+	mpool_destroy(p);
+  }
+
+  return 0;
+}
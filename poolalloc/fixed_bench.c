@@ -0,0 +1,92 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "poolalloc.h"
+#include "th_perf.h"
+
+/* ns per free+alloc of a constant-size object: mpool_alloc with
+   mpool_free_sized, the MPOOL_NEW/MPOOL_DELETE fast path, and malloc */
+
+/* usage: fixed_bench [live objects] [operations] */
+
+/* replaces a random one of `live` objects per operation; the indices
+   are drawn up front so that rand() is not timed */
+
+struct item {
+  long key;
+  long value;
+  void *next;
+};
+
+enum mode { OUT_OF_LINE, INLINE, MALLOC };
+static const char *mode_names[] = { "mpool_alloc+free_sized", "MPOOL_NEW+DELETE", "malloc+free" };
+
+static double run(enum mode mode, int live, long ops, const int *idx) {
+  struct memory_pool *p = mpool_create((size_t) live * 64 + 4096);
+  struct item **items = malloc(live * sizeof(*items));
+  struct th_perf perf;
+  long i;
+  int k;
+
+  for(k = 0; k < live; k++)
+	items[k] = mode == MALLOC ? malloc(sizeof(struct item)) : MPOOL_NEW(p, struct item);
+
+  th_perf_init(&perf);
+  th_perf_start(&perf);
+  switch(mode) {
+  case OUT_OF_LINE:
+	for(i = 0; i < ops; i++) {
+	  k = idx[i];
+	  mpool_free_sized(p, items[k], sizeof(struct item));
+	  items[k] = mpool_alloc(p, sizeof(struct item));
+	  items[k]->key = i;
+	}
+	break;
+  case INLINE:
+	for(i = 0; i < ops; i++) {
+	  k = idx[i];
+	  MPOOL_DELETE(p, items[k]);
+	  items[k] = MPOOL_NEW(p, struct item);
+	  items[k]->key = i;
+	}
+	break;
+  case MALLOC:
+	for(i = 0; i < ops; i++) {
+	  k = idx[i];
+	  free(items[k]);
+	  items[k] = malloc(sizeof(struct item));
+	  items[k]->key = i;
+	}
+	break;
+  }
+  th_perf_stop(&perf);
+  th_perf_report(&perf, mode_names[mode], ops);
+  th_perf_close(&perf);
+
+  if(mode == MALLOC) {
+	for(k = 0; k < live; k++)
+	  free(items[k]);
+  }
+  free(items);
+  mpool_destroy(p);
+  return (double) perf.ns / ops;
+}
+
+int main(int argc, char *argv[]) {
+  int live = argc > 1 ? atoi(argv[1]) : 1024;
+  long ops = argc > 2 ? atol(argv[2]) : 10000000;
+  int *idx = malloc(ops * sizeof(int));
+  long i;
+  int m;
+
+  srand(1);
+  for(i = 0; i < ops; i++)
+	idx[i] = rand() % live;
+
+  printf("%-24s %s\n", "", "ns/op");
+  for(m = OUT_OF_LINE; m <= MALLOC; m++)
+	printf("%-24s %.2f\n", mode_names[m], run(m, live, ops, idx));
+
+  free(idx);
+  return 0;
+}
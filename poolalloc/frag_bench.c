@@ -0,0 +1,106 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "poolalloc.h"
+
+/* fragmentation over a long run of mixed lifetimes, with every block
+   allocated by mpool_alloc and with mpool_alloc_hint */
+
+/* usage: frag_bench [steps] [pool size] */
+
+/* every step allocates a request buffer of 64..8192 bytes; it lives
+   1..16 steps, or 1..BURST_LIFE steps during a burst of load (every
+   other BURST steps). Every LONG_EVERY-th step also allocates a
+   32..512 byte object that is never freed. Both runs see the same
+   sizes and lifetimes. */
+
+/* fragmentation is 1 - largest free block / free bytes; the "idle"
+   line is taken after every request buffer has been freed and the free
+   list consolidated, so only the long-lived objects split free space */
+
+#define LONG_EVERY 32
+#define BURST 2048
+#define BURST_LIFE 512
+
+struct live {
+  char *addr;
+  long dies;
+};
+
+static double frag(struct mpool_stats *st) {
+  return st->free_bytes ? 1.0 - (double) st->largest_free / st->free_bytes : 0;
+}
+
+/* drop every block in `set` that dies at or before `now` */
+static int expire(struct memory_pool *p, struct live *set, int n, long now) {
+  int i = 0;
+  while(i < n) {
+	if(set[i].dies <= now) {
+	  mpool_free(p, set[i].addr);
+	  set[i] = set[--n];
+	} else {
+	  i++;
+	}
+  }
+  return n;
+}
+
+static void run(int hinted, long steps, size_t size) {
+  struct memory_pool *p = mpool_create(size);
+  struct live *shorts = malloc((BURST_LIFE + 1) * sizeof(struct live));
+  int nshort = 0;
+  struct mpool_stats st;
+  long t;
+
+  srand(7);
+  for(t = 1; t <= steps; t++) {
+	size_t ssize = 64 + rand() % 8129;
+	long slife = 1 + rand() % ((t / BURST) % 2 ? BURST_LIFE : 16);
+
+	nshort = expire(p, shorts, nshort, t);
+
+	shorts[nshort].addr = hinted ? mpool_alloc_hint(p, ssize, MPOOL_SHORT) : mpool_alloc(p, ssize);
+	shorts[nshort].dies = t + slife;
+	if(shorts[nshort].addr == NULL) {
+	  printf("%-8s pool exhausted at step %ld\n", hinted ? "hinted" : "plain", t);
+	  break;
+	}
+	nshort++;
+
+	if(t % LONG_EVERY == 0) {
+	  size_t lsize = 32 + rand() % 481;
+
+	  if((hinted ? mpool_alloc_hint(p, lsize, MPOOL_LONG) : mpool_alloc(p, lsize)) == NULL) {
+		printf("%-8s pool exhausted at step %ld\n", hinted ? "hinted" : "plain", t);
+		break;
+	  }
+	}
+
+	if(steps >= 10 && t % (steps / 10) == 0) {
+	  mpool_get_stats(p, &st);
+	  printf("%-8s %-10ld %-12lu %-12lu %-12lu %.3f\n", hinted ? "hinted" : "plain", t,
+			 (unsigned long) st.used_bytes / 1024, (unsigned long) st.free_blocks,
+			 (unsigned long) st.largest_free / 1024, frag(&st));
+	}
+  }
+
+  nshort = expire(p, shorts, nshort, steps + BURST_LIFE + 1);
+  mpool_consolidate(p);
+  mpool_get_stats(p, &st);
+  printf("%-8s %-10s %-12lu %-12lu %-12lu %.3f\n", hinted ? "hinted" : "plain", "idle",
+		 (unsigned long) st.used_bytes / 1024, (unsigned long) st.free_blocks,
+		 (unsigned long) st.largest_free / 1024, frag(&st));
+
+  free(shorts);
+  mpool_destroy(p);
+}
+
+int main(int argc, char *argv[]) {
+  long steps = argc > 1 ? atol(argv[1]) : 100000;
+  size_t size = argc > 2 ? strtoul(argv[2], NULL, 0) : 8 << 20;
+
+  printf("%-8s %-10s %-12s %-12s %-12s %s\n", "", "step", "used_kb", "free_blocks", "largest_kb", "frag");
+  run(0, steps, size);
+  run(1, steps, size);
+  return 0;
+}
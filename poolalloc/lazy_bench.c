@@ -0,0 +1,89 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "poolalloc.h"
+
+/* pool startup time by size, and the latency of requests that touch
+   fresh memory, for malloc-backed, MPOOL_LAZY and MPOOL_PREFAULT pools */
+
+/* usage: lazy_bench [requests] [block size] [gap us] */
+
+/* each request allocates a block and writes all of it; the blocks are
+   never freed, so every request touches memory no earlier request has.
+   Requests are `gap` microseconds apart, which is when the prefault
+   thread gets to run on a single CPU. */
+
+static const int modes[] = { 0, MPOOL_LAZY, MPOOL_PREFAULT };
+static const char *mode_names[] = { "malloc", "MPOOL_LAZY", "MPOOL_PREFAULT" };
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void startup(int m, size_t size) {
+  double t0 = now_ns(), t1;
+  struct memory_pool *p = mpool_create_flags(size, modes[m]);
+
+  t1 = now_ns();
+  if(p == NULL) {
+	printf("%-16s %8zu MB %14s\n", mode_names[m], size >> 20, "failed");
+	return;
+  }
+  mpool_destroy(p);
+  printf("%-16s %8zu MB %11.1f us\n", mode_names[m], size >> 20, (t1 - t0) / 1000);
+}
+
+static void requests(int m, int n, size_t block, long gap_us) {
+  struct memory_pool *p = mpool_create_flags((size_t) n * block + (64 << 20), modes[m]);
+  struct timespec gap = { 0, gap_us * 1000 };
+  double *lat = malloc(n * sizeof(double)), t0;
+  int i;
+
+  for(i = 0; i < n; i++) {
+	char *b;
+
+	nanosleep(&gap, NULL);
+	t0 = now_ns();
+	b = mpool_alloc(p, block);
+	memset(b, i, block);
+	lat[i] = now_ns() - t0;
+  }
+
+  qsort(lat, n, sizeof(double), cmp_double);
+  printf("%-16s %10.1f %10.1f %10.1f %10.1f\n", mode_names[m],
+		 lat[n / 2] / 1000, lat[n * 99 / 100] / 1000, lat[n - 1] / 1000, lat[n / 2] / block);
+
+  free(lat);
+  mpool_destroy(p);
+}
+
+int main(int argc, char *argv[]) {
+  int n = argc > 1 ? atoi(argv[1]) : 4096;
+  size_t block = argc > 2 ? strtoul(argv[2], NULL, 0) : 65536;
+  long gap_us = argc > 3 ? atol(argv[3]) : 200;
+  size_t sizes[] = { (size_t) 64 << 20, (size_t) 1 << 30, (size_t) 16 << 30 };
+  int m, s;
+
+  /* the first thread and the first large malloc cost extra */
+  for(m = 0; m < 3; m++)
+	mpool_destroy(mpool_create_flags(1 << 20, modes[m]));
+
+  printf("%-16s %11s %14s\n", "startup", "pool size", "mpool_create");
+  for(s = 0; s < 3; s++)
+	for(m = 0; m < 3; m++)
+	  startup(m, sizes[s]);
+
+  printf("\n%-16s %10s %10s %10s %10s\n", "requests", "p50 us", "p99 us", "max us", "p50 ns/B");
+  for(m = 0; m < 3; m++)
+	requests(m, n, block, gap_us);
+  return 0;
+}
@@ -0,0 +1,122 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "dbll.h"
+#include "poolalloc.h"
+
+/* ns per node to build, walk and free a dbll whose nodes come from
+   malloc, from a memory pool one by one, and from an arena carved out
+   of a single pool block */
+
+/* usage: list_alloc_bench [nodes] [rounds] */
+
+/* every round appends `nodes` nodes, removes every fourth one, appends
+   as many again and walks the list, then drops it: dbll_free for the
+   malloc and pool lists, dbll_free plus one mpool_free for the arena */
+
+struct arena {
+  struct memory_pool *p;
+  char *base;
+  size_t used;
+  size_t size;
+};
+
+static void *pool_alloc(size_t size, void *ctx) {
+  struct memory_pool *p = ctx;
+  return size == sizeof(struct llnode) ? MPOOL_NEW(p, struct llnode) : mpool_alloc(p, size);
+}
+
+static void pool_free(void *ptr, size_t size, void *ctx) {
+  struct memory_pool *p = ctx;
+  if(size == sizeof(struct llnode))
+	MPOOL_DELETE(p, (struct llnode *) ptr);
+  else
+	mpool_free_sized(p, ptr, size);
+}
+
+static void *arena_alloc(size_t size, void *ctx) {
+  struct arena *a = ctx;
+  void *b;
+
+  size = (size + 7) & ~(size_t) 7;
+  if(a->size - a->used < size)
+	return NULL;
+  b = a->base + a->used;
+  a->used += size;
+  return b;
+}
+
+enum mode { MALLOC, POOL, ARENA };
+static const char *mode_names[] = { "malloc", "mpool", "mpool arena" };
+
+static double now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(enum mode mode, long nodes, int rounds) {
+  size_t bytes = (size_t) nodes * 2 * sizeof(struct llnode);
+  struct memory_pool *p = mode == MALLOC ? NULL : mpool_create(bytes + (bytes >> 2) + 4096);
+  struct arena a;
+  double t_build = 0, t_walk = 0, t_free = 0, t0;
+  volatile long sink = 0;
+  struct llnode *n, *next;
+  struct dbll *ll;
+  long i;
+  int r;
+
+  for(r = 0; r < rounds; r++) {
+	t0 = now_ns();
+	if(mode == MALLOC) {
+	  ll = dbll_create();
+	} else if(mode == POOL) {
+	  ll = dbll_create_with_allocator(pool_alloc, pool_free, p);
+	} else {
+	  a.p = p;
+	  a.size = bytes;
+	  a.used = 0;
+	  a.base = mpool_alloc(p, bytes);
+	  ll = dbll_create_with_allocator(arena_alloc, NULL, &a);
+	}
+
+	for(i = 0; i < nodes; i++)
+	  dbll_append(ll, (void *) i);
+	for(i = 0, n = ll->first; n != NULL; n = next, i++) {
+	  next = n->next;
+	  if(i % 4 == 0)
+		dbll_remove(ll, n);
+	}
+	for(i = 0; i < nodes / 4; i++)
+	  dbll_append(ll, (void *) i);
+	t_build += now_ns() - t0;
+
+	t0 = now_ns();
+	for(n = ll->first; n != NULL; n = n->next)
+	  sink += (long) n->user_data;
+	t_walk += now_ns() - t0;
+
+	t0 = now_ns();
+	dbll_free(ll);
+	if(mode == ARENA)
+	  mpool_free(p, a.base);
+	t_free += now_ns() - t0;
+  }
+
+  printf("%-14s %12.2f %12.2f %12.2f\n", mode_names[mode],
+		 t_build / rounds / nodes, t_walk / rounds / nodes, t_free / rounds / nodes);
+  if(p != NULL)
+	mpool_destroy(p);
+}
+
+int main(int argc, char *argv[]) {
+  long nodes = argc > 1 ? atol(argv[1]) : 1000000;
+  int rounds = argc > 2 ? atoi(argv[2]) : 10;
+  int m;
+
+  printf("%-14s %12s %12s %12s\n", "", "build", "walk", "free");
+  for(m = MALLOC; m <= ARENA; m++)
+	run(m, nodes, rounds);
+  return 0;
+}
@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mpool_export.h"
+
+/* Routines for the shared memory pool exporter (see mpool_export.h) */
+
+#define READ_ATTEMPTS 10000
+
+/* counters of one pool, read without any locking of our own */
+static void export_collect(struct memory_pool *p, const char *name, struct mpool_export_pool *out)
+{
+  uint64_t bucket_free[MPOOL_EXPORT_BUCKETS] = { 0 };
+  struct llnode *curr;
+  size_t bsize = (p->size + MPOOL_EXPORT_BUCKETS - 1) / MPOOL_EXPORT_BUCKETS;
+  int b;
+
+  memset(out, 0, sizeof(*out));
+  strncpy(out->name, name, MPOOL_EXPORT_NAME_LEN - 1);
+  out->size = p->size;
+
+  for(curr = p->alloc_list->first; curr != NULL; curr = curr->next) {
+    out->used_bytes += ((struct alloc_info *) curr->user_data)->size;
+    out->used_blocks++;
+  }
+
+  /* spread each free region over the buckets it overlaps */
+  for(curr = p->free_list->first; curr != NULL; curr = curr->next) {
+    struct alloc_info *f = curr->user_data;
+    size_t lo = f->offset, hi = f->offset + f->size;
+
+    out->free_bytes += f->size;
+    out->free_blocks++;
+    if(f->size > out->largest_free)
+      out->largest_free = f->size;
+
+    while(lo < hi) {
+      size_t end = (lo / bsize + 1) * bsize;
+      if(end > hi)
+        end = hi;
+      bucket_free[lo / bsize] += end - lo;
+      lo = end;
+    }
+  }
+
+  out->fragmentation = out->free_bytes ? 1.0 - (double) out->largest_free / out->free_bytes : 0;
+
+  for(b = 0; b < MPOOL_EXPORT_BUCKETS; b++) {
+    size_t lo = b * bsize, len;
+
+    if(lo >= p->size)
+      break;
+    len = lo + bsize > p->size ? p->size - lo : bsize;
+    out->occupancy[b] = 100 - bucket_free[b] * 100 / len;
+  }
+}
+
+/* write new counters under the sequence lock */
+static void export_write(struct mpool_exporter *ex, struct mpool_export_pool *pools, unsigned n)
+{
+  struct mpool_export_shm *shm = ex->shm;
+  struct timespec now;
+  uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  memcpy(shm->pools, pools, n * sizeof(struct mpool_export_pool));
+  shm->npools = n;
+  shm->updates++;
+  shm->updated_ns = (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+
+  __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void export_publish(struct mpool_exporter *ex, int lock)
+{
+  struct mpool_export_pool pools[MPOOL_EXPORT_MAX_POOLS];
+  unsigned i;
+
+  /* collect first, so that the segment is odd only for a memcpy */
+  for(i = 0; i < ex->npools; i++) {
+    if(lock && ex->locks[i] != NULL)
+      pthread_mutex_lock(ex->locks[i]);
+    export_collect(ex->pools[i], ex->names[i], &pools[i]);
+    if(lock && ex->locks[i] != NULL)
+      pthread_mutex_unlock(ex->locks[i]);
+  }
+
+  export_write(ex, pools, ex->npools);
+}
+
+/* see mpool_export.h */
+struct mpool_exporter *mpool_export_create(const char *shm_name)
+{
+  struct mpool_exporter *ex;
+  int fd;
+
+  if(strlen(shm_name) >= sizeof(ex->shm_name))
+    return NULL;
+
+  ex = calloc(1, sizeof(struct mpool_exporter));
+  if(ex == NULL)
+    return NULL;
+
+  fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    free(ex);
+    return NULL;
+  }
+
+  if(ftruncate(fd, sizeof(struct mpool_export_shm)) != 0 ||
+     (ex->shm = mmap(NULL, sizeof(struct mpool_export_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    shm_unlink(shm_name);
+    free(ex);
+    return NULL;
+  }
+  close(fd);
+
+  strcpy(ex->shm_name, shm_name);
+  ex->shm->version = MPOOL_EXPORT_VERSION;
+  ex->shm->pid = getpid();
+  pthread_mutex_init(&ex->stop_lock, NULL);
+  pthread_cond_init(&ex->stop, NULL);
+
+  /* readers check the magic last */
+  __atomic_store_n(&ex->shm->magic, MPOOL_EXPORT_MAGIC, __ATOMIC_RELEASE);
+  return ex;
+}
+
+/* see mpool_export.h */
+void mpool_export_destroy(struct mpool_exporter *ex)
+{
+  if(ex->running) {
+    pthread_mutex_lock(&ex->stop_lock);
+    ex->running = 0;
+    pthread_cond_signal(&ex->stop);
+    pthread_mutex_unlock(&ex->stop_lock);
+    pthread_join(ex->thread, NULL);
+  }
+
+  munmap(ex->shm, sizeof(struct mpool_export_shm));
+  shm_unlink(ex->shm_name);
+  pthread_cond_destroy(&ex->stop);
+  pthread_mutex_destroy(&ex->stop_lock);
+  free(ex);
+}
+
+/* see mpool_export.h */
+int mpool_export_add(struct mpool_exporter *ex, struct memory_pool *p, const char *name, pthread_mutex_t *lock)
+{
+  if(ex->npools == MPOOL_EXPORT_MAX_POOLS)
+    return 0;
+
+  ex->pools[ex->npools] = p;
+  ex->locks[ex->npools] = lock;
+  strncpy(ex->names[ex->npools], name, MPOOL_EXPORT_NAME_LEN - 1);
+  ex->names[ex->npools][MPOOL_EXPORT_NAME_LEN - 1] = '\0';
+  ex->npools++;
+  return 1;
+}
+
+/* see mpool_export.h */
+void mpool_export_publish(struct mpool_exporter *ex)
+{
+  export_publish(ex, 0);
+}
+
+static void *export_thread(void *arg)
+{
+  struct mpool_exporter *ex = arg;
+  struct timespec until;
+
+  pthread_mutex_lock(&ex->stop_lock);
+  while(ex->running) {
+    pthread_mutex_unlock(&ex->stop_lock);
+    export_publish(ex, 1);
+    pthread_mutex_lock(&ex->stop_lock);
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += ex->interval_ms / 1000;
+    until.tv_nsec += (ex->interval_ms % 1000) * 1000000L;
+    if(until.tv_nsec >= 1000000000L) {
+      until.tv_sec++;
+      until.tv_nsec -= 1000000000L;
+    }
+
+    while(ex->running && pthread_cond_timedwait(&ex->stop, &ex->stop_lock, &until) == 0)
+      ;
+  }
+  pthread_mutex_unlock(&ex->stop_lock);
+
+  return NULL;
+}
+
+/* see mpool_export.h */
+int mpool_export_start(struct mpool_exporter *ex, unsigned interval_ms)
+{
+  if(ex->running)
+    return 1;
+
+  ex->interval_ms = interval_ms ? interval_ms : 1;
+  ex->running = 1;
+  if(pthread_create(&ex->thread, NULL, export_thread, ex) != 0) {
+    ex->running = 0;
+    return 0;
+  }
+
+  return 1;
+}
+
+/* see mpool_export.h */
+const struct mpool_export_shm *mpool_export_attach(const char *shm_name)
+{
+  struct mpool_export_shm *shm;
+  struct stat st;
+  int fd;
+
+  fd = shm_open(shm_name, O_RDONLY, 0);
+  if(fd < 0)
+    return NULL;
+
+  if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct mpool_export_shm)) {
+    close(fd);
+    return NULL;
+  }
+
+  shm = mmap(NULL, sizeof(struct mpool_export_shm), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(shm == MAP_FAILED)
+    return NULL;
+
+  if(__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != MPOOL_EXPORT_MAGIC || shm->version != MPOOL_EXPORT_VERSION) {
+    munmap(shm, sizeof(struct mpool_export_shm));
+    return NULL;
+  }
+
+  return shm;
+}
+
+/* see mpool_export.h */
+void mpool_export_detach(const struct mpool_export_shm *shm)
+{
+  munmap((void *) shm, sizeof(struct mpool_export_shm));
+}
+
+/* see mpool_export.h */
+int mpool_export_read(const struct mpool_export_shm *shm, struct mpool_export_shm *out)
+{
+  int i;
+
+  for(i = 0; i < READ_ATTEMPTS; i++) {
+    uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+
+    if(seq & 1) {
+      sched_yield();
+      continue;
+    }
+
+    memcpy(out, shm, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if(__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq) {
+      out->seq = seq;
+      return 1;
+    }
+  }
+
+  return 0;
+}
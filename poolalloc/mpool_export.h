@@ -0,0 +1,92 @@
+#pragma once
+#include <stdint.h>
+#include <pthread.h>
+#include "poolalloc.h"
+
+/* Publish pool counters in a POSIX shared memory segment */
+
+/* The exporter writes a struct mpool_export_shm into the segment under a
+   sequence lock: the writer makes seq odd, updates the data and makes
+   seq even again, and readers retry until they copied the data between
+   two equal, even values of seq. Readers therefore never block the
+   writer, and the writer never waits for readers.
+
+   Counters are read from the pools either by the owning thread calling
+   mpool_export_publish, or by a background thread started with
+   mpool_export_start, which takes the lock passed to mpool_export_add
+   (if any) around reading each pool. mpool_top attaches to the segment
+   and renders it. */
+
+#define MPOOL_EXPORT_MAGIC 0x6d706f6f6c657870ull /* "mpoolexp" */
+#define MPOOL_EXPORT_VERSION 1
+#define MPOOL_EXPORT_MAX_POOLS 16
+#define MPOOL_EXPORT_BUCKETS 64
+#define MPOOL_EXPORT_NAME_LEN 32
+
+struct mpool_export_pool {
+  char name[MPOOL_EXPORT_NAME_LEN];
+  uint64_t size;
+  uint64_t used_bytes;        /* bytes on the alloc_list */
+  uint64_t used_blocks;
+  uint64_t free_bytes;        /* bytes on the free_list */
+  uint64_t free_blocks;       /* regions on the free_list */
+  uint64_t largest_free;
+  double fragmentation;       /* 1 - largest_free / free_bytes */
+  uint8_t occupancy[MPOOL_EXPORT_BUCKETS]; /* percent in use of each 1/BUCKETS of the pool */
+};
+
+struct mpool_export_shm {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t seq;               /* odd while the writer is updating */
+  int32_t pid;                /* of the exporting process */
+  uint32_t npools;
+  uint64_t updates;
+  uint64_t updated_ns;        /* CLOCK_REALTIME of the last update */
+  struct mpool_export_pool pools[MPOOL_EXPORT_MAX_POOLS];
+};
+
+struct mpool_exporter {
+  char shm_name[64];
+  struct mpool_export_shm *shm;
+  struct memory_pool *pools[MPOOL_EXPORT_MAX_POOLS];
+  pthread_mutex_t *locks[MPOOL_EXPORT_MAX_POOLS];
+  char names[MPOOL_EXPORT_MAX_POOLS][MPOOL_EXPORT_NAME_LEN];
+  unsigned npools;
+
+  pthread_t thread;
+  int running;
+  unsigned interval_ms;
+  pthread_mutex_t stop_lock;
+  pthread_cond_t stop;
+};
+
+/* create the segment shm_name ("/name") and an exporter writing to it */
+/* return NULL if the segment could not be created */
+struct mpool_exporter *mpool_export_create(const char *shm_name);
+
+/* stop the background thread, remove the segment and free ex */
+void mpool_export_destroy(struct mpool_exporter *ex);
+
+/* export p under name; lock, if not NULL, is held by the background
+   thread while it reads p and must be the lock that guards p */
+/* return 0 if MPOOL_EXPORT_MAX_POOLS pools are exported already */
+int mpool_export_add(struct mpool_exporter *ex, struct memory_pool *p, const char *name, pthread_mutex_t *lock);
+
+/* read every pool and publish the counters now; the caller must be
+   allowed to read the pools (e.g. be the thread that owns them) */
+void mpool_export_publish(struct mpool_exporter *ex);
+
+/* publish every interval_ms from a background thread */
+/* return 0 if the thread could not be started */
+int mpool_export_start(struct mpool_exporter *ex, unsigned interval_ms);
+
+/* map an existing segment read-only; NULL if it does not exist or is
+   not an exporter segment */
+const struct mpool_export_shm *mpool_export_attach(const char *shm_name);
+
+void mpool_export_detach(const struct mpool_export_shm *shm);
+
+/* copy a consistent snapshot of shm into *out, retrying while the
+   writer is busy; return 0 if no consistent copy was seen in a while */
+int mpool_export_read(const struct mpool_export_shm *shm, struct mpool_export_shm *out);
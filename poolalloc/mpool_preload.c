@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include "poolalloc.h"
+
+/*
+   LD_PRELOAD shim that serves the program's malloc family from memory
+   pools:
+
+     LD_PRELOAD=./libmpool_preload.so sort big.txt
+
+   User blocks come from a growing set of arenas, each a struct
+   memory_pool. poolalloc.c and dbll.c call malloc themselves for their
+   bookkeeping; those nested calls are recognised through a thread-local
+   flag and served by a small size-class allocator on mmap'd memory
+   (meta_*), so they never recurse into the pools.
+
+   All pool operations run under one global lock.
+
+   Pointers that are not inside any arena (memory handed out before the
+   shim was loaded, or by another allocator) are passed on to the next
+   free, realloc and malloc_usable_size in the link chain.
+
+   Environment:
+     MPOOL_ARENA_SIZE   minimum arena size in bytes (default 64MB)
+ */
+
+#define ARENA_MIN_DEFAULT (64UL << 20)
+#define MAX_ARENAS 4096
+
+/* header placed right before every user block */
+struct shim_hdr {
+  void *base;                 /* address returned by mpool_alloc */
+  size_t size;                /* size requested by the user */
+};
+
+#define HDR_SIZE sizeof(struct shim_hdr)
+
+static pthread_mutex_t shim_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int in_shim __attribute__((tls_model("initial-exec")));
+
+static struct memory_pool *arenas[MAX_ARENAS];
+static int narenas;
+static size_t arena_min;
+
+static void (*next_free)(void *);
+static void *(*next_realloc)(void *, size_t);
+static size_t (*next_usable_size)(void *);
+
+/*
+   Internal metadata allocator, only used while in_shim is set (and so
+   with shim_lock held). Blocks up to META_MAX_SMALL bytes come from
+   16-byte size classes carved out of META_CHUNK mmap'd chunks and are
+   never returned to the kernel; larger ones (such as the pool memory
+   itself) are mmap'd individually.
+ */
+
+#define META_ALIGN 16
+#define META_MAX_SMALL 512
+#define META_CLASSES (META_MAX_SMALL / META_ALIGN)
+#define META_CHUNK (1UL << 20)
+
+struct meta_hdr {
+  size_t size;                /* class size, or mapping length for large blocks */
+  size_t large;
+};
+
+static void *meta_bins[META_CLASSES];
+static char *meta_bump, *meta_end;
+
+static void *meta_alloc(size_t size)
+{
+  struct meta_hdr *h;
+  size_t cls;
+
+  if(size == 0)
+    size = 1;
+
+  if(size > META_MAX_SMALL) {
+    size_t len = (size + sizeof(struct meta_hdr) + 4095) & ~(size_t) 4095;
+    h = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(h == MAP_FAILED)
+      return NULL;
+    h->size = len;
+    h->large = 1;
+    return h + 1;
+  }
+
+  cls = (size - 1) / META_ALIGN;
+  if(meta_bins[cls] != NULL) {
+    void *b = meta_bins[cls];
+    meta_bins[cls] = *(void **) b;
+    return b;
+  }
+
+  size = (cls + 1) * META_ALIGN;
+  if(meta_bump == NULL || meta_end - meta_bump < (ptrdiff_t) (size + sizeof(struct meta_hdr))) {
+    meta_bump = mmap(NULL, META_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(meta_bump == MAP_FAILED) {
+      meta_bump = NULL;
+      return NULL;
+    }
+    meta_end = meta_bump + META_CHUNK;
+  }
+
+  h = (struct meta_hdr *) meta_bump;
+  meta_bump += size + sizeof(struct meta_hdr);
+  h->size = size;
+  h->large = 0;
+  return h + 1;
+}
+
+static void meta_free(void *ptr)
+{
+  struct meta_hdr *h = (struct meta_hdr *) ptr - 1;
+
+  if(h->large) {
+    munmap(h, h->size);
+    return;
+  }
+
+  *(void **) ptr = meta_bins[h->size / META_ALIGN - 1];
+  meta_bins[h->size / META_ALIGN - 1] = ptr;
+}
+
+static void *meta_realloc(void *ptr, size_t size)
+{
+  struct meta_hdr *h;
+  size_t have;
+  void *n;
+
+  if(ptr == NULL)
+    return meta_alloc(size);
+
+  h = (struct meta_hdr *) ptr - 1;
+  have = h->large ? h->size - sizeof(struct meta_hdr) : h->size;
+  if(size <= have)
+    return ptr;
+
+  n = meta_alloc(size);
+  if(n != NULL) {
+    memcpy(n, ptr, have);
+    meta_free(ptr);
+  }
+  return n;
+}
+
+/* arenas */
+
+static void shim_lock_all()
+{
+  pthread_mutex_lock(&shim_lock);
+}
+
+static void shim_unlock_all()
+{
+  pthread_mutex_unlock(&shim_lock);
+}
+
+__attribute__((constructor))
+static void shim_init()
+{
+  const char *s = getenv("MPOOL_ARENA_SIZE");
+
+  arena_min = s ? strtoul(s, NULL, 0) : 0;
+  if(arena_min == 0)
+    arena_min = ARENA_MIN_DEFAULT;
+
+  next_free = (void (*)(void *)) dlsym(RTLD_NEXT, "free");
+  next_realloc = (void *(*)(void *, size_t)) dlsym(RTLD_NEXT, "realloc");
+  next_usable_size = (size_t (*)(void *)) dlsym(RTLD_NEXT, "malloc_usable_size");
+
+  /* keep the lock consistent in the child of a fork */
+  pthread_atfork(shim_lock_all, shim_unlock_all, shim_unlock_all);
+}
+
+/* arena holding the address, or NULL if it is not the shim's */
+/* called with shim_lock held */
+static struct memory_pool *arena_of(void *base)
+{
+  int i;
+
+  for(i = narenas - 1; i >= 0; i--) {
+    struct memory_pool *p = arenas[i];
+    if((char *) base >= p->start && (char *) base < p->start + p->size)
+      return p;
+  }
+
+  return NULL;
+}
+
+/* allocate size bytes from some arena, adding an arena if all are full */
+/* zeroed with mpool_calloc if zero is set */
+/* called with shim_lock held and in_shim set */
+static void *arena_alloc(size_t size, int zero)
+{
+  size_t min = arena_min ? arena_min : ARENA_MIN_DEFAULT;
+  void *b;
+  int i;
+
+  /* newest arena first: older ones are usually the most fragmented */
+  for(i = narenas - 1; i >= 0; i--) {
+    if((b = zero ? mpool_calloc(arenas[i], 1, size) : mpool_alloc(arenas[i], size)) != NULL)
+      return b;
+  }
+
+  if(narenas == MAX_ARENAS)
+    return NULL;
+
+  arenas[narenas] = mpool_create(size * 2 > min ? size * 2 : min);
+  if(arenas[narenas] == NULL)
+    return NULL;
+
+  narenas++;
+  return zero ? mpool_calloc(arenas[narenas - 1], 1, size) : mpool_alloc(arenas[narenas - 1], size);
+}
+
+static void *shim_alloc(size_t align, size_t size, int zero)
+{
+  size_t total;
+  char *b, *user;
+  struct shim_hdr *h;
+
+  if(in_shim)
+    return align <= META_ALIGN ? meta_alloc(size) : NULL;
+
+  /* mpool_alloc aligns blocks of more than 8 bytes to 16, which also
+     keeps the user pointer after the header 16-byte aligned */
+  total = size + HDR_SIZE + (align > 16 ? align : 0);
+  if(total < size)
+    return NULL;
+
+  pthread_mutex_lock(&shim_lock);
+  in_shim = 1;
+  b = arena_alloc(total, zero);
+  in_shim = 0;
+  pthread_mutex_unlock(&shim_lock);
+
+  if(b == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  user = b + HDR_SIZE;
+  if(align > 16)
+    user = (char *) (((uintptr_t) user + align - 1) & ~(uintptr_t) (align - 1));
+
+  h = (struct shim_hdr *) user - 1;
+  h->base = b;
+  h->size = size;
+  return user;
+}
+
+void *malloc(size_t size)
+{
+  return shim_alloc(16, size, 0);
+}
+
+/* whether ptr is in one of the shim's arenas */
+static int shim_owns(void *ptr)
+{
+  struct memory_pool *p;
+
+  pthread_mutex_lock(&shim_lock);
+  p = arena_of(ptr);
+  pthread_mutex_unlock(&shim_lock);
+  return p != NULL;
+}
+
+void free(void *ptr)
+{
+  struct memory_pool *p;
+  struct shim_hdr *h;
+
+  if(ptr == NULL)
+    return;
+
+  if(in_shim) {
+    meta_free(ptr);
+    return;
+  }
+
+  h = (struct shim_hdr *) ptr - 1;
+
+  pthread_mutex_lock(&shim_lock);
+  in_shim = 1;
+  p = arena_of(ptr);
+  if(p != NULL)
+    mpool_free(p, h->base);
+  in_shim = 0;
+  pthread_mutex_unlock(&shim_lock);
+
+  if(p == NULL && next_free != NULL)
+    next_free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+  size_t total = nmemb * size;
+  void *p;
+
+  if(size != 0 && total / size != nmemb) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  /* mpool_calloc only clears arena pages that were used before, and
+     large metadata blocks are fresh mappings; small metadata blocks are
+     reused, so they are not known to be zero */
+  if(in_shim) {
+    p = meta_alloc(total);
+    if(p != NULL && total <= META_MAX_SMALL)
+      memset(p, 0, total);
+  } else {
+    p = shim_alloc(16, total, 1);
+  }
+  return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  struct shim_hdr *h;
+  void *n;
+
+  if(in_shim)
+    return meta_realloc(ptr, size);
+
+  if(ptr == NULL)
+    return malloc(size);
+
+  if(!shim_owns(ptr))
+    return next_realloc != NULL ? next_realloc(ptr, size) : NULL;
+
+  if(size == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  h = (struct shim_hdr *) ptr - 1;
+  if(size <= h->size)
+    return ptr;
+
+  n = malloc(size);
+  if(n != NULL) {
+    memcpy(n, ptr, h->size);
+    free(ptr);
+  }
+  return n;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  void *p;
+
+  if(alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+
+  p = shim_alloc(alignment, size, 0);
+  if(p == NULL)
+    return ENOMEM;
+
+  *memptr = p;
+  return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+  if(alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return shim_alloc(alignment, size, 0);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+  return aligned_alloc(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+  return shim_alloc(sysconf(_SC_PAGESIZE), size, 0);
+}
+
+void *pvalloc(size_t size)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  return shim_alloc(page, (size + page - 1) & ~(page - 1), 0);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+  if(ptr == NULL)
+    return 0;
+  if(!shim_owns(ptr))
+    return next_usable_size != NULL ? next_usable_size(ptr) : 0;
+  return ((struct shim_hdr *) ptr - 1)->size;
+}
@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include <execinfo.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpool_profile.h"
+
+/* Routines for the sampling heap profiler (see mpool_profile.h) */
+
+#define PROF_MIN_TABLE 64
+
+/* frames of prof_alloc, the pool's hook runner and the allocating
+   entry point (mpool_alloc, mpool_calloc, ...) at the top of a stack,
+   when backtrace() adds none of its own */
+#define PROF_SKIP 3
+
+/* frames backtrace() may add on top, as sanitizers' versions do */
+#define PROF_EXTRA 4
+
+/* xorshift64* */
+static uint64_t prof_random(struct mpool_profile *prof)
+{
+  prof->rng ^= prof->rng >> 12;
+  prof->rng ^= prof->rng << 25;
+  prof->rng ^= prof->rng >> 27;
+  return prof->rng * 2685821657736338717ull;
+}
+
+/* exponentially distributed gap before the next sample */
+static int64_t prof_next_gap(struct mpool_profile *prof)
+{
+  /* uniform in (0, 1] */
+  double u = ((prof_random(prof) >> 11) + 1) / 9007199254740992.0;
+
+  return (int64_t) (-log(u) * prof->mean_bytes) + 1;
+}
+
+static size_t prof_slot(struct mpool_profile *prof, void *addr)
+{
+  size_t mask = prof->tcap - 1;
+  size_t i = ((uintptr_t) addr >> 4) * 0x9e3779b97f4a7c15ull >> 20 & mask;
+
+  while(prof->table[i].addr != NULL && prof->table[i].addr != addr)
+    i = (i + 1) & mask;
+
+  return i;
+}
+
+/* empty slot i, shifting later entries of the probe run back (as in
+   lru.c) */
+static void prof_delete(struct mpool_profile *prof, size_t i)
+{
+  size_t mask = prof->tcap - 1;
+  size_t j = i, home;
+
+  for(;;) {
+    prof->table[i].addr = NULL;
+
+    for(;;) {
+      j = (j + 1) & mask;
+      if(prof->table[j].addr == NULL)
+        return;
+
+      home = ((uintptr_t) prof->table[j].addr >> 4) * 0x9e3779b97f4a7c15ull >> 20 & mask;
+      if(i <= j ? (i < home && home <= j) : (i < home || home <= j))
+        continue;
+
+      break;
+    }
+
+    prof->table[i] = prof->table[j];
+    i = j;
+  }
+}
+
+static int prof_grow(struct mpool_profile *prof)
+{
+  struct mpool_sample *old = prof->table;
+  size_t oldcap = prof->tcap, i;
+
+  prof->table = calloc(2 * oldcap, sizeof(struct mpool_sample));
+  if(prof->table == NULL) {
+    prof->table = old;
+    return 0;
+  }
+
+  prof->tcap = 2 * oldcap;
+  for(i = 0; i < oldcap; i++) {
+    if(old[i].addr != NULL)
+      prof->table[prof_slot(prof, old[i].addr)] = old[i];
+  }
+
+  free(old);
+  return 1;
+}
+
+/* the pool only calls this once countdown has run out */
+static void prof_alloc(struct mpool_hooks *h, void *addr, size_t size)
+{
+  struct mpool_profile *prof = (struct mpool_profile *) h;
+  struct mpool_sample *s;
+  void *stack[MPOOL_PROFILE_DEPTH + PROF_SKIP + PROF_EXTRA];
+  void *runner = __builtin_return_address(0);
+  int depth, skip;
+
+  prof->hooks.countdown = prof_next_gap(prof);
+
+  /* keep the load factor below 0.5 */
+  if(2 * (prof->live + 1) > prof->tcap && !prof_grow(prof))
+    return;
+
+  depth = backtrace(stack, MPOOL_PROFILE_DEPTH + PROF_SKIP + PROF_EXTRA);
+
+  /* the caller of the entry point is two frames below the hook runner */
+  for(skip = 0; skip < depth && stack[skip] != runner; skip++)
+    ;
+  skip = skip < depth ? skip + 2 : PROF_SKIP;
+  depth = depth > skip ? depth - skip : 0;
+  if(depth > MPOOL_PROFILE_DEPTH)
+    depth = MPOOL_PROFILE_DEPTH;
+
+  s = &prof->table[prof_slot(prof, addr)];
+  if(s->addr == NULL)
+    prof->live++;
+
+  s->addr = addr;
+  s->size = size;
+  s->depth = depth;
+  memcpy(s->stack, stack + skip, depth * sizeof(void *));
+  prof->hooks.free_filter |= MPOOL_HOOK_BIT(addr);
+  prof->samples++;
+}
+
+/* recompute the free filter from the live samples */
+static void prof_refilter(struct mpool_profile *prof)
+{
+  size_t i;
+
+  prof->hooks.free_filter = 0;
+  for(i = 0; i < prof->tcap; i++) {
+    if(prof->table[i].addr != NULL)
+      prof->hooks.free_filter |= MPOOL_HOOK_BIT(prof->table[i].addr);
+  }
+}
+
+static void prof_free(struct mpool_hooks *h, void *addr)
+{
+  struct mpool_profile *prof = (struct mpool_profile *) h;
+  size_t i;
+
+  if(prof->live == 0)
+    return;
+
+  i = prof_slot(prof, addr);
+  if(prof->table[i].addr != NULL) {
+    prof_delete(prof, i);
+    prof->live--;
+    prof_refilter(prof);
+  }
+}
+
+static void prof_move(struct mpool_hooks *h, void *from, void *to)
+{
+  struct mpool_profile *prof = (struct mpool_profile *) h;
+  struct mpool_sample s;
+  size_t i;
+
+  if(prof->live == 0)
+    return;
+
+  i = prof_slot(prof, from);
+  if(prof->table[i].addr == NULL)
+    return;
+
+  s = prof->table[i];
+  prof_delete(prof, i);
+  s.addr = to;
+  prof->table[prof_slot(prof, to)] = s;
+  prof_refilter(prof);
+}
+
+/* see mpool_profile.h */
+struct mpool_profile *mpool_profile_start(struct memory_pool *p, size_t mean_bytes)
+{
+  struct mpool_profile *prof;
+  void *warm;
+
+  prof = malloc(sizeof(struct mpool_profile));
+  if(prof == NULL)
+    return NULL;
+
+  prof->table = calloc(PROF_MIN_TABLE, sizeof(struct mpool_sample));
+  if(prof->table == NULL) {
+    free(prof);
+    return NULL;
+  }
+
+  /* the first backtrace() loads the unwinder, which allocates; do it
+     now rather than inside a pool operation */
+  backtrace(&warm, 1);
+
+  prof->hooks.alloc = prof_alloc;
+  prof->hooks.free = prof_free;
+  prof->hooks.move = prof_move;
+  prof->pool = p;
+  prof->mean_bytes = mean_bytes ? mean_bytes : 1;
+  prof->rng = (uintptr_t) prof ^ 0x2545f4914f6cdd1dull;
+  prof->tcap = PROF_MIN_TABLE;
+  prof->live = 0;
+  prof->samples = 0;
+  prof->hooks.countdown = prof_next_gap(prof);
+  prof->hooks.free_filter = 0;
+
+  p->hooks = &prof->hooks;
+  return prof;
+}
+
+/* see mpool_profile.h */
+void mpool_profile_stop(struct mpool_profile *prof)
+{
+  if(prof == NULL)
+    return;
+
+  /* leave hooks installed after the profile alone */
+  if(prof->pool->hooks == &prof->hooks)
+    prof->pool->hooks = NULL;
+  free(prof->table);
+  free(prof);
+}
+
+static int prof_stack_cmp(const void *a, const void *b)
+{
+  const struct mpool_sample *x = *(struct mpool_sample * const *) a;
+  const struct mpool_sample *y = *(struct mpool_sample * const *) b;
+
+  if(x->depth != y->depth)
+    return x->depth < y->depth ? -1 : 1;
+  return memcmp(x->stack, y->stack, x->depth * sizeof(void *));
+}
+
+/* write the function name of a backtrace_symbols() entry,
+   "file(function+0x12) [0x...]", or the address if it has none */
+static void prof_put_frame(FILE *out, const char *sym, void *addr)
+{
+  const char *open = strchr(sym, '(');
+  size_t n = open ? strcspn(open + 1, "+)") : 0;
+
+  if(n > 0)
+    fprintf(out, "%.*s", (int) n, open + 1);
+  else
+    fprintf(out, "%p", addr);
+}
+
+/* see mpool_profile.h */
+int mpool_profile_dump(struct mpool_profile *prof, FILE *out, enum mpool_profile_format format)
+{
+  struct mpool_sample **live;
+  size_t n = 0, i, j, k;
+  size_t bytes = 0;
+
+  live = malloc((prof->live ? prof->live : 1) * sizeof(struct mpool_sample *));
+  if(live == NULL)
+    return 0;
+
+  for(i = 0; i < prof->tcap; i++) {
+    if(prof->table[i].addr != NULL) {
+      live[n++] = &prof->table[i];
+      bytes += prof->table[i].size;
+    }
+  }
+
+  /* identical stacks end up next to each other */
+  qsort(live, n, sizeof(struct mpool_sample *), prof_stack_cmp);
+
+  if(format == MPOOL_PROFILE_PPROF)
+    fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", n, bytes, n, bytes, prof->mean_bytes);
+
+  for(i = 0; i < n; i = j) {
+    size_t count = 0, sum = 0;
+    double scaled = 0;
+
+    for(j = i; j < n && prof_stack_cmp(&live[i], &live[j]) == 0; j++) {
+      count++;
+      sum += live[j]->size;
+      /* a block of size s was sampled with probability 1 - exp(-s / mean) */
+      scaled += live[j]->size / (1 - exp(-(double) live[j]->size / prof->mean_bytes));
+    }
+
+    if(format == MPOOL_PROFILE_PPROF) {
+      fprintf(out, "%zu: %zu [%zu: %zu] @", count, sum, count, sum);
+      for(k = 0; k < (size_t) live[i]->depth; k++)
+        fprintf(out, " %p", live[i]->stack[k]);
+      fprintf(out, "\n");
+    } else {
+      char **syms = backtrace_symbols(live[i]->stack, live[i]->depth);
+
+      /* outermost frame first */
+      for(k = live[i]->depth; k-- > 0; ) {
+        if(syms != NULL)
+          prof_put_frame(out, syms[k], live[i]->stack[k]);
+        else
+          fprintf(out, "%p", live[i]->stack[k]);
+        if(k > 0)
+          fputc(';', out);
+      }
+      fprintf(out, " %.0f\n", scaled);
+      free(syms);
+    }
+  }
+
+  /* pprof needs the mappings to symbolize addresses */
+  if(format == MPOOL_PROFILE_PPROF) {
+    FILE *maps = fopen("/proc/self/maps", "r");
+    char line[512];
+
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    while(maps != NULL && fgets(line, sizeof(line), maps) != NULL)
+      fputs(line, out);
+    if(maps != NULL)
+      fclose(maps);
+  }
+
+  free(live);
+  return !ferror(out);
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "poolalloc.h"
+
+/* Sampling heap profiler for a memory pool */
+
+/* While a profile is attached, allocations are sampled with a Poisson
+   process: on average one sample per `mean_bytes` bytes allocated, so
+   that an allocation of `size` bytes is sampled with probability
+   1 - exp(-size / mean_bytes). A sample records the block's address,
+   size and call stack (backtrace()) and stays in the live table until
+   the block is freed, so a dump shows where the memory in use right now
+   was allocated. Stacks start at the caller of the pool function that
+   allocated the block, whichever one it was.
+
+     struct mpool_profile *prof = mpool_profile_start(p, 512 * 1024);
+     ...
+     mpool_profile_dump(prof, stdout, MPOOL_PROFILE_FOLDED);
+     mpool_profile_stop(prof);
+
+   Function names in dumps need the program to be linked with -rdynamic. */
+
+#define MPOOL_PROFILE_DEPTH 32
+
+enum mpool_profile_format {
+  MPOOL_PROFILE_FOLDED,       /* "outer;...;inner bytes" lines for flame graph tools */
+  MPOOL_PROFILE_PPROF         /* gperftools heap profile text, readable by pprof */
+};
+
+struct mpool_sample {
+  void *addr;                 /* NULL marks an empty table slot */
+  size_t size;
+  int depth;
+  void *stack[MPOOL_PROFILE_DEPTH];
+};
+
+struct mpool_profile {
+  struct mpool_hooks hooks;   /* must be first; hooks.countdown is the
+                                 number of bytes left until the next sample */
+  struct memory_pool *pool;
+  size_t mean_bytes;
+  uint64_t rng;
+  struct mpool_sample *table; /* live samples, linear probing on addr */
+  size_t tcap;                /* power of two */
+  size_t live;
+  unsigned long samples;      /* taken since mpool_profile_start */
+};
+
+/* attach a profile sampling every mean_bytes bytes on average to p,
+   replacing any other hooks */
+/* return NULL if memory could not be allocated */
+struct mpool_profile *mpool_profile_start(struct memory_pool *p, size_t mean_bytes);
+
+/* detach prof from its pool, unless other hooks have replaced it since,
+   and free it */
+void mpool_profile_stop(struct mpool_profile *prof);
+
+/* write the live samples to out, merged by call stack */
+/* in folded format sizes are scaled up to estimate the total bytes per
+   stack; pprof does that scaling itself */
+/* return 0 if writing failed */
+int mpool_profile_dump(struct mpool_profile *prof, FILE *out, enum mpool_profile_format format);
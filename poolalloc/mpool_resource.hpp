@@ -0,0 +1,164 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+extern "C" {
+#include "poolalloc.h"
+}
+
+/* C++ adapters that let STL containers allocate from a struct memory_pool */
+
+/* Neither adapter owns the pool, and like the pool itself neither is
+   thread-safe. */
+
+namespace mpool_detail {
+
+/* Blocks are allocated with their exact alignment and freed with
+   mpool_free_sized, since both interfaces pass the size back in.
+   Zero-byte requests take one byte so that every block has its own
+   address. */
+
+inline void *allocate(struct memory_pool *p, std::size_t bytes, std::size_t align)
+{
+  void *b = mpool_aligned_alloc(p, align, bytes ? bytes : 1);
+  if(b == nullptr)
+    throw std::bad_alloc();
+  return b;
+}
+
+inline void deallocate(struct memory_pool *p, void *ptr, std::size_t bytes)
+{
+  mpool_free_sized(p, ptr, bytes ? bytes : 1);
+}
+
+/* size class of T for mpool_new, see MPOOL_NEW in poolalloc.h; over-aligned
+   types keep their own alignment */
+template <class T>
+struct size_class {
+  static constexpr int bin = MPOOL_CLASS_BIN(sizeof(T));
+  static constexpr std::size_t align =
+    alignof(T) > MPOOL_CLASS_ALIGN(sizeof(T)) ? alignof(T) : MPOOL_CLASS_ALIGN(sizeof(T));
+};
+
+template <class T>
+inline void *allocate_fixed(struct memory_pool *p)
+{
+  typedef size_class<T> c;
+  void *b;
+
+  if constexpr (c::bin >= 0)
+    b = mpool_alloc_class(p, c::bin, c::align);
+  else
+    b = mpool_aligned_alloc(p, c::align, sizeof(T));
+  if(b == nullptr)
+    throw std::bad_alloc();
+  return b;
+}
+
+template <class T>
+inline void deallocate_fixed(struct memory_pool *p, void *b)
+{
+  if constexpr (size_class<T>::bin >= 0)
+    mpool_free_class(p, size_class<T>::bin, b);
+  else
+    mpool_free(p, b);
+}
+
+}
+
+/* construct a T in p through the inline size-class fast path */
+/* throws std::bad_alloc if the pool has no room */
+template <class T, class... Args>
+T *mpool_new(struct memory_pool *p, Args &&...args)
+{
+  void *b = mpool_detail::allocate_fixed<T>(p);
+
+  try {
+    return new (b) T(std::forward<Args>(args)...);
+  } catch(...) {
+    mpool_detail::deallocate_fixed<T>(p, b);
+    throw;
+  }
+}
+
+/* destroy and free an object from mpool_new<T> */
+template <class T>
+void mpool_delete(struct memory_pool *p, T *obj)
+{
+  if(obj == nullptr)
+    return;
+  obj->~T();
+  mpool_detail::deallocate_fixed<T>(p, obj);
+}
+
+/* std::pmr::memory_resource backed by a memory pool */
+class mpool_resource : public std::pmr::memory_resource {
+public:
+  explicit mpool_resource(struct memory_pool *p) : pool_(p) {}
+
+  struct memory_pool *pool() const { return pool_; }
+
+protected:
+  void *do_allocate(std::size_t bytes, std::size_t align) override
+  {
+    return mpool_detail::allocate(pool_, bytes, align);
+  }
+
+  void do_deallocate(void *ptr, std::size_t bytes, std::size_t align) override
+  {
+    mpool_detail::deallocate(pool_, ptr, bytes);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+  {
+    const mpool_resource *o = dynamic_cast<const mpool_resource *>(&other);
+    return o != nullptr && o->pool_ == pool_;
+  }
+
+private:
+  struct memory_pool *pool_;
+};
+
+/* classic allocator for containers that take an Allocator parameter */
+template <class T>
+class mpool_allocator {
+public:
+  typedef T value_type;
+
+  explicit mpool_allocator(struct memory_pool *p) noexcept : pool_(p) {}
+
+  template <class U>
+  mpool_allocator(const mpool_allocator<U> &other) noexcept : pool_(other.pool()) {}
+
+  T *allocate(std::size_t n)
+  {
+    if(n > SIZE_MAX / sizeof(T))
+      throw std::bad_array_new_length();
+    return static_cast<T *>(mpool_detail::allocate(pool_, n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *ptr, std::size_t n) noexcept
+  {
+    mpool_detail::deallocate(pool_, ptr, n * sizeof(T));
+  }
+
+  struct memory_pool *pool() const noexcept { return pool_; }
+
+private:
+  struct memory_pool *pool_;
+};
+
+template <class T, class U>
+bool operator==(const mpool_allocator<T> &a, const mpool_allocator<U> &b) noexcept
+{
+  return a.pool() == b.pool();
+}
+
+template <class T, class U>
+bool operator!=(const mpool_allocator<T> &a, const mpool_allocator<U> &b) noexcept
+{
+  return !(a == b);
+}
@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "mpool_resource.hpp"
+
+/* std::pmr containers on the default resource, a
+   monotonic_buffer_resource and an mpool_resource */
+
+/* usage: mpool_resource_bench [elements] */
+
+/* each test builds a container of n elements and destroys it again;
+   the time covers both */
+
+typedef std::chrono::steady_clock bench_clock;
+
+static volatile long sink;
+
+static double run_vector(std::pmr::memory_resource *r, long n) {
+  auto t0 = bench_clock::now();
+  {
+	std::pmr::vector<long> v(r);
+	for(long i = 0; i < n; i++)
+	  v.push_back(i);
+	sink = v.back();
+  }
+  return std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count();
+}
+
+static double run_map(std::pmr::memory_resource *r, long n) {
+  auto t0 = bench_clock::now();
+  {
+	std::pmr::unordered_map<long, long> m(r);
+	for(long i = 0; i < n; i++)
+	  m[i * 7919] = i;
+	sink = m.size();
+  }
+  return std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count();
+}
+
+static double run_list(std::pmr::memory_resource *r, long n) {
+  auto t0 = bench_clock::now();
+  {
+	std::pmr::list<long> l(r);
+	for(long i = 0; i < n; i++)
+	  l.push_back(i);
+	sink = l.back();
+  }
+  return std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count();
+}
+
+int main(int argc, char *argv[]) {
+  long n = argc > 1 ? atol(argv[1]) : 20000;
+  const char *names[] = { "vector", "unordered_map", "list" };
+  double (*tests[])(std::pmr::memory_resource *, long) = { run_vector, run_map, run_list };
+
+  printf("%-14s %-10s %-12s %s\n", "container", "elements", "resource", "ns/element");
+
+  for(int t = 0; t < 3; t++) {
+	double ns = tests[t](std::pmr::new_delete_resource(), n);
+	printf("%-14s %-10ld %-12s %.2f\n", names[t], n, "default", ns / n);
+
+	{
+	  std::pmr::monotonic_buffer_resource mono;
+	  ns = tests[t](&mono, n);
+	  printf("%-14s %-10ld %-12s %.2f\n", names[t], n, "monotonic", ns / n);
+	}
+
+	struct memory_pool *p = mpool_create(n * 256 + (1 << 20));
+	{
+	  mpool_resource r(p);
+	  ns = tests[t](&r, n);
+	  printf("%-14s %-10ld %-12s %.2f\n", names[t], n, "mpool", ns / n);
+	}
+	mpool_destroy(p);
+  }
+
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <list>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#include "mpool_resource.hpp"
+
+extern "C" {
+#include "test_helper.h"
+}
+
+static bool inside(struct memory_pool *p, const void *a) {
+  return (const char *) a >= p->start && (const char *) a < p->start + p->size;
+}
+
+int test_resource_alignment() {
+  struct memory_pool *p = mpool_create(1 << 16);
+  int ret = 1;
+
+  if(!th_check(p != NULL, "resource: mpool_create returned non-null (%p)", p))
+	return 0;
+
+  mpool_resource r(p);
+  std::size_t aligns[] = {1, 2, 4, 8, 16, 32, 64, 4096};
+  std::size_t sizes[] = {1, 3, 24, 100};
+
+  for(std::size_t a : aligns) {
+	for(std::size_t s : sizes) {
+	  void *b = r.allocate(s, a);
+	  ret = th_check(inside(p, b) && inside(p, (char *) b + s - 1), "resource: block %p of %lu bytes is inside the pool", b, s) && ret;
+	  ret = th_check((std::uintptr_t) b % a == 0, "resource: block %p for size %lu is aligned to %lu", b, s, a) && ret;
+	  r.deallocate(b, s, a);
+	}
+  }
+
+  ret = th_check(mpool_alloc(p, p->size) != NULL, "resource: every block was returned to the pool") && ret;
+
+  mpool_resource r2(p);
+  ret = th_check(r.is_equal(r2), "resource: resources on the same pool compare equal") && ret;
+
+  mpool_destroy(p);
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+int test_containers() {
+  struct memory_pool *p = mpool_create(1 << 20);
+  int ret = 1;
+
+  if(!th_check(p != NULL, "containers: mpool_create returned non-null (%p)", p))
+	return 0;
+
+  {
+	mpool_resource r(p);
+	std::pmr::vector<int> v(&r);
+	std::pmr::list<std::pmr::string> l(&r);
+
+	for(int i = 0; i < 1000; i++) {
+	  v.push_back(i);
+	  l.emplace_back(std::to_string(i) + " is long enough to need the heap");
+	}
+
+	ret = th_check(inside(p, v.data()), "containers: pmr::vector storage is in the pool") && ret;
+	ret = th_check(inside(p, l.back().data()), "containers: pmr::string storage is in the pool") && ret;
+	ret = th_check(v[999] == 999 && l.front()[0] == '0', "containers: contents survive reallocation") && ret;
+
+	std::vector<long, mpool_allocator<long>> cv{mpool_allocator<long>(p)};
+	for(long i = 0; i < 1000; i++)
+	  cv.push_back(i);
+
+	ret = th_check(inside(p, cv.data()), "containers: mpool_allocator vector storage is in the pool") && ret;
+	ret = th_check(mpool_allocator<int>(p) == mpool_allocator<char>(p), "containers: allocators on the same pool compare equal") && ret;
+  }
+
+  ret = th_check(mpool_alloc(p, p->size) != NULL, "containers: destroying the containers returns every block") && ret;
+
+  mpool_destroy(p);
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+struct tracked {
+  static int live;
+  long a, b, c;                 /* 24 bytes: size class 24, pointer aligned */
+  tracked(long x) : a(x), b(x + 1), c(x + 2) { live++; }
+  ~tracked() { live--; }
+};
+int tracked::live = 0;
+
+struct alignas(64) wide {
+  char bytes[64];
+};
+
+struct quad {
+  long v[4];                    /* 32 bytes: size class 32, 16-byte aligned */
+};
+
+struct throws {
+  throws() { throw 1; }
+};
+
+int test_mpool_new() {
+  struct memory_pool *p = mpool_create(1 << 16);
+  int ret = 1;
+
+  if(!th_check(p != NULL, "mpool_new: mpool_create returned non-null (%p)", p))
+	return 0;
+
+  tracked *t = mpool_new<tracked>(p, 10);
+  ret = th_check(inside(p, t) && (uintptr_t) t % alignof(void *) == 0, "mpool_new: object (%p) is in the pool and pointer aligned", t) && ret;
+  ret = th_check(t->a == 10 && t->c == 12 && tracked::live == 1, "mpool_new: constructor ran with its arguments") && ret;
+
+  mpool_delete(p, t);
+  ret = th_check(tracked::live == 0, "mpool_delete: destructor ran") && ret;
+  ret = th_check(p->bins[MPOOL_CLASS_BIN(sizeof(tracked))] == t, "mpool_delete: block went onto its bin") && ret;
+
+  tracked *u = mpool_new<tracked>(p, 20);
+  ret = th_check(u == t, "mpool_new: same-size object reuses the binned block (%p, %p)", t, u) && ret;
+  mpool_delete(p, u);
+
+  /* mpool_new and MPOOL_NEW share the class's alignment, so each pops
+     the other's blocks */
+  ret = th_check(mpool_detail::size_class<tracked>::align == MPOOL_CLASS_ALIGN(sizeof(tracked)) &&
+				 mpool_detail::size_class<quad>::align == MPOOL_CLASS_ALIGN(sizeof(quad)),
+				 "mpool_new: alignment matches MPOOL_CLASS_ALIGN") && ret;
+  quad *q = mpool_new<quad>(p);
+  mpool_delete(p, q);
+  quad *r = MPOOL_NEW(p, quad);
+  ret = th_check(r == q, "mpool_new: MPOOL_NEW pops the block mpool_delete pushed (%p, %p)", q, r) && ret;
+  MPOOL_DELETE(p, r);
+
+  wide *w = mpool_new<wide>(p);
+  ret = th_check((uintptr_t) w % 64 == 0, "mpool_new: over-aligned type is aligned (%p)", w) && ret;
+  mpool_delete(p, w);
+
+  bool threw = false;
+  try {
+	mpool_new<throws>(p);
+  } catch(int) {
+	threw = true;
+  }
+  ret = th_check(threw, "mpool_new: constructor exceptions propagate") && ret;
+
+  ret = th_check(mpool_alloc(p, p->size) != NULL, "mpool_new: every block was returned") && ret;
+
+  mpool_destroy(p);
+  fprintf(stderr, "=== DONE\n\n");
+  return ret;
+}
+
+int main(void) {
+  if(!test_resource_alignment())
+	exit(1);
+
+  if(!test_containers())
+	exit(1);
+
+  if(!test_mpool_new())
+	exit(1);
+
+  printf("ALL DONE\n");
+  return 0;
+}
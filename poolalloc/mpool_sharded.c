@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mpool_sharded.h"
+
+/* Routines for per-CPU sharded memory pools (see mpool_sharded.h) */
+
+static unsigned mpool_shard_cpu(struct mpool_sharded *sp)
+{
+  int cpu = sched_getcpu();
+
+  return cpu < 0 ? 0 : (unsigned) cpu % sp->nshards;
+}
+
+static struct mpool_shard *mpool_shard_of(struct mpool_sharded *sp, void *addr)
+{
+  unsigned i;
+
+  for(i = 0; i < sp->nshards; i++) {
+    struct memory_pool *p = sp->shards[i].pool;
+    if((char *) addr >= p->start && (char *) addr < p->start + p->size)
+      return &sp->shards[i];
+  }
+
+  return NULL;
+}
+
+/* free everything on sh's remote stack; called with sh->lock held */
+static void mpool_shard_drain(struct mpool_shard *sh)
+{
+  void *b, *next;
+
+  if(__atomic_load_n(&sh->remote, __ATOMIC_RELAXED) == NULL)
+    return;
+
+  b = __atomic_exchange_n(&sh->remote, NULL, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&sh->remote_count, 0, __ATOMIC_RELAXED);
+
+  for(; b != NULL; b = next) {
+    next = *(void **) b;
+    mpool_free(sh->pool, b);
+  }
+}
+
+/* see mpool_sharded.h */
+struct mpool_sharded *mpool_sharded_create(size_t size, unsigned nshards)
+{
+  struct mpool_sharded *sp;
+  void *mem;
+  unsigned i;
+
+  if(nshards == 0) {
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    nshards = n > 0 ? n : 1;
+  }
+
+  sp = malloc(sizeof(struct mpool_sharded));
+  if(sp == NULL)
+    return NULL;
+
+  if(posix_memalign(&mem, 64, nshards * sizeof(struct mpool_shard)) != 0) {
+    free(sp);
+    return NULL;
+  }
+
+  sp->shards = mem;
+  sp->nshards = nshards;
+  memset(sp->shards, 0, nshards * sizeof(struct mpool_shard));
+
+  for(i = 0; i < nshards; i++) {
+    pthread_mutex_init(&sp->shards[i].lock, NULL);
+    sp->shards[i].pool = mpool_create(size / nshards);
+    if(sp->shards[i].pool == NULL) {
+      sp->nshards = i;
+      mpool_sharded_destroy(sp);
+      return NULL;
+    }
+  }
+
+  return sp;
+}
+
+/* see mpool_sharded.h */
+void mpool_sharded_destroy(struct mpool_sharded *sp)
+{
+  unsigned i;
+
+  for(i = 0; i < sp->nshards; i++) {
+    mpool_destroy(sp->shards[i].pool);
+    pthread_mutex_destroy(&sp->shards[i].lock);
+  }
+
+  free(sp->shards);
+  free(sp);
+}
+
+/* see mpool_sharded.h */
+void *mpool_sharded_alloc(struct mpool_sharded *sp, size_t size)
+{
+  unsigned home = mpool_shard_cpu(sp), i;
+  void *b = NULL;
+
+  if(size < MPOOL_SHARD_MIN_BLOCK)
+    size = MPOOL_SHARD_MIN_BLOCK;
+
+  for(i = 0; i < sp->nshards && b == NULL; i++) {
+    struct mpool_shard *sh = &sp->shards[(home + i) % sp->nshards];
+
+    pthread_mutex_lock(&sh->lock);
+    mpool_shard_drain(sh);
+    b = mpool_alloc(sh->pool, size);
+    pthread_mutex_unlock(&sh->lock);
+  }
+
+  return b;
+}
+
+/* see mpool_sharded.h */
+void mpool_sharded_free(struct mpool_sharded *sp, void *addr)
+{
+  struct mpool_shard *sh;
+  void *top;
+
+  if(addr == NULL || (sh = mpool_shard_of(sp, addr)) == NULL)
+    return;
+
+  if(sh == &sp->shards[mpool_shard_cpu(sp)]) {
+    pthread_mutex_lock(&sh->lock);
+    mpool_shard_drain(sh);
+    mpool_free(sh->pool, addr);
+    pthread_mutex_unlock(&sh->lock);
+    return;
+  }
+
+  /* Treiber push; the owner only ever takes the whole stack, so there
+     is no ABA problem */
+  top = __atomic_load_n(&sh->remote, __ATOMIC_RELAXED);
+  do {
+    *(void **) addr = top;
+  } while(!__atomic_compare_exchange_n(&sh->remote, &top, addr, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  /* an idle owner would never drain its stack, so drain it here once
+     it gets long, if that does not mean waiting */
+  if(__atomic_add_fetch(&sh->remote_count, 1, __ATOMIC_RELAXED) >= MPOOL_SHARD_REMOTE_BATCH &&
+     pthread_mutex_trylock(&sh->lock) == 0) {
+    mpool_shard_drain(sh);
+    pthread_mutex_unlock(&sh->lock);
+  }
+}
+
+/* see mpool_sharded.h */
+void mpool_sharded_get_stats(struct mpool_sharded *sp, struct mpool_stats *stats)
+{
+  struct mpool_stats st;
+  unsigned i;
+
+  memset(stats, 0, sizeof(*stats));
+
+  for(i = 0; i < sp->nshards; i++) {
+    struct mpool_shard *sh = &sp->shards[i];
+
+    pthread_mutex_lock(&sh->lock);
+    mpool_shard_drain(sh);
+    mpool_get_stats(sh->pool, &st);
+    pthread_mutex_unlock(&sh->lock);
+
+    stats->free_bytes += st.free_bytes;
+    stats->free_blocks += st.free_blocks;
+    if(st.largest_free > stats->largest_free)
+      stats->largest_free = st.largest_free;
+    stats->used_bytes += st.used_bytes;
+    stats->used_blocks += st.used_blocks;
+    stats->binned_bytes += st.binned_bytes;
+    stats->deferred_bytes += st.deferred_bytes;
+    stats->handles += st.handles;
+    stats->compactions += st.compactions;
+    stats->compact_moved += st.compact_moved;
+    stats->compact_ns += st.compact_ns;
+    stats->trims += st.trims;
+    stats->trimmed_bytes += st.trimmed_bytes;
+    stats->committed_bytes += st.committed_bytes;
+  }
+}
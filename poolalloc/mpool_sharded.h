@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+#include <pthread.h>
+#include "poolalloc.h"
+
+/* One logical pool split into per-CPU sub-pools (shards) */
+
+/* A thread allocates from the shard of the CPU it is running on, as
+   reported by sched_getcpu(), under that shard's lock. Since threads
+   mostly stay on one CPU, the locks are rarely contended. A thread that
+   migrates merely uses another shard; every shard operation still takes
+   the shard's lock, so this is always correct.
+
+   A block freed on a CPU other than its owner's is pushed onto the
+   owner's lock-free remote stack. The owner takes the whole stack and
+   frees it as one batch the next time it holds its lock, or the
+   freeing thread does so once MPOOL_SHARD_REMOTE_BATCH blocks are
+   waiting and the lock happens to be free. */
+
+/* blocks are at least this large, so a remote stack can link through them */
+#define MPOOL_SHARD_MIN_BLOCK sizeof(void *)
+
+#define MPOOL_SHARD_REMOTE_BATCH 256
+
+struct mpool_shard {
+  pthread_mutex_t lock;
+  struct memory_pool *pool;
+  void *remote;               /* blocks freed by other CPUs, linked through their first word */
+  size_t remote_count;        /* pushed onto remote since the last drain */
+} __attribute__((aligned(64)));
+
+struct mpool_sharded {
+  struct mpool_shard *shards;
+  unsigned nshards;
+};
+
+/* create nshards sub-pools of size / nshards bytes each; nshards 0
+   means one per configured CPU */
+/* return NULL if memory could not be allocated */
+struct mpool_sharded *mpool_sharded_create(size_t size, unsigned nshards);
+
+/* destroy every shard; blocks still allocated are lost */
+void mpool_sharded_destroy(struct mpool_sharded *sp);
+
+/* allocate from the current CPU's shard, or from any other shard if it
+   is full; NULL if no shard has room */
+void *mpool_sharded_alloc(struct mpool_sharded *sp, size_t size);
+
+/* free a block from any shard, from any thread */
+void mpool_sharded_free(struct mpool_sharded *sp, void *addr);
+
+/* stats summed over all shards, after draining their remote stacks */
+void mpool_sharded_get_stats(struct mpool_sharded *sp, struct mpool_stats *stats);
@@ -0,0 +1,76 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mpool_export.h"
+
+/* show the pools published by mpool_export in another process */
+
+/* usage: mpool_top shm_name [interval ms [count]] */
+
+/* redraws every interval (default 1000ms) until interrupted, or count
+   times; the heat map has one cell per 1/64 of the pool, from ' ' (all
+   free) to '@' (all in use) */
+
+static const char shades[] = " .:-=+*#%@";
+
+static void render(const struct mpool_export_shm *s) {
+  unsigned i;
+  int b;
+
+  printf("pid %d, update %llu\n\n", s->pid, (unsigned long long) s->updates);
+  printf("%-20s %12s %12s %10s %12s %8s %8s\n", "pool", "size", "used", "free_rgns", "largest", "frag", "blocks");
+
+  for(i = 0; i < s->npools && i < MPOOL_EXPORT_MAX_POOLS; i++) {
+	const struct mpool_export_pool *p = &s->pools[i];
+
+	printf("%-20.20s %12llu %12llu %10llu %12llu %7.1f%% %8llu\n", p->name,
+		   (unsigned long long) p->size, (unsigned long long) p->used_bytes,
+		   (unsigned long long) p->free_blocks, (unsigned long long) p->largest_free,
+		   100 * p->fragmentation, (unsigned long long) p->used_blocks);
+
+	printf("  [");
+	for(b = 0; b < MPOOL_EXPORT_BUCKETS; b++)
+	  putchar(shades[p->occupancy[b] * 9 / 100]);
+	printf("]\n");
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+  const struct mpool_export_shm *shm;
+  struct mpool_export_shm snap;
+  long interval = argc > 2 ? atol(argv[2]) : 1000;
+  long count = argc > 3 ? atol(argv[3]) : -1;
+  struct timespec ts;
+
+  if(argc < 2) {
+	fprintf(stderr, "usage: %s shm_name [interval ms [count]]\n", argv[0]);
+	return 2;
+  }
+
+  if((shm = mpool_export_attach(argv[1])) == NULL) {
+	fprintf(stderr, "%s: cannot attach to %s\n", argv[0], argv[1]);
+	return 1;
+  }
+
+  ts.tv_sec = interval / 1000;
+  ts.tv_nsec = interval % 1000 * 1000000L;
+
+  for(; count != 0; count--) {
+	if(mpool_export_read(shm, &snap)) {
+	  /* clear the screen when redrawing on a terminal */
+	  if(count < 0)
+		printf("\033[H\033[2J");
+	  render(&snap);
+	} else {
+	  fprintf(stderr, "%s: no consistent snapshot\n", argv[0]);
+	}
+
+	if(count != 1)
+	  nanosleep(&ts, NULL);
+  }
+
+  mpool_export_detach(shm);
+  return 0;
+}
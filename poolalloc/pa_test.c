@@ -1,9 +1,18 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "dbll.h"
 #include "poolalloc.h"
+#include "mpool_sharded.h"
+#include "mpool_profile.h"
+#include "mpool_export.h"
 #include "test_helper.h"
 
 int test_alloc_free() {
@@ -91,6 +100,786 @@ int test_create_destroy(size_t poolsize) {
   return ret;
 }
 
+int test_aligned_alloc() {
+  struct memory_pool *p;
+  size_t aligns[] = {1, 2, 8, 16, 32, 64, 256, 4096};
+  char *small, *big, *pad;
+  int i, ret = 1;
+
+  p = mpool_create(1 << 16);
+
+  if(!th_check(p != NULL, "mpool_create returned non-null (%p)", p))
+	return 0;
+
+  for(i = 0; i < 8; i++) {
+	char *b = mpool_aligned_alloc(p, aligns[i], 3);
+	ret = th_check(b != NULL && (uintptr_t) b % aligns[i] == 0, "mpool_aligned_alloc (%p) is aligned to %lu", b, aligns[i]) && ret;
+	ret = th_check(b >= p->start && b + 3 <= p->start + p->size, "mpool_aligned_alloc (%p) is inside pool", b) && ret;
+	mpool_free(p, b);
+  }
+
+  ret = th_check(mpool_aligned_alloc(p, 24, 8) == NULL, "mpool_aligned_alloc rejects an alignment that is not a power of two") && ret;
+
+  /* the padding in front of a page-aligned block is reused */
+  small = mpool_alloc(p, 1);
+  big = mpool_aligned_alloc(p, 4096, 100);
+  pad = mpool_alloc(p, 64);
+  ret = th_check(big != NULL && (uintptr_t) big % 4096 == 0, "mpool_aligned_alloc (%p) is page aligned", big) && ret;
+  ret = th_check(pad != NULL && pad < big, "padding before the aligned block (%p) serves a later allocation (%p)", big, pad) && ret;
+  mpool_free(p, small);
+  mpool_free(p, big);
+  mpool_free(p, pad);
+
+  ret = th_check(p->free_list->first != NULL && p->free_list->first == p->free_list->last, "free list is one block after freeing everything") && ret;
+
+  mpool_destroy(p);
+  return ret;
+}
+
+int test_free_sized() {
+  struct memory_pool *p;
+  char *a, *b, *c;
+  int n, ret = 1;
+
+  p = mpool_create(4096);
+
+  if(!th_check(p != NULL, "mpool_create returned non-null (%p)", p))
+	return 0;
+
+  a = mpool_alloc(p, 32);
+  mpool_free_sized(p, a, 32);
+  b = mpool_alloc(p, 32);
+  ret = th_check(a == b, "mpool_free_sized block (%p) is reused for the same size (%p)", a, b) && ret;
+  mpool_free_sized(p, b, 32);
+
+  c = mpool_alloc(p, 24);
+  ret = th_check(c != a, "mpool_free_sized block is not handed to another size") && ret;
+  mpool_free_sized(p, c, 24);
+
+  /* a block of 300 bytes is too big for the bins */
+  a = mpool_alloc(p, 300);
+  mpool_free_sized(p, a, 300);
+  b = mpool_alloc(p, 300);
+  ret = th_check(a == b, "mpool_free_sized of %d bytes frees the block at once", 300) && ret;
+  mpool_free(p, b);
+
+  mpool_destroy(p);
+
+  p = mpool_create(4096);
+  for(n = 0; n < 64; n++)
+	mpool_free_sized(p, mpool_alloc(p, 64), 64);
+  a = mpool_alloc(p, 4096);
+  ret = th_check(a == p->start, "binned blocks are returned to the free list when an allocation does not fit (%p)", a) && ret;
+
+  mpool_destroy(p);
+  return ret;
+}
+
+struct fixed_item {
+  int key;
+  char tag[16];
+};
+
+static int fixed_hook_allocs;
+
+static void fixed_hook_alloc(struct mpool_hooks *h, void *addr, size_t size) {
+  fixed_hook_allocs++;
+  h->countdown = 0;
+}
+
+int test_fixed() {
+  struct memory_pool *p;
+  struct mpool_hooks hooks = { fixed_hook_alloc, NULL, NULL, 0, 0 };
+  struct fixed_item *a, *b;
+  char *big;
+  int ret = 1;
+
+  p = mpool_create(4096);
+
+  if(!th_check(p != NULL, "mpool_create returned non-null (%p)", p))
+	return 0;
+
+  ret = th_check(MPOOL_CLASS_BIN(sizeof(struct fixed_item)) == 2 && MPOOL_CLASS_ALIGN(sizeof(struct fixed_item)) == sizeof(void *), "20-byte type is in the 24-byte class, pointer aligned") && ret;
+  ret = th_check(MPOOL_CLASS_ALIGN(32) == 16, "32-byte class is 16-byte aligned") && ret;
+
+  a = MPOOL_NEW(p, struct fixed_item);
+  ret = th_check(a != NULL && (uintptr_t) a % sizeof(void *) == 0, "MPOOL_NEW on an empty bin falls back to the pool (%p)", a) && ret;
+  b = MPOOL_NEW(p, struct fixed_item);
+  ret = th_check((char *) b - (char *) a == 24, "24-byte blocks from the pool leave no holes (%p, %p)", a, b) && ret;
+  MPOOL_DELETE(p, b);
+  MPOOL_DELETE(p, a);
+  b = MPOOL_NEW(p, struct fixed_item);
+  ret = th_check(a == b, "MPOOL_NEW pops the block MPOOL_DELETE pushed (%p, %p)", a, b) && ret;
+
+  /* with hooks installed the out-of-line path runs them */
+  MPOOL_DELETE(p, b);
+  p->hooks = &hooks;
+  a = MPOOL_NEW(p, struct fixed_item);
+  ret = th_check(a == b && fixed_hook_allocs == 1, "MPOOL_NEW runs the alloc hook (%d calls)", fixed_hook_allocs) && ret;
+  MPOOL_DELETE(p, a);
+  p->hooks = NULL;
+
+  big = MPOOL_ALLOC_FIXED(p, 300);
+  ret = th_check(big != NULL && p->bins[MPOOL_BINS - 1] == NULL, "sizes past MPOOL_BIN_MAX use mpool_alloc") && ret;
+  MPOOL_FREE_FIXED(p, big, 300);
+
+  a = mpool_alloc(p, 4096);
+  ret = th_check(a != NULL, "every block was returned") && ret;
+
+  mpool_destroy(p);
+  return ret;
+}
+
+int test_handles() {
+  struct memory_pool *p;
+  struct mpool_handle *h[16];
+  struct mpool_stats st;
+  char *pinned, *b;
+  int i, j, ok, ret = 1;
+
+  p = mpool_create(4096);
+
+  if(!th_check(p != NULL, "mpool_create returned non-null (%p)", p))
+	return 0;
+
+  for(i = 0; i < 16; i++) {
+	h[i] = mpool_halloc(p, 256);
+	ret = th_check(h[i] != NULL, "mpool_halloc %d is non-null", i) && ret;
+	if(h[i] == NULL)
+	  return 0;
+	b = mpool_pin(p, h[i]);
+	memset(b, i, 256);
+	mpool_unpin(p, h[i]);
+  }
+
+  ret = th_check(mpool_halloc(p, 16) == NULL, "mpool_halloc fails when the pool is full") && ret;
+
+  /* leave 8 holes of 256 bytes */
+  for(i = 0; i < 16; i += 2)
+	mpool_hfree(p, h[i]);
+
+  pinned = mpool_pin(p, h[15]);
+  mpool_get_stats(p, &st);
+  ret = th_check(st.free_bytes == 2048 && st.largest_free == 256, "fragmented: %lu free bytes, largest block %lu", st.free_bytes, st.largest_free) && ret;
+
+  ret = th_check(mpool_compact(p, 0) == 7 * 256, "mpool_compact moves the 7 unpinned blocks") && ret;
+
+  mpool_get_stats(p, &st);
+  ret = th_check(st.free_bytes == 2048 && st.largest_free == 2048, "compacted: %lu free bytes, largest block %lu", st.free_bytes, st.largest_free) && ret;
+  ret = th_check(mpool_pin(p, h[15]) == pinned, "pinned block did not move") && ret;
+  mpool_unpin(p, h[15]);
+  mpool_unpin(p, h[15]);
+
+  for(i = 1; i < 16; i += 2) {
+	b = mpool_pin(p, h[i]);
+	for(ok = 1, j = 0; j < 256; j++)
+	  ok = ok && b[j] == i;
+	mpool_unpin(p, h[i]);
+	ret = th_check(ok, "handle %d kept its contents", i) && ret;
+  }
+
+  b = mpool_alloc(p, 2048);
+  ret = th_check(b != NULL, "mpool_alloc of 2048 bytes succeeds after compaction") && ret;
+  mpool_free(p, b);
+
+  for(i = 1; i < 16; i += 2)
+	mpool_hfree(p, h[i]);
+
+  ret = th_check(p->free_list->first != NULL && p->free_list->first == p->free_list->last, "free list is one block after freeing every handle") && ret;
+
+  mpool_destroy(p);
+  return ret;
+}
+
+/* the same fragmented layout in a pool of 8 KB: handles of mixed sizes,
+   some of them refilling holes below later ones, every third one freed
+   and one pinned */
+static struct memory_pool *compact_pool(struct mpool_handle **h, int n) {
+  struct memory_pool *p = mpool_create(8192);
+  int i;
+
+  if(p == NULL)
+	return NULL;
+  for(i = 0; i < n; i++)
+	h[i] = mpool_halloc(p, 16 * (1 + i % 5));
+  for(i = 0; i < n; i += 4) {
+	mpool_hfree(p, h[i]);
+	h[i] = mpool_halloc(p, 16);
+  }
+  for(i = 1; i < n; i += 3) {
+	mpool_hfree(p, h[i]);
+	h[i] = NULL;
+  }
+  mpool_pin(p, h[n / 2]);
+  return p;
+}
+
+int test_compact_budget() {
+  struct memory_pool *full, *step;
+  struct mpool_handle *a[64], *b[64];
+  struct mpool_stats sa, sb;
+  size_t moved, total = 0;
+  int i, calls, ok, ret = 1;
+
+  full = compact_pool(a, 64);
+  step = compact_pool(b, 64);
+
+  if(!th_check(full != NULL && step != NULL, "mpool_create returned non-null"))
+	return 0;
+
+  moved = mpool_compact(step, 1);
+  ret = th_check(moved > 0, "a call with a 1 ns budget still moves a block (%zu bytes)", moved) && ret;
+  total += moved;
+
+  for(calls = 1; calls < 1000 && (moved = mpool_compact(step, 1)) > 0; calls++)
+	total += moved;
+  ret = th_check(moved == 0, "repeated 1 ns calls finish (%d calls)", calls) && ret;
+
+  ret = th_check(mpool_compact(full, 0) == total, "one full call moves the same %zu bytes", total) && ret;
+
+  for(ok = 1, i = 0; i < 64; i++)
+	ok = ok && (a[i] == NULL) == (b[i] == NULL) && (a[i] == NULL || a[i]->info->offset == b[i]->info->offset);
+  ret = th_check(ok, "every handle ends up at the same offset") && ret;
+
+  mpool_get_stats(full, &sa);
+  mpool_get_stats(step, &sb);
+  ret = th_check(sa.free_blocks == sb.free_blocks && sa.largest_free == sb.largest_free, "same free regions: %lu and %lu, largest %lu and %lu", sa.free_blocks, sb.free_blocks, sa.largest_free, sb.largest_free) && ret;
+
+  mpool_destroy(full);
+  mpool_destroy(step);
+  return ret;
+}
+
+int test_deferred() {
+  struct memory_pool *p;
+  struct mpool_stats st;
+  char *b[5], *again;
+  int i, ret = 1;
+
+  p = mpool_create(4096);
+
+  if(!th_check(p != NULL, "mpool_create returned non-null (%p)", p))
+	return 0;
+
+  mpool_set_deferred(p, 4);
+
+  for(i = 0; i < 5; i++)
+	b[i] = mpool_alloc(p, 64);
+
+  mpool_free(p, b[1]);
+  mpool_get_stats(p, &st);
+  ret = th_check(st.deferred_bytes == 64 && st.free_blocks == 1, "deferred free leaves the free list alone (%lu deferred, %lu free blocks)", st.deferred_bytes, st.free_blocks) && ret;
+
+  again = mpool_alloc(p, 64);
+  ret = th_check(again == b[1], "same-size allocation reuses the deferred block (%p, %p)", again, b[1]) && ret;
+
+  for(i = 0; i < 4; i++)
+	mpool_free(p, b[i]);
+  mpool_get_stats(p, &st);
+  ret = th_check(st.deferred_bytes == 256, "up to the threshold frees stay deferred (%lu)", st.deferred_bytes) && ret;
+
+  mpool_free(p, b[4]);
+  mpool_get_stats(p, &st);
+  ret = th_check(st.deferred_bytes == 0 && st.free_blocks == 1 && st.largest_free == 4096, "passing the threshold merges everything (%lu deferred, %lu free blocks)", st.deferred_bytes, st.free_blocks) && ret;
+
+  /* an allocation that does not fit consolidates first */
+  for(i = 0; i < 3; i++)
+	b[i] = mpool_alloc(p, 1024);
+  for(i = 0; i < 3; i++)
+	mpool_free(p, b[i]);
+  again = mpool_alloc(p, 4096);
+  ret = th_check(again == p->start, "allocation miss consolidates the deferred blocks (%p)", again) && ret;
+
+  mpool_destroy(p);
+  return ret;
+}
+
+int test_alloc_hint() {
+  struct memory_pool *p;
+  struct mpool_stats st;
+  size_t size = 65536;
+  char *longs[32], *shorts[32], *a, *b;
+  int i, ret = 1;
+
+  p = mpool_create(size);
+
+  if(!th_check(p != NULL, "mpool_create returned non-null (%p)", p))
+	return 0;
+
+  a = mpool_alloc_hint(p, 100, MPOOL_LONG);
+  b = mpool_alloc_hint(p, 100, MPOOL_SHORT);
+  ret = th_check(a == p->start, "MPOOL_LONG block is at the bottom (%p)", a) && ret;
+  ret = th_check(b != NULL && b + 100 <= p->start + size && b + 100 + 16 > p->start + size && (uintptr_t) b % 16 == 0,
+				 "MPOOL_SHORT block is at the top, aligned (%p)", b) && ret;
+  mpool_free(p, a);
+  mpool_free(p, b);
+  ret = th_check(p->free_list->first == p->free_list->last, "freeing both leaves one free block") && ret;
+
+  /* interleaved lifetimes: once the short blocks are gone the long ones
+     are contiguous */
+  for(i = 0; i < 32; i++) {
+	longs[i] = mpool_alloc_hint(p, 48, MPOOL_LONG);
+	shorts[i] = mpool_alloc_hint(p, 200 + i, MPOOL_SHORT);
+  }
+  for(i = 0; i < 32; i++)
+	mpool_free(p, shorts[i]);
+
+  mpool_get_stats(p, &st);
+  ret = th_check(st.free_blocks == 1 && st.largest_free == size - 32 * 48, "short blocks leave no holes (%lu free blocks, largest %lu)", st.free_blocks, st.largest_free) && ret;
+
+  for(i = 0; i < 32; i++)
+	mpool_free(p, longs[i]);
+
+  /* the top block is reused when it is the only one left */
+  a = mpool_alloc_hint(p, size, MPOOL_SHORT);
+  ret = th_check(a == p->start, "MPOOL_SHORT can take the whole pool") && ret;
+
+  mpool_destroy(p);
+  return ret;
+}
+
+int test_trim() {
+  struct memory_pool *p;
+  struct mpool_stats st;
+  size_t size = 4 << 20, released;
+  char *head, *b;
+  int zero, ret = 1;
+
+  p = mpool_create(size);
+
+  if(!th_check(p != NULL, "mpool_create returned non-null (%p)", p))
+	return 0;
+
+  memset(p->start, 0xa5, size);
+  head = mpool_alloc(p, 65536);
+
+  ret = th_check(mpool_trim(p, size) == 0, "mpool_trim keeping everything releases nothing") && ret;
+
+  released = mpool_trim(p, 1 << 20);
+  ret = th_check(released >= size - 65536 - (1 << 20) - 4096 && released <= size - 65536 - (1 << 20) + 4096, "mpool_trim keeping 1MB releases about 3MB (%lu)", released) && ret;
+
+  released = mpool_trim(p, 0);
+  ret = th_check(released >= size - 65536 - 8192, "mpool_trim releases all free pages (%lu)", released) && ret;
+  ret = th_check(head[0] == (char) 0xa5 && head[65535] == (char) 0xa5, "allocated block is left alone") && ret;
+
+  mpool_get_stats(p, &st);
+  ret = th_check(st.trims == 3 && st.trimmed_bytes >= released, "stats count %lu trims, %lu bytes", st.trims, st.trimmed_bytes) && ret;
+
+  /* the address range is still usable */
+  b = mpool_alloc(p, size - 65536 - 16);
+  ret = th_check(b != NULL, "released space can be allocated again") && ret;
+  if(b != NULL) {
+	zero = b[size / 2] == 0;
+	memset(b, 1, size - 65536 - 16);
+	ret = th_check(zero && b[size / 2] == 1, "released pages come back zeroed and writable") && ret;
+  }
+
+  mpool_destroy(p);
+  return ret;
+}
+
+int test_snapshot() {
+  struct memory_pool *p, *h, *c1, *c2;
+  struct mpool_snapshot *snap;
+  size_t size = 1 << 20;
+  char *a, *b, *ca, *cb, *n;
+  int ret = 1;
+
+  p = mpool_create_flags(size, MPOOL_MEMFD);
+
+  if(!th_check(p != NULL, "mpool_create_flags returned non-null (%p)", p))
+	return 0;
+
+  a = mpool_alloc(p, 4096);
+  b = mpool_alloc(p, 100);
+  strcpy(a, "template a");
+  strcpy(b, "template b");
+
+  snap = mpool_snapshot(p);
+  if(!th_check(snap != NULL, "mpool_snapshot returned non-null (%p)", snap))
+	return 0;
+  ret = th_check(snap->nalloc == 2 && snap->nfree == 1, "snapshot has 2 allocated and 1 free records") && ret;
+  ret = th_check(strcmp(a, "template a") == 0, "the pool keeps its contents after the snapshot") && ret;
+
+  c1 = mpool_clone(snap);
+  c2 = mpool_clone(snap);
+  if(!th_check(c1 != NULL && c2 != NULL, "mpool_clone returned non-null (%p, %p)", c1, c2))
+	return 0;
+
+  ca = c1->start + (a - p->start);
+  cb = c1->start + (b - p->start);
+  ret = th_check(strcmp(ca, "template a") == 0 && strcmp(cb, "template b") == 0, "clone sees the snapshot contents") && ret;
+
+  /* writes stay in the pool that made them */
+  strcpy(ca, "clone 1");
+  strcpy(a, "source");
+  ret = th_check(strcmp(c2->start + (a - p->start), "template a") == 0, "other clone is unaffected (%s)", c2->start + (a - p->start)) && ret;
+  ret = th_check(strcmp(a, "source") == 0 && strcmp(ca, "clone 1") == 0, "source and clone are independent") && ret;
+
+  /* allocation state is cloned too */
+  n = mpool_alloc(c1, size - 4096 - 112);
+  ret = th_check(n != NULL && n >= cb + 100, "clone allocates after the cloned blocks (%p)", n) && ret;
+  mpool_free(c1, ca);
+  mpool_free(c1, cb);
+  mpool_free(c1, n);
+  ret = th_check(c1->free_list->first == c1->free_list->last, "freeing cloned blocks merges them") && ret;
+
+  mpool_destroy(c1);
+  mpool_destroy(c2);
+
+  /* a second snapshot copies the current contents */
+  mpool_snapshot_free(snap);
+  snap = mpool_snapshot(p);
+  c1 = mpool_clone(snap);
+  ret = th_check(c1 != NULL && strcmp(c1->start + (a - p->start), "source") == 0, "second snapshot has the later writes") && ret;
+  mpool_snapshot_free(snap);
+  ret = th_check(strcmp(c1->start + (b - p->start), "template b") == 0, "clone outlives its snapshot") && ret;
+  mpool_destroy(c1);
+  mpool_destroy(p);
+
+  /* malloc-backed pools are copied */
+  h = mpool_create(size);
+  a = mpool_alloc(h, 64);
+  strcpy(a, "heap");
+  snap = mpool_snapshot(h);
+  c1 = mpool_clone(snap);
+  mpool_snapshot_free(snap);
+  ret = th_check(c1 != NULL && strcmp(c1->start + (a - h->start), "heap") == 0, "clone of a malloc-backed pool") && ret;
+  mpool_destroy(c1);
+  mpool_destroy(h);
+
+  return ret;
+}
+
+int test_lazy() {
+  struct memory_pool *p, *c;
+  struct mpool_snapshot *snap;
+  struct mpool_stats st;
+  size_t size = (size_t) 1 << 30;
+  char *blocks[256], *b;
+  int ret = 1;
+  int i, bad;
+
+  ret = th_check(mpool_create_flags(size, MPOOL_MEMFD | MPOOL_LAZY) == NULL, "MPOOL_MEMFD and MPOOL_LAZY are rejected together") && ret;
+
+  p = mpool_create_flags(size, MPOOL_LAZY);
+  if(!th_check(p != NULL, "mpool_create_flags(MPOOL_LAZY) returned non-null (%p)", p))
+	return 0;
+
+  mpool_get_stats(p, &st);
+  ret = th_check(st.committed_bytes == 0, "lazy pool starts with nothing committed (%lu)", (unsigned long) st.committed_bytes) && ret;
+
+  for(i = 0, bad = 0; i < 256; i++) {
+	blocks[i] = mpool_alloc(p, 16384);
+	bad += blocks[i] == NULL;
+	if(blocks[i] != NULL)
+	  memset(blocks[i], i, 16384);
+  }
+  ret = th_check(bad == 0, "lazy pool serves 256 blocks of 16KB (%d failed)", bad) && ret;
+
+  mpool_get_stats(p, &st);
+  ret = th_check(st.committed_bytes >= 256 * 16384 && st.committed_bytes <= 256 * 16384 + MPOOL_COMMIT_CHUNK,
+				 "lazy pool commits up to the frontier (%lu bytes)", (unsigned long) st.committed_bytes) && ret;
+
+  b = mpool_alloc_hint(p, 64, MPOOL_SHORT);
+  ret = th_check(b != NULL && b < p->start + p->committed, "short-lived blocks stay below the frontier in a lazy pool") && ret;
+  mpool_free(p, b);
+
+  /* only committed memory is snapshotted */
+  snap = mpool_snapshot(p);
+  c = snap != NULL ? mpool_clone(snap) : NULL;
+  if(!th_check(c != NULL, "lazy pool can be snapshotted and cloned (%p)", c))
+	return 0;
+  ret = th_check(c->start[blocks[255] - p->start] == (char) 255, "clone of a lazy pool sees its contents") && ret;
+  mpool_snapshot_free(snap);
+  mpool_destroy(c);
+
+  for(i = 0; i < 256; i++)
+	mpool_free(p, blocks[i]);
+  ret = th_check(mpool_trim(p, 0) <= p->committed, "mpool_trim releases no more than was committed") && ret;
+  mpool_destroy(p);
+
+  /* the prefault thread leaves blocks in use alone */
+  p = mpool_create_flags(size, MPOOL_PREFAULT);
+  if(!th_check(p != NULL, "mpool_create_flags(MPOOL_PREFAULT) returned non-null (%p)", p))
+	return 0;
+  for(i = 0; i < 256; i++) {
+	blocks[i] = mpool_alloc(p, 65536);
+	memset(blocks[i], i, 65536);
+  }
+  for(i = 0, bad = 0; i < 256; i++)
+	bad += blocks[i][0] != (char) i || blocks[i][65535] != (char) i;
+  ret = th_check(bad == 0, "blocks of a prefaulted pool keep their contents (%d changed)", bad) && ret;
+  mpool_destroy(p);
+
+  return ret;
+}
+
+/* number of non-zero bytes in b */
+static size_t nonzero(const char *b, size_t size) {
+  size_t i, n = 0;
+  for(i = 0; i < size; i++)
+	n += b[i] != 0;
+  return n;
+}
+
+int test_calloc() {
+  struct memory_pool *p, *c;
+  struct mpool_snapshot *snap;
+  size_t size = 1 << 20, pg;
+  char *a, *b;
+  int ret = 1;
+
+  p = mpool_create(size);
+
+  b = mpool_calloc(p, 1000, 300);
+  ret = th_check(b != NULL && nonzero(b, 300000) == 0, "mpool_calloc of fresh memory is zero") && ret;
+  pg = (b - p->start) / MPOOL_ZERO_PAGE + 1;
+  ret = th_check(p->dirty[pg / 64] >> (pg % 64) & 1, "pages handed out are marked dirty") && ret;
+
+  /* reused memory is cleared */
+  memset(b, 0xab, 300000);
+  mpool_free(p, b);
+  a = mpool_calloc(p, 1, 200000);
+  ret = th_check(a == b && nonzero(a, 200000) == 0, "mpool_calloc clears reused memory") && ret;
+  mpool_free(p, a);
+
+  /* so are binned blocks */
+  a = mpool_alloc(p, 64);
+  memset(a, 0xab, 64);
+  mpool_free_sized(p, a, 64);
+  b = mpool_calloc(p, 8, 8);
+  ret = th_check(b == a && nonzero(b, 64) == 0, "mpool_calloc clears binned blocks") && ret;
+  mpool_free(p, b);
+
+  /* trimmed pages are zero again */
+  mpool_trim(p, 0);
+  ret = th_check((p->dirty[pg / 64] >> (pg % 64) & 1) == 0, "mpool_trim marks released pages zero") && ret;
+  a = mpool_calloc(p, 1, 300000);
+  ret = th_check(a != NULL && nonzero(a, 300000) == 0, "mpool_calloc after mpool_trim is zero") && ret;
+
+  ret = th_check(mpool_calloc(p, SIZE_MAX / 2, 4) == NULL, "mpool_calloc rejects nmemb * size overflow") && ret;
+
+  /* clones start with the snapshot's bytes, even in free space */
+  memset(a, 0xcd, 300000);
+  mpool_free(p, a);
+  snap = mpool_snapshot(p);
+  c = mpool_clone(snap);
+  mpool_snapshot_free(snap);
+  b = mpool_calloc(c, 1, 300000);
+  ret = th_check(b != NULL && nonzero(b, 300000) == 0, "mpool_calloc in a clone clears the snapshot's data") && ret;
+  mpool_destroy(c);
+  mpool_destroy(p);
+
+  p = mpool_create_flags((size_t) 1 << 30, MPOOL_LAZY);
+  b = mpool_calloc(p, 1 << 20, 8);
+  ret = th_check(b != NULL && nonzero(b, 8 << 20) == 0, "mpool_calloc in a lazy pool is zero") && ret;
+  mpool_destroy(p);
+
+  return ret;
+}
+
+#define SHARD_THREADS 4
+#define SHARD_BLOCKS 200
+/* about 400KB in all, more than one shard holds, so some blocks spill
+   into other shards and are freed remotely even on a single CPU */
+#define SHARD_SIZE(i) (1 + (i) % 64 * 16)
+
+static struct mpool_sharded *shard_test_pool;
+static char *shard_blocks[SHARD_THREADS][SHARD_BLOCKS];
+
+static void *shard_alloc_thread(void *arg) {
+  long t = (long) arg;
+  int i;
+
+  for(i = 0; i < SHARD_BLOCKS; i++) {
+	shard_blocks[t][i] = mpool_sharded_alloc(shard_test_pool, SHARD_SIZE(i));
+	if(shard_blocks[t][i] != NULL)
+	  memset(shard_blocks[t][i], t, SHARD_SIZE(i));
+  }
+  return NULL;
+}
+
+/* frees the blocks of the next thread, so most frees are remote */
+static void *shard_free_thread(void *arg) {
+  long t = (long) arg;
+  int i;
+
+  for(i = 0; i < SHARD_BLOCKS; i++)
+	mpool_sharded_free(shard_test_pool, shard_blocks[(t + 1) % SHARD_THREADS][i]);
+  return NULL;
+}
+
+int test_sharded() {
+  pthread_t th[SHARD_THREADS];
+  struct mpool_stats st;
+  int i, j, ok = 1, ret = 1;
+  long t;
+
+  shard_test_pool = mpool_sharded_create(1 << 20, 4);
+
+  if(!th_check(shard_test_pool != NULL, "mpool_sharded_create returned non-null (%p)", shard_test_pool))
+	return 0;
+
+  for(t = 0; t < SHARD_THREADS; t++)
+	pthread_create(&th[t], NULL, shard_alloc_thread, (void *) t);
+  for(t = 0; t < SHARD_THREADS; t++)
+	pthread_join(th[t], NULL);
+
+  for(t = 0; t < SHARD_THREADS; t++) {
+	for(i = 0; i < SHARD_BLOCKS; i++) {
+	  ok = ok && shard_blocks[t][i] != NULL;
+	  for(j = 0; ok && j < SHARD_SIZE(i); j++)
+		ok = shard_blocks[t][i][j] == (char) t;
+	}
+  }
+  ret = th_check(ok, "sharded blocks from %d threads are intact", SHARD_THREADS) && ret;
+
+  mpool_sharded_get_stats(shard_test_pool, &st);
+  ret = th_check(st.used_blocks == SHARD_THREADS * SHARD_BLOCKS, "sharded pool has %lu blocks in use", st.used_blocks) && ret;
+
+  for(t = 0; t < SHARD_THREADS; t++)
+	pthread_create(&th[t], NULL, shard_free_thread, (void *) t);
+  for(t = 0; t < SHARD_THREADS; t++)
+	pthread_join(th[t], NULL);
+
+  mpool_sharded_get_stats(shard_test_pool, &st);
+  ret = th_check(st.used_blocks == 0 && st.free_bytes == 1 << 20 && st.free_blocks == 4, "cross-thread frees return everything (%lu used, %lu free blocks)", st.used_blocks, st.free_blocks) && ret;
+  ret = th_check(st.committed_bytes == 1 << 20, "sharded pool sums the shards' committed bytes (%lu)", (unsigned long) st.committed_bytes) && ret;
+
+  mpool_sharded_destroy(shard_test_pool);
+  return ret;
+}
+
+/* the live sample for addr */
+static size_t profile_slot(struct mpool_profile *prof, void *addr) {
+  size_t i;
+
+  for(i = 0; i < prof->tcap; i++)
+	if(prof->table[i].addr == addr)
+	  return i;
+  return 0;
+}
+
+int test_profile() {
+  struct memory_pool *p;
+  struct mpool_profile *prof;
+  struct mpool_hooks other = { NULL, NULL, NULL, INT64_MAX, 0 };
+  struct mpool_sample *s[3];
+  char *b[3], line[256];
+  FILE *out;
+  int i, ret = 1;
+
+  p = mpool_create(16 << 20);
+
+  if(!th_check(p != NULL, "mpool_create returned non-null (%p)", p))
+	return 0;
+
+  /* a mean of one byte samples every allocation */
+  prof = mpool_profile_start(p, 1);
+  if(!th_check(prof != NULL, "mpool_profile_start returned non-null (%p)", prof))
+	return 0;
+
+  for(i = 0; i < 3; i++)
+	b[i] = mpool_alloc(p, 100 * (i + 1));
+  ret = th_check(prof->live == 3, "every allocation is sampled (%lu live)", prof->live) && ret;
+
+  mpool_free(p, b[1]);
+  ret = th_check(prof->live == 2, "freeing drops the sample (%lu live)", prof->live) && ret;
+
+  out = tmpfile();
+  ret = th_check(mpool_profile_dump(prof, out, MPOOL_PROFILE_PPROF), "mpool_profile_dump succeeds") && ret;
+  rewind(out);
+  ret = th_check(fgets(line, sizeof(line), out) != NULL && strcmp(line, "heap profile: 2: 400 [2: 400] @ heap_v2/1\n") == 0, "pprof header counts the live samples (%s)", line) && ret;
+  fclose(out);
+
+  mpool_free(p, b[0]);
+  mpool_free(p, b[2]);
+
+  /* every entry point leaves the same frames above its caller */
+  b[0] = mpool_alloc(p, 64);
+  b[1] = mpool_calloc(p, 8, 8);
+  b[2] = mpool_alloc_hint(p, 64, MPOOL_SHORT);
+  for(i = 0; i < 3; i++)
+	s[i] = &prof->table[profile_slot(prof, b[i])];
+  for(i = 1; i < 3; i++)
+	ret = th_check(s[i]->depth == s[0]->depth && s[i]->stack[1] == s[0]->stack[1], "stacks from different entry points start at the caller (%d: depth %d, %d)", i, s[i]->depth, s[0]->depth) && ret;
+  for(i = 0; i < 3; i++)
+	mpool_free(p, b[i]);
+
+  mpool_profile_stop(prof);
+  ret = th_check(p->hooks == NULL, "mpool_profile_stop detaches the profile") && ret;
+
+  /* hooks installed over a profile stay */
+  prof = mpool_profile_start(p, 65536);
+  p->hooks = &other;
+  mpool_profile_stop(prof);
+  ret = th_check(p->hooks == &other, "mpool_profile_stop leaves other hooks alone") && ret;
+  p->hooks = NULL;
+
+  /* 10MB in blocks of 100 bytes at one sample per 64KB: about 160 samples */
+  prof = mpool_profile_start(p, 65536);
+  for(i = 0; i < 100000; i++)
+	mpool_free_sized(p, mpool_alloc(p, 104), 104);
+  ret = th_check(prof->samples > 90 && prof->samples < 230, "sampling rate follows the mean (%lu samples)", prof->samples) && ret;
+  ret = th_check(prof->live == 0, "no samples outlive their blocks (%lu)", prof->live) && ret;
+  mpool_profile_stop(prof);
+
+  mpool_destroy(p);
+  return ret;
+}
+
+int test_export() {
+  struct memory_pool *p;
+  struct mpool_exporter *ex;
+  const struct mpool_export_shm *shm;
+  struct mpool_export_shm snap;
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  struct timespec ts = { 0, 50 * 1000000L };
+  char name[64];
+  void *b;
+  int ret = 1;
+
+  snprintf(name, sizeof(name), "/mpool_pa_test_%d", (int) getpid());
+
+  p = mpool_create(65536);
+  ex = mpool_export_create(name);
+  if(!th_check(p != NULL && ex != NULL, "mpool_export_create returned non-null (%p)", ex))
+	return 0;
+
+  mpool_export_add(ex, p, "test", &lock);
+  mpool_alloc(p, 32768);
+  mpool_export_publish(ex);
+
+  shm = mpool_export_attach(name);
+  if(!th_check(shm != NULL, "mpool_export_attach returned non-null (%p)", shm))
+	return 0;
+
+  ret = th_check(mpool_export_read(shm, &snap), "mpool_export_read got a snapshot") && ret;
+  ret = th_check(snap.npools == 1 && strcmp(snap.pools[0].name, "test") == 0, "snapshot holds the pool") && ret;
+  ret = th_check(snap.pools[0].used_bytes == 32768 && snap.pools[0].free_bytes == 32768 && snap.pools[0].free_blocks == 1, "snapshot counters (%lu used)", (unsigned long) snap.pools[0].used_bytes) && ret;
+  ret = th_check(snap.pools[0].occupancy[0] == 100 && snap.pools[0].occupancy[31] == 100 && snap.pools[0].occupancy[32] == 0, "occupancy map shows the first half in use") && ret;
+
+  /* the background thread picks up changes made under the lock */
+  ret = th_check(mpool_export_start(ex, 10), "mpool_export_start started the thread") && ret;
+  pthread_mutex_lock(&lock);
+  b = mpool_alloc(p, 16384);
+  pthread_mutex_unlock(&lock);
+  nanosleep(&ts, NULL);
+
+  memset(&snap, 0, sizeof(snap));
+  mpool_export_read(shm, &snap);
+  ret = th_check(snap.pools[0].used_bytes == 49152 && snap.updates > 1, "background updates are published (%lu used, %lu updates)", (unsigned long) snap.pools[0].used_bytes, (unsigned long) snap.updates) && ret;
+
+  mpool_export_detach(shm);
+  mpool_export_destroy(ex);
+  ret = th_check(mpool_export_attach(name) == NULL, "the segment is gone after mpool_export_destroy") && ret;
+
+  mpool_free(p, b);
+  mpool_destroy(p);
+  return ret;
+}
+
 int main(int argc, char *argv[]) {
   int poolsize = 1024;
 
@@ -105,6 +894,48 @@ int main(int argc, char *argv[]) {
   if(!test_alloc_free(poolsize))
 	exit(1);
 
+  if(!test_aligned_alloc())
+	exit(1);
+
+  if(!test_free_sized())
+	exit(1);
+
+  if(!test_fixed())
+	exit(1);
+
+  if(!test_handles())
+	exit(1);
+
+  if(!test_compact_budget())
+	exit(1);
+
+  if(!test_deferred())
+	exit(1);
+
+  if(!test_alloc_hint())
+	exit(1);
+
+  if(!test_trim())
+	exit(1);
+
+  if(!test_snapshot())
+	exit(1);
+
+  if(!test_lazy())
+	exit(1);
+
+  if(!test_calloc())
+	exit(1);
+
+  if(!test_sharded())
+	exit(1);
+
+  if(!test_profile())
+	exit(1);
+
+  if(!test_export())
+	exit(1);
+
   printf("ALL DONE\n");
   return 0;
 }
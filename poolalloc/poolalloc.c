@@ -1,5 +1,13 @@
+#define _GNU_SOURCE
 #include "dbll.h"
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/types.h>
 #include "poolalloc.h"
 
 /*
@@ -7,23 +15,305 @@
    allocated and free to_adds
  */
 
+/* length of the mapping behind a pool of `size` bytes */
+static size_t mpool_map_len(size_t size)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  return size ? (size + page - 1) & ~(page - 1) : page;
+}
+
+/* a new memfd of len bytes, or -1 */
+static int mpool_memfd(size_t len)
+{
+  int fd = memfd_create("mpool", MFD_CLOEXEC);
+
+  if(fd >= 0 && ftruncate(fd, len) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+/* background thread of an MPOOL_PREFAULT pool */
+struct mpool_prefault {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  char *start;
+  size_t len;                 /* length of the reservation */
+  size_t frontier;            /* pool's committed bytes, under lock */
+  size_t ready;               /* bytes committed and faulted in, atomic */
+  int running;                /* under lock */
+};
+
+/* fault in len bytes at from without changing them, since the pool
+   may already be using the pages */
+static void mpool_touch(char *from, size_t len)
+{
+  size_t page = sysconf(_SC_PAGESIZE), i;
+
+#ifdef MADV_POPULATE_WRITE
+  if(madvise(from, len, MADV_POPULATE_WRITE) == 0)
+    return;
+#endif
+  for(i = 0; i < len; i += page)
+    __atomic_fetch_add(from + i, 0, __ATOMIC_RELAXED);
+}
+
+static void *mpool_prefault_thread(void *arg)
+{
+  struct mpool_prefault *pf = arg;
+  size_t ready, target, end;
+
+  pthread_mutex_lock(&pf->lock);
+  while(pf->running) {
+    ready = __atomic_load_n(&pf->ready, __ATOMIC_RELAXED);
+    target = pf->len - pf->frontier > MPOOL_PREFAULT_AHEAD ? pf->frontier + MPOOL_PREFAULT_AHEAD : pf->len;
+    if(ready >= target) {
+      pthread_cond_wait(&pf->wake, &pf->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&pf->lock);
+
+    /* one chunk at a time, so that the pool sees progress early */
+    end = target - ready > MPOOL_COMMIT_CHUNK ? ready + MPOOL_COMMIT_CHUNK : target;
+    if(mprotect(pf->start + ready, end - ready, PROT_READ | PROT_WRITE) != 0) {
+      /* leave committing to the pool */
+      pthread_mutex_lock(&pf->lock);
+      break;
+    }
+    mpool_touch(pf->start + ready, end - ready);
+    __atomic_store_n(&pf->ready, end, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&pf->lock);
+  }
+  pthread_mutex_unlock(&pf->lock);
+
+  return NULL;
+}
+
+/* start prefaulting a reserved pool, return NULL if that failed */
+static struct mpool_prefault *mpool_prefault_start(struct memory_pool *p)
+{
+  struct mpool_prefault *pf = malloc(sizeof(struct mpool_prefault));
+
+  if(pf == NULL)
+    return NULL;
+
+  pthread_mutex_init(&pf->lock, NULL);
+  pthread_cond_init(&pf->wake, NULL);
+  pf->start = p->start;
+  pf->len = mpool_map_len(p->size);
+  pf->frontier = 0;
+  pf->ready = 0;
+  pf->running = 1;
+  if(pthread_create(&pf->thread, NULL, mpool_prefault_thread, pf) != 0) {
+    pthread_cond_destroy(&pf->wake);
+    pthread_mutex_destroy(&pf->lock);
+    free(pf);
+    return NULL;
+  }
+  return pf;
+}
+
+static void mpool_prefault_stop(struct mpool_prefault *pf)
+{
+  pthread_mutex_lock(&pf->lock);
+  pf->running = 0;
+  pthread_cond_signal(&pf->wake);
+  pthread_mutex_unlock(&pf->lock);
+
+  pthread_join(pf->thread, NULL);
+  pthread_cond_destroy(&pf->wake);
+  pthread_mutex_destroy(&pf->lock);
+  free(pf);
+}
+
+/* let a lazy pool touch its first `end` bytes, committing whole chunks */
+/* return 0 if the memory could not be committed */
+static int mpool_commit(struct memory_pool *p, size_t end)
+{
+  struct mpool_prefault *pf = p->prefault;
+  size_t len = mpool_map_len(p->size);
+  size_t to = (end + MPOOL_COMMIT_CHUNK - 1) / MPOOL_COMMIT_CHUNK * MPOOL_COMMIT_CHUNK;
+  size_t ready = pf != NULL ? __atomic_load_n(&pf->ready, __ATOMIC_ACQUIRE) : 0;
+
+  if(to > len)
+    to = len;
+
+  /* take what the thread has prepared, or commit the rest here */
+  if(ready >= end) {
+    to = ready;
+  } else if(mprotect(p->start + p->committed, to - p->committed, PROT_READ | PROT_WRITE) != 0) {
+    return 0;
+  }
+  p->committed = to;
+
+  if(pf != NULL) {
+    pthread_mutex_lock(&pf->lock);
+    pf->frontier = to;
+    pthread_cond_signal(&pf->wake);
+    pthread_mutex_unlock(&pf->lock);
+  }
+  return 1;
+}
+
+/* bytes in the known-zero map of a pool of `size` bytes */
+static size_t mpool_dirty_map_len(size_t size)
+{
+  size_t pages = (size + MPOOL_ZERO_PAGE - 1) / MPOOL_ZERO_PAGE;
+  return (pages / 64 + 1) * sizeof(uint64_t);
+}
+
+/* the known-zero map of a pool of `size` bytes, all pages zero */
+static uint64_t *mpool_dirty_map(size_t size)
+{
+  return calloc(mpool_dirty_map_len(size), 1);
+}
+
+#define MPOOL_PAGE_DIRTY(d, pg) (((d)[(pg) / 64] >> ((pg) % 64)) & 1)
+
+/* mark [offset, offset + size) as handed out; if zero is set, first
+   clear the parts of it that may hold old data */
+static void mpool_dirty(struct memory_pool *p, size_t offset, size_t size, int zero)
+{
+  uint64_t *d = p->dirty;
+  size_t pg, end, last, from, to;
+  int was;
+
+  if(size == 0)
+    return;
+  if(d == NULL) {
+    if(zero)
+      memset(p->start + offset, 0, size);
+    return;
+  }
+
+  last = (offset + size - 1) / MPOOL_ZERO_PAGE;
+  for(pg = offset / MPOOL_ZERO_PAGE; pg <= last; pg = end) {
+    /* pages [pg, end) are all dirty or all still zero */
+    was = MPOOL_PAGE_DIRTY(d, pg);
+    for(end = pg + 1; end <= last && MPOOL_PAGE_DIRTY(d, end) == was; end++)
+      ;
+
+    if(was) {
+      if(zero) {
+        from = pg * MPOOL_ZERO_PAGE > offset ? pg * MPOOL_ZERO_PAGE : offset;
+        to = end * MPOOL_ZERO_PAGE < offset + size ? end * MPOOL_ZERO_PAGE : offset + size;
+        memset(p->start + from, 0, to - from);
+      }
+    } else {
+      for(; pg < end; pg++)
+        d[pg / 64] |= (uint64_t) 1 << (pg % 64);
+    }
+  }
+}
+
+/* note that the pages wholly inside [from, to) read as zero again */
+static void mpool_clean(struct memory_pool *p, size_t from, size_t to)
+{
+  size_t pg;
+
+  if(p->dirty == NULL)
+    return;
+  for(pg = (from + MPOOL_ZERO_PAGE - 1) / MPOOL_ZERO_PAGE; (pg + 1) * MPOOL_ZERO_PAGE <= to; pg++)
+    p->dirty[pg / 64] &= ~((uint64_t) 1 << (pg % 64));
+}
+
+/* everything but the memory and the free_list's first record */
+static void mpool_init(struct memory_pool *mpool)
+{
+  memset(mpool->bins, 0, sizeof(mpool->bins));
+  /* create a doubly-linked list to track allocations */
+  mpool->alloc_list = dbll_create();
+
+  /* create a doubly-linked list to track free to_adds */
+  mpool->free_list = dbll_create();
+
+  /* unsorted cache of freed blocks, see mpool_set_deferred */
+  mpool->deferred = dbll_create();
+  mpool->deferred_count = 0;
+  mpool->deferred_threshold = 0;
+
+  /* handles from mpool_halloc, see mpool_compact */
+  mpool->handles = dbll_create();
+  mpool->compact_next = NULL;
+  mpool->compact_free = NULL;
+  mpool->compactions = 0;
+  mpool->compact_moved = 0;
+  mpool->compact_ns = 0;
+  mpool->trims = 0;
+  mpool->trimmed = 0;
+  mpool->hooks = NULL;
+  mpool->committed = mpool->size;
+  mpool->prefault = NULL;
+  mpool->dirty = mpool_dirty_map(mpool->size);
+}
+
 /* create and initialize a memory pool of the required size */
 /* use malloc() or calloc() to obtain this initial pool of memory from the system */
 struct memory_pool *mpool_create(size_t size)
 {
-  struct memory_pool *mpool = (struct memory_pool *)malloc(sizeof(struct memory_pool ));
+  return mpool_create_flags(size, 0);
+}
+
+/* see poolalloc.h */
+struct memory_pool *mpool_create_flags(size_t size, int flags)
+{
+  struct memory_pool *mpool;
+
+  if((flags & MPOOL_MEMFD) && (flags & (MPOOL_LAZY | MPOOL_PREFAULT))){
+    return NULL;
+  }
+
+  mpool = (struct memory_pool *)malloc(sizeof(struct memory_pool ));
   if(mpool == NULL){
     return NULL;
   }
-  /* set start to memory obtained from malloc */
-  mpool->start = malloc(size);
+
+  if(flags & MPOOL_MEMFD){
+    /* map a memfd shared, so that mpool_snapshot can freeze it as it is */
+    mpool->fd = mpool_memfd(mpool_map_len(size));
+    mpool->start = MAP_FAILED;
+    if(mpool->fd >= 0){
+      mpool->start = mmap(NULL, mpool_map_len(size), PROT_READ | PROT_WRITE, MAP_SHARED, mpool->fd, 0);
+    }
+    if(mpool->start == MAP_FAILED){
+      if(mpool->fd >= 0) close(mpool->fd);
+      free(mpool);
+      return NULL;
+    }
+    mpool->map = MPOOL_MAP_SHARED;
+  } else if(flags & (MPOOL_LAZY | MPOOL_PREFAULT)){
+    /* address space only; mpool_commit makes it usable */
+    mpool->start = mmap(NULL, mpool_map_len(size), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(mpool->start == MAP_FAILED){
+      free(mpool);
+      return NULL;
+    }
+    mpool->fd = -1;
+    mpool->map = MPOOL_MAP_RESERVED;
+  } else {
+    /* set start to memory obtained from calloc, so that mpool_calloc
+       knows it is zero; large pools come straight from mmap and are not
+       cleared a second time */
+    mpool->start = calloc(size ? size : 1, 1);
+    if(mpool->start == NULL){
+      free(mpool);
+      return NULL;
+    }
+    mpool->fd = -1;
+    mpool->map = MPOOL_MAP_HEAP;
+  }
   /* set size to size */
   mpool->size = size;
-  /* create a doubly-linked list to track allocations */
-  mpool->alloc_list = dbll_create();
-
-  /* create a doubly-linked list to track free to_adds */
-  mpool->free_list = dbll_create();
+  mpool_init(mpool);
+  if(mpool->map == MPOOL_MAP_RESERVED){
+    mpool->committed = 0;
+    if(flags & MPOOL_PREFAULT){
+      mpool->prefault = mpool_prefault_start(mpool);
+    }
+  }
 
   /* create a free to_add of memory for the entire pool and place it on the free_list */
   struct alloc_info *mem_to_add = (struct alloc_info*) malloc(sizeof(struct alloc_info));
@@ -36,17 +326,46 @@ struct memory_pool *mpool_create(size_t size)
 
 }
 
+/* free the alloc_info records held by a list */
+static void mpool_free_records(struct dbll *list)
+{
+  struct llnode *curr;
+  for(curr = list->first; curr != NULL; curr = curr->next){
+    free(curr->user_data);
+  }
+}
+
 /* ``destroy'' the memory pool by freeing it and all associated data structures */
 /* this includes the alloc_list and the free_list as well */
 void mpool_destroy(struct memory_pool *p)
 {
   /* make sure the allocated list is empty (i.e. everything has been freed) */
   /* free the alloc_list dbll */
+  mpool_free_records(p->alloc_list);
   dbll_free(p->alloc_list);
   /* free the free_list dbll  */
+  mpool_free_records(p->free_list);
   dbll_free(p->free_list);
-  
-  /* free the memory pool structure */
+  /* and the deferred blocks and the handles */
+  mpool_free_records(p->deferred);
+  dbll_free(p->deferred);
+  mpool_free_records(p->handles);
+  dbll_free(p->handles);
+
+  if(p->prefault != NULL){
+    mpool_prefault_stop(p->prefault);
+  }
+  free(p->dirty);
+
+  /* free the pool memory and the memory pool structure */
+  if(p->map == MPOOL_MAP_HEAP){
+    free(p->start);
+  } else {
+    munmap(p->start, mpool_map_len(p->size));
+  }
+  if(p->fd >= 0){
+    close(p->fd);
+  }
   free(p);
 }
 
@@ -62,105 +381,373 @@ void mpool_destroy(struct memory_pool *p)
    sizes, align to 16.
 */
 
-void *mpool_alloc(struct memory_pool *p, size_t size)
+static size_t mpool_size_align(size_t size)
 {
+  if(size <= 2)
+    return size ? size : 1;
+  if(size <= 4)
+    return 4;
+  if(size <= 8)
+    return 8;
+  return 16;
+}
 
-  size_t align;
-  switch (size) {
-    case 1:
-      align = 1;
-      break;
-    case 2:
-      align = 2;
-      break;
-    case 3:
-      align = 4;
-    case 4:
-      align = 4;
-      break;
-    case 5:
-      align = 8;
-      break;
-    case 6:
-      align = 8;
-      break;
-    case 7:
-      align = 8;
-      break;
-    case 8:
-      align = 8;
-      break;
-    default:
-      align = 16;
-      break;
+/* bin holding freed blocks of exactly `size` bytes, or -1 */
+static int mpool_bin_of(size_t size)
+{
+  if(size == 0 || size > MPOOL_BIN_MAX || size % MPOOL_BIN_STEP != 0)
+    return -1;
+  return size / MPOOL_BIN_STEP - 1;
+}
+
+static void mpool_free_block(struct memory_pool *p, void *addr);
+
+/* drop an empty free region, moving mpool_compact's saved position off it */
+static void mpool_unlink_free(struct memory_pool *p, struct llnode *node)
+{
+  if(p->compact_free == node)
+    p->compact_free = node->prev;
+  free(node->user_data);
+  dbll_remove(p->free_list, node);
+}
+
+/* hand every binned block back to the free list */
+static void mpool_flush_bins(struct memory_pool *p)
+{
+  int i;
+
+  for(i = 0; i < MPOOL_BINS; i++) {
+    while(p->bins[i] != NULL) {
+      void *b = p->bins[i];
+      memcpy(&p->bins[i], b, sizeof(void *));
+      mpool_free_block(p, b);
+    }
+  }
+}
+
+/* search the free list for the first block that can hold `size` bytes
+   at an address aligned to `align` */
+static struct llnode *mpool_find_fit(struct memory_pool *p, size_t align, size_t size)
+{
+  struct llnode *curr;
+
+  for(curr = p->free_list->first; curr != NULL; curr = curr->next) {
+    struct alloc_info *temp = curr->user_data;
+    uintptr_t addr = (uintptr_t) (p->start + temp->offset);
+    size_t pad = (align - addr % align) % align;
+
+    if(temp->size >= pad && temp->size - pad >= size)
+      return curr;
+  }
+
+  return NULL;
+}
+
+/* search the free list from the top for the last block that can hold
+   `size` bytes at an aligned address, placed as high as possible */
+static struct llnode *mpool_find_fit_high(struct memory_pool *p, size_t align, size_t size)
+{
+  struct llnode *curr;
+
+  for(curr = p->free_list->last; curr != NULL; curr = curr->prev) {
+    struct alloc_info *temp = curr->user_data;
+    uintptr_t lo = (uintptr_t) (p->start + temp->offset);
+    uintptr_t hi = lo + temp->size;
+
+    if(temp->size >= size && ((hi - size) & ~(uintptr_t) (align - 1)) >= lo)
+      return curr;
+  }
+
+  return NULL;
+}
+
+static struct llnode *mpool_find(struct memory_pool *p, size_t align, size_t size, int hint)
+{
+  return hint == MPOOL_SHORT ? mpool_find_fit_high(p, align, size) : mpool_find_fit(p, align, size);
+}
+
+/* carve an allocation out of the top of free block `block`; the space
+   above it that alignment leaves over becomes a free block of its own */
+static void *mpool_place_high(struct memory_pool *p, struct llnode *block, size_t align, size_t size, int zero)
+{
+  struct alloc_info *block_data = block->user_data, *to_add, *tail;
+  size_t top = block_data->offset + block_data->size;
+  size_t offset = ((uintptr_t) (p->start + top - size) & ~(uintptr_t) (align - 1)) - (uintptr_t) p->start;
+
+  to_add = malloc(sizeof(struct alloc_info));
+  if(to_add == NULL)
+    return NULL;
+  to_add->size = size;
+  to_add->offset = offset;
+  to_add->request_size = size;
+
+  if(offset + size < top) {
+    tail = malloc(sizeof(struct alloc_info));
+    if(tail == NULL) {
+      free(to_add);
+      return NULL;
+    }
+    tail->size = top - (offset + size);
+    tail->offset = offset + size;
+    tail->request_size = 0;
+    dbll_insert_after(p->free_list, block, tail);
+  }
+
+  block_data->size = offset - block_data->offset;
+  if(block_data->size == 0)
+    mpool_unlink_free(p, block);
+
+  dbll_append(p->alloc_list, to_add);
+  mpool_dirty(p, offset, size, zero);
+  return p->start + offset;
+}
+
+/* mpool_aligned_alloc without the hooks */
+/* MPOOL_SHORT blocks are cut from the top of the highest free block
+   that fits, everything else from the bottom of the lowest one; if zero
+   is set the block is cleared */
+static void *mpool_place(struct memory_pool *p, size_t align, size_t size, int hint, int zero)
+{
+  struct llnode *block;
+  struct alloc_info *block_data, *to_add;
+  size_t pad;
+  int bin;
+
+  /* align must be a power of two */
+  if(align == 0 || (align & (align - 1)) != 0)
+    return NULL;
+
+  /* short-lived blocks at the top would commit all of a lazy pool */
+  if(p->map == MPOOL_MAP_RESERVED)
+    hint = MPOOL_LONG;
+
+  /* reuse a block released with mpool_free_sized if it is aligned well
+     enough; its record never left the alloc_list */
+  bin = hint == MPOOL_SHORT ? -1 : mpool_bin_of(size);
+  if(bin >= 0 && p->bins[bin] != NULL && (uintptr_t) p->bins[bin] % align == 0) {
+    void *b = p->bins[bin];
+    memcpy(&p->bins[bin], b, sizeof(void *));
+    if(zero)
+      memset(b, 0, size);
+    return b;
+  }
+
+  /* in deferred mode, a recently freed block of the same size is
+     taken back as it is */
+  if(p->deferred_count > 0 && hint != MPOOL_SHORT) {
+    for(block = p->deferred->last; block != NULL; block = block->prev) {
+      to_add = block->user_data;
+      if(to_add->size == size && (uintptr_t) (p->start + to_add->offset) % align == 0) {
+        dbll_remove(p->deferred, block);
+        p->deferred_count--;
+        to_add->request_size = size;
+        dbll_append(p->alloc_list, to_add);
+        if(zero)
+          memset(p->start + to_add->offset, 0, size);
+        return p->start + to_add->offset;
+      }
+    }
   }
+
   /* check if there is enough memory for allocation of `size` (taking
    alignment into account) by checking the list of free blocks */
+  block = mpool_find(p, align, size, hint);
 
-  /* search the free list for a suitable block */
-  /* there are many strategies you can use: first fit (the first block that fits),
-   best fit (the smallest block that fits), etc. */
-  struct llnode* block = NULL;
-  struct llnode* curr = p->free_list->first;
-  while (curr != NULL) {
-    struct alloc_info* temp = curr->user_data;
-    size_t start = temp->offset;
-    if (start % align != 0){
-      start = (start / align + 1) * align;
-    }
-    if (temp->offset + temp->size >= start + size) {
-      block = curr;
-      break;
-    }
-  curr = curr->next;
+  /* binned and deferred blocks are not on the free list, so give them
+     back before giving up, then try to merge free space by moving
+     handle blocks */
+  if(block == NULL) {
+    mpool_flush_bins(p);
+    mpool_consolidate(p);
+    block = mpool_find(p, align, size, hint);
+  }
+  if(block == NULL && p->handles->first != NULL && mpool_compact(p, 0) > 0) {
+    block = mpool_find(p, align, size, hint);
   }
 
   /* if no suitable block can be found, return NULL */
   if (block == NULL){return NULL;}
-  struct alloc_info* block_data = block->user_data;
-
-  /* if found, create an alloc_info block, store start of new region
-   into offset, set size to allocation size (take alignment into
-   account!), set free to null */
-  struct alloc_info* to_add;
-  if (block_data->offset % align != 0) {
-    // Split memory to_add into 2 to_adds: offset->alignment-1 and alignment->offset+size 
+  block_data = block->user_data;
+
+  if(hint == MPOOL_SHORT)
+    return mpool_place_high(p, block, align, size, zero);
+
+  pad = (align - (uintptr_t) (p->start + block_data->offset) % align) % align;
+
+  /* a lazy pool commits memory up to the end of the block first */
+  if(block_data->offset + pad + size > p->committed && !mpool_commit(p, block_data->offset + pad + size))
+    return NULL;
+
+  /* split the padding in front of the aligned address off into its own
+     free block so that it can still serve smaller allocations */
+  if (pad != 0) {
     to_add = malloc( sizeof(struct alloc_info) );
-    to_add->size = (block_data->offset / align + 1) * align - block_data->offset;
+    if(to_add == NULL)
+      return NULL;
+    to_add->size = pad;
     to_add->offset = block_data->offset;
+    to_add->request_size = 0;
 
-    block_data->offset += to_add->size;
-    block_data->size -= to_add->size;
+    block_data->offset += pad;
+    block_data->size -= pad;
 
     dbll_insert_before(p->free_list, block, to_add);
   }
 
   to_add = malloc( sizeof(struct alloc_info) );
+  if(to_add == NULL)
+    return NULL;
   to_add->size = size;
   to_add->offset = block_data->offset;
   to_add->request_size = size;
 
   block_data->offset += to_add->size;
   block_data->size -= to_add->size;
-  if (block_data->size == 0){
-    dbll_remove(p->free_list, block);
-  }
+  if (block_data->size == 0)
+    mpool_unlink_free(p, block);
 
   /* add the new alloc_info block to the memory pool's allocated
    list */
   dbll_append(p->alloc_list, to_add);
+  mpool_dirty(p, to_add->offset, size, zero);
 
   /* return pointer to allocated region*/
   return p->start + to_add->offset;
 
 }
 
+/* charge a new block of `size` bytes to the hooks' countdown and run
+   the alloc hook once it has run out */
+/* every allocating entry point calls this directly, and it is kept out
+   of line and off the tail-call path, so the alloc hook always runs two
+   frames below the caller of the entry point (see mpool_profile.c) */
+__attribute__((noinline))
+static void mpool_run_alloc_hook(struct memory_pool *p, void *b, size_t size)
+{
+  if(p->hooks != NULL && b != NULL && (p->hooks->countdown -= (int64_t) size) <= 0)
+    p->hooks->alloc(p->hooks, b, size);
+  __asm__ __volatile__("");
+}
+
+/* see poolalloc.h */
+void *mpool_alloc(struct memory_pool *p, size_t size)
+{
+  void *b = mpool_place(p, mpool_size_align(size), size, MPOOL_LONG, 0);
+
+  mpool_run_alloc_hook(p, b, size);
+  return b;
+}
+
+/* see poolalloc.h */
+void *mpool_aligned_alloc(struct memory_pool *p, size_t align, size_t size)
+{
+  void *b = mpool_place(p, align, size, MPOOL_LONG, 0);
+
+  mpool_run_alloc_hook(p, b, size);
+  return b;
+}
+
+/* see poolalloc.h */
+void *mpool_alloc_hint(struct memory_pool *p, size_t size, int hint)
+{
+  void *b = mpool_place(p, mpool_size_align(size), size, hint, 0);
+
+  mpool_run_alloc_hook(p, b, size);
+  return b;
+}
+
+/* see poolalloc.h */
+void *mpool_calloc(struct memory_pool *p, size_t nmemb, size_t size)
+{
+  size_t total = nmemb * size;
+  void *b;
+
+  if(size != 0 && total / size != nmemb)
+    return NULL;
+
+  b = mpool_place(p, mpool_size_align(total), total, MPOOL_LONG, 1);
+
+  mpool_run_alloc_hook(p, b, total);
+  return b;
+}
+
+/* see poolalloc.h */
+void mpool_free_sized(struct memory_pool *p, void *addr, size_t size)
+{
+  int bin = mpool_bin_of(size);
+
+  if(addr == NULL)
+    return;
+
+  if(bin < 0) {
+    mpool_free(p, addr);
+    return;
+  }
+
+  if(p->hooks != NULL && (p->hooks->free_filter & MPOOL_HOOK_BIT(addr)))
+    p->hooks->free(p->hooks, addr);
+
+  /* the block may be less aligned than a pointer */
+  memcpy(addr, &p->bins[bin], sizeof(void *));
+  p->bins[bin] = addr;
+}
+
+/* insert a free region before `pos` (append if NULL), keeping the free
+   list in address order, and coalesce it with its neighbours */
+/* return the node now holding the region */
+static struct llnode *mpool_insert_free(struct memory_pool *p, struct llnode *pos, struct alloc_info *data)
+{
+  struct llnode *block;
+
+  if (pos != NULL){
+    block = dbll_insert_before(p->free_list, pos, data);
+  }
+  else {
+    block = dbll_append(p->free_list, data);
+  }
+
+  /* coalesce the free_list */
+
+  // coalesce the previous block
+  if (block->prev != NULL) {
+    struct llnode* prev = block->prev;
+    struct alloc_info* current_data = block->user_data;
+    struct alloc_info* prev_data = prev->user_data;
+    if (prev_data->offset + prev_data->size == current_data->offset) {
+      current_data->offset -= prev_data->size;
+      current_data->size += prev_data->size;
+      mpool_unlink_free(p, prev);
+    }
+  }
+
+  // coalesce the next block
+  if  (block->next != NULL) {
+    struct llnode* next = block->next;
+    struct alloc_info* current_data = block->user_data;
+    struct alloc_info* next_data = next->user_data;
+    if (current_data->offset + current_data->size == next_data->offset) {
+      current_data->size += next_data->size;
+      mpool_unlink_free(p, next);
+    }
+  }
+
+  return block;
+}
+
 /* Free a chunk of memory out of the pool */
 /* This moves the chunk of memory to the free list. */
 /* You may want to coalesce free to_adds [i.e. combine two free to_adds
    that are are next to each other in the pool into one larger free
    to_add. Note this requires that you keep the list of free to_adds in order */
 void mpool_free(struct memory_pool *p, void *addr)
+{
+  if(p->hooks != NULL && (p->hooks->free_filter & MPOOL_HOOK_BIT(addr)))
+    p->hooks->free(p->hooks, addr);
+  mpool_free_block(p, addr);
+}
+
+/* mpool_free without the hooks */
+static void mpool_free_block(struct memory_pool *p, void *addr)
 {
   /* search the alloc_list for the to_add */
   struct llnode* block = NULL;
@@ -170,18 +757,28 @@ void mpool_free(struct memory_pool *p, void *addr)
       block = curr;
       break;
     }
+   curr = curr->next;
+  }
 
+  /* not allocated from this pool */
   if(block == NULL){
     return;
   }
-   curr = curr->next;
-  }
 
   /* move it to the free_list */
   struct alloc_info* data = block->user_data;
   // Remove from alloc_list
   dbll_remove(p->alloc_list, block);
 
+  /* in deferred mode, park it on the unsorted cache instead */
+  if (p->deferred_threshold) {
+    dbll_append(p->deferred, data);
+    if (++p->deferred_count > p->deferred_threshold) {
+      mpool_consolidate(p);
+    }
+    return;
+  }
+
   // Add to free_list
   block = NULL;
   curr = p->free_list->first;
@@ -192,36 +789,477 @@ void mpool_free(struct memory_pool *p, void *addr)
     }
     curr = curr->next;
   }
-  
-  if (block != NULL){
-    block = dbll_insert_before(p->free_list, block, data);
+
+  mpool_insert_free(p, block, data);
+}
+
+/* see poolalloc.h */
+void mpool_set_deferred(struct memory_pool *p, size_t threshold)
+{
+  p->deferred_threshold = threshold;
+  if (threshold == 0 || p->deferred_count > threshold) {
+    mpool_consolidate(p);
   }
-  else {
-    block = dbll_append(p->free_list, data);
+}
+
+static int mpool_offset_cmp(const void *a, const void *b)
+{
+  size_t x = (*(struct alloc_info * const *) a)->offset;
+  size_t y = (*(struct alloc_info * const *) b)->offset;
+
+  return x < y ? -1 : x > y;
+}
+
+/* see poolalloc.h */
+void mpool_consolidate(struct memory_pool *p)
+{
+  struct alloc_info **batch;
+  struct llnode *cursor;
+  size_t n = 0, i;
+
+  if (p->deferred_count == 0) {
+    return;
   }
 
-  /* coalesce the free_list */
+  batch = malloc(p->deferred_count * sizeof(struct alloc_info *));
 
-  // coalesce the previous block
-  if (block->prev != NULL) {
-    struct llnode* prev = block->prev;
-    struct alloc_info* current_data = block->user_data;
-    struct alloc_info* prev_data = prev->user_data;
-    if (prev_data->offset + prev_data->size == current_data->offset) {
-      current_data->offset -= prev_data->size;
-      current_data->size += prev_data->size;
-      dbll_remove(p->free_list, prev);
+  if (batch == NULL) {
+    /* no room to sort: fall back to one insert walk per block */
+    while (p->deferred->first != NULL) {
+      struct alloc_info *data = p->deferred->first->user_data;
+      dbll_remove(p->deferred, p->deferred->first);
+      for (cursor = p->free_list->first; cursor != NULL; cursor = cursor->next) {
+        if (((struct alloc_info *) cursor->user_data)->offset > data->offset)
+          break;
+      }
+      mpool_insert_free(p, cursor, data);
     }
+    p->deferred_count = 0;
+    return;
   }
 
-  // coalesce the next block
-  if  (block->next != NULL) {
-    struct llnode* next = block->next;
-    struct alloc_info* current_data = block->user_data;
-    struct alloc_info* next_data = next->user_data;
-    if (current_data->offset + current_data->size == next_data->offset) {
-      current_data->size += next_data->size;
-      dbll_remove(p->free_list, next);
+  while (p->deferred->first != NULL) {
+    batch[n++] = p->deferred->first->user_data;
+    dbll_remove(p->deferred, p->deferred->first);
+  }
+  p->deferred_count = 0;
+
+  qsort(batch, n, sizeof(struct alloc_info *), mpool_offset_cmp);
+
+  /* merge the sorted batch into the free list in a single walk */
+  cursor = p->free_list->first;
+  for (i = 0; i < n; i++) {
+    struct llnode *node;
+
+    while (cursor != NULL && ((struct alloc_info *) cursor->user_data)->offset < batch[i]->offset) {
+      cursor = cursor->next;
+    }
+
+    node = mpool_insert_free(p, cursor, batch[i]);
+    cursor = node->next;
+  }
+
+  free(batch);
+}
+
+/* see poolalloc.h */
+struct mpool_handle *mpool_halloc(struct memory_pool *p, size_t size)
+{
+  struct mpool_handle *h;
+  struct llnode *curr;
+  char *addr;
+
+  h = malloc(sizeof(struct mpool_handle));
+  if(h == NULL)
+    return NULL;
+
+  addr = mpool_alloc(p, size);
+  if(addr == NULL) {
+    free(h);
+    return NULL;
+  }
+
+  /* the record was just appended to the alloc_list */
+  for(curr = p->alloc_list->last; curr != NULL; curr = curr->prev) {
+    if(((struct alloc_info *) curr->user_data)->offset == (size_t) (addr - p->start))
+      break;
+  }
+
+  h->info = curr->user_data;
+  h->align = mpool_size_align(size);
+  h->pins = 0;
+
+  /* keep the handles in address order for mpool_compact, which never
+     reorders them; new blocks are often the highest */
+  for(curr = p->handles->last; curr != NULL; curr = curr->prev) {
+    if(((struct mpool_handle *) curr->user_data)->info->offset < h->info->offset)
+      break;
+  }
+  h->node = curr != NULL ? dbll_insert_after(p->handles, curr, h)
+                         : dbll_insert_before(p->handles, NULL, h);
+  if(h->node == NULL) {
+    mpool_free(p, addr);
+    free(h);
+    return NULL;
+  }
+
+  return h;
+}
+
+/* see poolalloc.h */
+void *mpool_pin(struct memory_pool *p, struct mpool_handle *h)
+{
+  h->pins++;
+  return p->start + h->info->offset;
+}
+
+/* see poolalloc.h */
+void mpool_unpin(struct memory_pool *p, struct mpool_handle *h)
+{
+  if(h->pins > 0)
+    h->pins--;
+}
+
+/* see poolalloc.h */
+void mpool_hfree(struct memory_pool *p, struct mpool_handle *h)
+{
+  if(h == NULL)
+    return;
+
+  if(p->compact_next == h->node)
+    p->compact_next = h->node->next;
+  dbll_remove(p->handles, h->node);
+  mpool_free(p, p->start + h->info->offset);
+  free(h);
+}
+
+static unsigned long long mpool_now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* see poolalloc.h */
+size_t mpool_compact(struct memory_pool *p, unsigned long long budget_ns)
+{
+  unsigned long long t0 = mpool_now_ns();
+  struct llnode *node, *cursor;
+  size_t moved = 0;
+
+  /* blocks on the deferred cache are free space the walk must see */
+  mpool_consolidate(p);
+
+  if(budget_ns == 0)
+    p->compact_next = p->compact_free = NULL;
+  node = p->compact_next != NULL ? p->compact_next : p->handles->first;
+  cursor = p->compact_free != NULL ? p->compact_free : p->free_list->first;
+
+  /* walk the handles and the free list together in address order; a
+     block that directly follows a free region slides down into it, and
+     the region moves up past the block, where it may merge with the
+     next one */
+  for(; node != NULL && cursor != NULL; node = node->next) {
+    struct mpool_handle *h = node->user_data;
+    struct alloc_info *b = h->info;
+    struct alloc_info *f = NULL;
+    size_t dst;
+
+    if(budget_ns && moved > 0 && mpool_now_ns() - t0 >= budget_ns)
+      break;
+
+    if(h->pins > 0)
+      continue;
+
+    while(cursor != NULL) {
+      f = cursor->user_data;
+      if(f->offset + f->size >= b->offset)
+        break;
+      cursor = cursor->next;
+    }
+
+    if(cursor == NULL || f->offset + f->size != b->offset)
+      continue;
+
+    dst = f->offset;
+    dst += (h->align - (uintptr_t) (p->start + dst) % h->align) % h->align;
+    if(dst >= b->offset)
+      continue;
+
+    memmove(p->start + dst, p->start + b->offset, b->size);
+    mpool_dirty(p, dst, b->size, 0);
+
+    if(dst > f->offset) {
+      /* the alignment padding stays behind as a free region of its own */
+      struct alloc_info *g = malloc(sizeof(struct alloc_info));
+      if(g == NULL) {
+        memmove(p->start + b->offset, p->start + dst, b->size);
+        break;
+      }
+      g->offset = dst + b->size;
+      g->size = b->offset - dst;
+      g->request_size = 0;
+      f->size = dst - f->offset;
+      cursor = dbll_insert_after(p->free_list, cursor, g);
+      f = g;
+    } else {
+      f->offset += b->size;
+    }
+
+    if(p->hooks != NULL && p->hooks->move != NULL)
+      p->hooks->move(p->hooks, p->start + b->offset, p->start + dst);
+
+    b->offset = dst;
+    moved += b->size;
+
+    if(cursor->next != NULL) {
+      struct alloc_info *next = cursor->next->user_data;
+      if(f->offset + f->size == next->offset) {
+        f->size += next->size;
+        mpool_unlink_free(p, cursor->next);
+      }
+    }
+  }
+
+  /* resume here next time, or start over once the walk is done */
+  p->compact_next = cursor != NULL ? node : NULL;
+  p->compact_free = p->compact_next != NULL ? cursor : NULL;
+
+  p->compactions++;
+  p->compact_moved += moved;
+  p->compact_ns += mpool_now_ns() - t0;
+  return moved;
+}
+
+/* see poolalloc.h */
+void mpool_get_stats(struct memory_pool *p, struct mpool_stats *stats)
+{
+  struct llnode *curr;
+  int i;
+
+  memset(stats, 0, sizeof(*stats));
+
+  for(curr = p->free_list->first; curr != NULL; curr = curr->next) {
+    struct alloc_info *f = curr->user_data;
+    stats->free_bytes += f->size;
+    stats->free_blocks++;
+    if(f->size > stats->largest_free)
+      stats->largest_free = f->size;
+  }
+
+  for(curr = p->alloc_list->first; curr != NULL; curr = curr->next) {
+    stats->used_bytes += ((struct alloc_info *) curr->user_data)->size;
+    stats->used_blocks++;
+  }
+
+  /* binned blocks are free to the caller but still on the alloc_list */
+  for(i = 0; i < MPOOL_BINS; i++) {
+    void *b;
+    for(b = p->bins[i]; b != NULL; memcpy(&b, b, sizeof(void *))) {
+      stats->binned_bytes += (i + 1) * MPOOL_BIN_STEP;
+    }
+  }
+
+  for(curr = p->deferred->first; curr != NULL; curr = curr->next)
+    stats->deferred_bytes += ((struct alloc_info *) curr->user_data)->size;
+
+  for(curr = p->handles->first; curr != NULL; curr = curr->next)
+    stats->handles++;
+
+  stats->compactions = p->compactions;
+  stats->compact_moved = p->compact_moved;
+  stats->compact_ns = p->compact_ns;
+  stats->trims = p->trims;
+  stats->trimmed_bytes = p->trimmed;
+  stats->committed_bytes = p->committed < p->size ? p->committed : p->size;
+}
+
+/* see poolalloc.h */
+size_t mpool_trim(struct memory_pool *p, size_t keep_bytes)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t free_bytes = 0, released = 0, target;
+  struct llnode *curr;
+
+  /* binned and deferred blocks only count once they are on the free list */
+  mpool_flush_bins(p);
+  mpool_consolidate(p);
+
+  for(curr = p->free_list->first; curr != NULL; curr = curr->next)
+    free_bytes += ((struct alloc_info *) curr->user_data)->size;
+
+  target = free_bytes > keep_bytes ? free_bytes - keep_bytes : 0;
+
+  /* from the end of the pool down, so the tail goes first */
+  for(curr = p->free_list->last; curr != NULL && released < target; curr = curr->prev) {
+    struct alloc_info *f = curr->user_data;
+    uintptr_t lo = ((uintptr_t) (p->start + f->offset) + page - 1) & ~(uintptr_t) (page - 1);
+    uintptr_t hi = (uintptr_t) (p->start + f->offset + f->size) & ~(uintptr_t) (page - 1);
+    int tail = f->offset + f->size == p->size;
+
+    /* a lazy pool has nothing to release past what it committed */
+    if(f->offset + f->size > p->committed)
+      hi = (uintptr_t) (p->start + p->committed) & ~(uintptr_t) (page - 1);
+
+    if(hi <= lo)
+      continue;
+
+    /* interior runs must be large enough to be worth a system call */
+    if(!tail && hi - lo < MPOOL_TRIM_MIN_RUN)
+      continue;
+
+    if(hi - lo > target - released)
+      lo = hi - ((target - released + page - 1) & ~(page - 1));
+
+    /* the pages stay mapped and read back as zero (or as the snapshot
+       they were cloned from) once touched again; pages of a shared
+       memfd mapping have to be removed from the file to be freed */
+    if(madvise((void *) lo, hi - lo, p->map == MPOOL_MAP_SHARED ? MADV_REMOVE : MADV_DONTNEED) == 0) {
+      released += hi - lo;
+      if(p->map != MPOOL_MAP_PRIVATE)
+        mpool_clean(p, lo - (uintptr_t) p->start, hi - (uintptr_t) p->start);
     }
   }
+
+  p->trims++;
+  p->trimmed += released;
+  return released;
+}
+
+/* copy the records of a list into recs, return how many there were */
+static size_t mpool_copy_records(struct dbll *list, struct alloc_info *recs)
+{
+  struct llnode *curr;
+  size_t n = 0;
+
+  for(curr = list->first; curr != NULL; curr = curr->next) {
+    if(recs != NULL)
+      recs[n] = *(struct alloc_info *) curr->user_data;
+    n++;
+  }
+  return n;
+}
+
+/* replace the pool's mapping with a private mapping of fd */
+/* the new mapping is made elsewhere first and then moved over the old
+   one, so if either step fails the pool stays on its old mapping */
+/* returns 0 on success, -1 on failure */
+static int mpool_remap_private(struct memory_pool *p, int fd, size_t len)
+{
+  void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+  if(m == MAP_FAILED)
+    return -1;
+  if(mremap(m, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, p->start) == MAP_FAILED) {
+    munmap(m, len);
+    return -1;
+  }
+  return 0;
+}
+
+/* see poolalloc.h */
+struct mpool_snapshot *mpool_snapshot(struct memory_pool *p)
+{
+  struct mpool_snapshot *snap;
+  size_t len = mpool_map_len(p->size);
+  size_t used = p->committed < p->size ? p->committed : p->size;
+
+  /* binned and deferred blocks are free; the clones could never reuse
+     them otherwise */
+  mpool_flush_bins(p);
+  mpool_consolidate(p);
+
+  snap = malloc(sizeof(struct mpool_snapshot));
+  if(snap == NULL)
+    return NULL;
+
+  snap->size = p->size;
+  snap->nalloc = mpool_copy_records(p->alloc_list, NULL);
+  snap->nfree = mpool_copy_records(p->free_list, NULL);
+  snap->records = malloc((snap->nalloc + snap->nfree + 1) * sizeof(struct alloc_info));
+  if(snap->records == NULL) {
+    free(snap);
+    return NULL;
+  }
+  mpool_copy_records(p->alloc_list, snap->records);
+  mpool_copy_records(p->free_list, snap->records + snap->nalloc);
+
+  if(p->map == MPOOL_MAP_SHARED) {
+    /* the memfd already holds the pool: hand it to the snapshot and
+       move the pool onto a private mapping of it at the same address,
+       so that from now on its writes are copy-on-write */
+    if(mpool_remap_private(p, p->fd, len) < 0) {
+      free(snap->records);
+      free(snap);
+      return NULL;
+    }
+    snap->fd = p->fd;
+    p->fd = -1;
+    p->map = MPOOL_MAP_PRIVATE;
+    return snap;
+  }
+
+  /* otherwise copy the pool into a new memfd; the file reads as zero
+     past what a lazy pool has committed */
+  snap->fd = mpool_memfd(len);
+  if(snap->fd < 0 || pwrite(snap->fd, p->start, used, 0) != (ssize_t) used) {
+    if(snap->fd >= 0)
+      close(snap->fd);
+    free(snap->records);
+    free(snap);
+    return NULL;
+  }
+
+  /* a private mapping may as well share the snapshot's pages again; if
+     that fails it keeps its own */
+  if(p->map == MPOOL_MAP_PRIVATE)
+    mpool_remap_private(p, snap->fd, len);
+
+  return snap;
+}
+
+/* see poolalloc.h */
+struct memory_pool *mpool_clone(struct mpool_snapshot *snap)
+{
+  struct memory_pool *mpool;
+  size_t i;
+
+  mpool = malloc(sizeof(struct memory_pool));
+  if(mpool == NULL)
+    return NULL;
+
+  mpool->start = mmap(NULL, mpool_map_len(snap->size), PROT_READ | PROT_WRITE, MAP_PRIVATE, snap->fd, 0);
+  if(mpool->start == MAP_FAILED) {
+    free(mpool);
+    return NULL;
+  }
+  mpool->size = snap->size;
+  mpool->fd = -1;
+  mpool->map = MPOOL_MAP_PRIVATE;
+  mpool_init(mpool);
+
+  /* a clone starts out with the snapshot's data */
+  if(mpool->dirty != NULL)
+    memset(mpool->dirty, 0xff, mpool_dirty_map_len(mpool->size));
+
+  for(i = 0; i < snap->nalloc + snap->nfree; i++) {
+    struct alloc_info *r = malloc(sizeof(struct alloc_info));
+    if(r == NULL) {
+      mpool_destroy(mpool);
+      return NULL;
+    }
+    *r = snap->records[i];
+    dbll_append(i < snap->nalloc ? mpool->alloc_list : mpool->free_list, r);
+  }
+
+  return mpool;
+}
+
+/* see poolalloc.h */
+void mpool_snapshot_free(struct mpool_snapshot *snap)
+{
+  close(snap->fd);
+  free(snap->records);
+  free(snap);
 }
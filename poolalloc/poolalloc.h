@@ -1,4 +1,6 @@
 #pragma once
+#include <stdint.h>
+#include <string.h>
 #include "dbll.h"
 
 struct alloc_info {
@@ -7,14 +9,316 @@ struct alloc_info {
   size_t request_size; /* size actually requested */
 };
 
+/* mpool_free_sized keeps freed blocks of MPOOL_BIN_STEP, 2 *
+   MPOOL_BIN_STEP, ... MPOOL_BIN_MAX bytes on per-size stacks (bins)
+   linked through the blocks themselves */
+#define MPOOL_BIN_STEP 8
+#define MPOOL_BIN_MAX 256
+#define MPOOL_BINS (MPOOL_BIN_MAX / MPOOL_BIN_STEP)
+
+/* smallest free run inside the pool that mpool_trim releases */
+#define MPOOL_TRIM_MIN_RUN (64 * 1024)
+
+/* callbacks for observers such as the sampling profiler
+   (mpool_profile.h), built so that the pool pays next to nothing for
+   the allocations they do not care about */
+/* alloc runs after a successful allocation once the sizes allocated
+   since it last ran add up to countdown; it should reset countdown. free
+   runs before a block is freed if its address's MPOOL_HOOK_BIT is set in
+   free_filter. move runs whenever compaction relocates a block. */
+struct mpool_hooks {
+  void (*alloc)(struct mpool_hooks *h, void *addr, size_t size);
+  void (*free)(struct mpool_hooks *h, void *addr);
+  void (*move)(struct mpool_hooks *h, void *from, void *to);
+  int64_t countdown;
+  uint64_t free_filter;
+};
+
+#define MPOOL_HOOK_BIT(addr) ((uint64_t) 1 << (((uintptr_t) (addr) >> 4) & 63))
+
+/* how the memory of a pool is obtained */
+#define MPOOL_MAP_HEAP 0      /* malloc */
+#define MPOOL_MAP_SHARED 1    /* shared mapping of a memfd */
+#define MPOOL_MAP_PRIVATE 2   /* private (copy-on-write) mapping of a snapshot's memfd */
+#define MPOOL_MAP_RESERVED 3  /* reserved address space, committed as it is used */
+
+/* mpool_create_flags: keep the pool in a memfd, so that the first
+   mpool_snapshot does not copy it */
+#define MPOOL_MEMFD 1
+
+/* mpool_create_flags: only reserve address space for the pool and
+   commit it in MPOOL_COMMIT_CHUNK steps as the highest allocated
+   address (the frontier) moves up, so that creating a pool costs the
+   same whatever its size; MPOOL_SHORT hints are ignored, since they
+   would commit the top of the pool */
+#define MPOOL_LAZY 2
+
+/* mpool_create_flags: MPOOL_LAZY plus a background thread that commits
+   and faults in the MPOOL_PREFAULT_AHEAD bytes past the frontier, so
+   that allocations do not take page faults on first touch */
+#define MPOOL_PREFAULT 4
+
+/* granularity of the map of pages known to be zero, see mpool_calloc */
+#define MPOOL_ZERO_PAGE 4096
+
+#define MPOOL_COMMIT_CHUNK (2UL << 20)
+#define MPOOL_PREFAULT_AHEAD (16UL << 20)
+
+struct mpool_prefault;
+
 struct memory_pool {
   char *start;                /* start of pool */
   size_t size;                /* size of pool */
+  int map;                    /* MPOOL_MAP_* */
+  int fd;                     /* memfd mapped shared at start, or -1 */
   struct dbll *alloc_list;    /* track allocations */
   struct dbll *free_list;     /* list of freed regions */
+  void *bins[MPOOL_BINS];     /* blocks freed with mpool_free_sized, still on alloc_list */
+  struct dbll *deferred;      /* freed blocks not yet on free_list, see mpool_set_deferred */
+  size_t deferred_count;
+  size_t deferred_threshold;  /* 0 when frees coalesce immediately */
+  struct dbll *handles;       /* struct mpool_handle in address order, see mpool_halloc */
+  struct llnode *compact_next; /* handle the next mpool_compact resumes at, NULL to start over */
+  struct llnode *compact_free; /* free region its walk had reached, NULL for the first */
+  unsigned long compactions;  /* calls to mpool_compact */
+  size_t compact_moved;       /* bytes moved by them */
+  unsigned long long compact_ns; /* time spent in them */
+  unsigned long trims;        /* calls to mpool_trim */
+  size_t trimmed;             /* bytes they handed back to the kernel */
+  struct mpool_hooks *hooks;  /* NULL unless someone is watching */
+  size_t committed;           /* bytes from start that may be touched, see MPOOL_LAZY */
+  struct mpool_prefault *prefault; /* MPOOL_PREFAULT thread, or NULL */
+  uint64_t *dirty;            /* bit per MPOOL_ZERO_PAGE, set once the page may
+                                 hold non-zero bytes; NULL treats all as dirty */
+};
+
+/* a movable allocation, see mpool_halloc */
+struct mpool_handle {
+  struct alloc_info *info;    /* record on the pool's alloc_list */
+  size_t align;               /* alignment kept when the block moves */
+  unsigned pins;              /* the block only moves while this is 0 */
+  struct llnode *node;        /* node in the pool's handles list */
+};
+
+struct mpool_stats {
+  size_t free_bytes;          /* bytes on the free list */
+  size_t free_blocks;         /* regions on the free list */
+  size_t largest_free;        /* largest of those regions */
+  size_t used_bytes;          /* bytes on the alloc_list, including binned blocks */
+  size_t used_blocks;
+  size_t binned_bytes;        /* bytes freed with mpool_free_sized but not yet merged */
+  size_t deferred_bytes;      /* bytes on the deferred cache */
+  size_t handles;             /* live handles */
+  unsigned long compactions;
+  size_t compact_moved;
+  unsigned long long compact_ns;
+  unsigned long trims;
+  size_t trimmed_bytes;       /* total returned by mpool_trim */
+  size_t committed_bytes;     /* the whole pool unless it was created with MPOOL_LAZY */
 };
 
 struct memory_pool *mpool_create(size_t size);
+
+/* mpool_create with MPOOL_* flags */
+/* MPOOL_MEMFD cannot be combined with MPOOL_LAZY or MPOOL_PREFAULT */
+struct memory_pool *mpool_create_flags(size_t size, int flags);
 void mpool_destroy(struct memory_pool *p);
 void *mpool_alloc(struct memory_pool *p, size_t size);
 void mpool_free(struct memory_pool *p, void *addr);
+
+/* expected lifetime of a block, see mpool_alloc_hint */
+#define MPOOL_LONG 0
+#define MPOOL_SHORT 1
+
+/* mpool_alloc for a block of the given expected lifetime */
+/* MPOOL_LONG blocks are placed like mpool_alloc places them, first fit
+   from the bottom of the pool; MPOOL_SHORT blocks are placed last fit
+   from the top, and skip the bins and the deferred cache, which may
+   hold blocks from the bottom. Keeping the two apart stops short-lived
+   blocks from leaving holes between long-lived ones. */
+void *mpool_alloc_hint(struct memory_pool *p, size_t size, int hint);
+
+/* mpool_alloc for nmemb * size bytes that read as zero */
+/* pool memory is zero until it is first handed out, and again once
+   mpool_trim releases it (except in clones, whose released pages read
+   back as the snapshot), so only the MPOOL_ZERO_PAGE pages of the block
+   that may hold old data are cleared */
+/* return NULL if nmemb * size overflows or the pool has no room */
+void *mpool_calloc(struct memory_pool *p, size_t nmemb, size_t size);
+
+/* allocate size bytes at an address that is a multiple of align, which
+   must be a power of two */
+/* padding skipped to reach the alignment stays on the free list */
+/* return NULL if align is invalid or the pool has no room */
+void *mpool_aligned_alloc(struct memory_pool *p, size_t align, size_t size);
+
+/* free addr, which must have been allocated with exactly `size` bytes */
+/* blocks of up to MPOOL_BIN_MAX bytes go onto a bin without searching
+   the alloc_list and are handed out again to allocations of the same
+   size; bins are emptied into the free list when an allocation does not
+   otherwise fit */
+void mpool_free_sized(struct memory_pool *p, void *addr, size_t size);
+
+/*
+   Inline fast path for sizes known at compile time, such as sizeof(T):
+
+     struct node *n = MPOOL_NEW(p, struct node);
+     ...
+     MPOOL_DELETE(p, n);
+
+   The size is rounded up to its size class, a multiple of
+   MPOOL_BIN_STEP, and the class and its alignment fold into
+   constants. Classes that are multiples of 16 are 16-byte aligned, the
+   others pointer aligned: a type's size is a multiple of its alignment,
+   so this suits any type aligned to at most 16, and 24-byte nodes
+   pack without holes. An allocation pops the class's bin inline and
+   only calls mpool_aligned_alloc when the bin is empty, its top block
+   is not aligned well enough or hooks are installed; a free pushes the
+   block onto the bin. Sizes above MPOOL_BIN_MAX use mpool_alloc and
+   mpool_free. Blocks must be freed with the same size they were allocated with.
+ */
+
+#define MPOOL_CLASS_SIZE(size) (((size) + MPOOL_BIN_STEP - 1) / MPOOL_BIN_STEP * MPOOL_BIN_STEP)
+#define MPOOL_CLASS_BIN(size) ((size) == 0 || (size) > MPOOL_BIN_MAX ? -1 : (int) (MPOOL_CLASS_SIZE(size) / MPOOL_BIN_STEP) - 1)
+#define MPOOL_CLASS_ALIGN(size) (MPOOL_CLASS_SIZE(size) % 16 == 0 ? 16 : sizeof(void *))
+
+#define MPOOL_ALLOC_FIXED(p, size)                                      \
+  (MPOOL_CLASS_BIN(size) >= 0                                           \
+   ? mpool_alloc_class((p), MPOOL_CLASS_BIN(size), MPOOL_CLASS_ALIGN(size)) \
+   : mpool_alloc((p), (size)))
+
+#define MPOOL_FREE_FIXED(p, addr, size)                                 \
+  (MPOOL_CLASS_BIN(size) >= 0                                           \
+   ? mpool_free_class((p), MPOOL_CLASS_BIN(size), (addr))               \
+   : mpool_free((p), (addr)))
+
+#define MPOOL_NEW(p, type) ((type *) MPOOL_ALLOC_FIXED((p), sizeof(type)))
+#define MPOOL_DELETE(p, ptr) MPOOL_FREE_FIXED((p), (ptr), sizeof(*(ptr)))
+
+/* a block of bin's size at an address aligned to align (a power of two) */
+static inline void *mpool_alloc_class(struct memory_pool *p, int bin, size_t align)
+{
+  void *b = p->bins[bin];
+
+  if(__builtin_expect(b != NULL && p->hooks == NULL && ((uintptr_t) b & (align - 1)) == 0, 1)) {
+    memcpy(&p->bins[bin], b, sizeof(void *));
+    return b;
+  }
+  return mpool_aligned_alloc(p, align, (size_t) (bin + 1) * MPOOL_BIN_STEP);
+}
+
+/* free a block allocated by mpool_alloc_class with the same bin */
+static inline void mpool_free_class(struct memory_pool *p, int bin, void *addr)
+{
+  if(__builtin_expect(p->hooks != NULL, 0)) {
+    mpool_free_sized(p, addr, (size_t) (bin + 1) * MPOOL_BIN_STEP);
+    return;
+  }
+  if(addr != NULL) {
+    memcpy(addr, &p->bins[bin], sizeof(void *));
+    p->bins[bin] = addr;
+  }
+}
+
+/* switch deferred coalescing on (threshold > 0) or off (0) */
+/* in deferred mode mpool_free moves the block to an unsorted cache
+   without touching the free list; allocations of the same size reuse
+   cached blocks first. Once more than `threshold` blocks are cached, or
+   an allocation finds no room, the cache is sorted and merged into the
+   free list in one pass (mpool_consolidate). */
+void mpool_set_deferred(struct memory_pool *p, size_t threshold);
+
+/* merge every deferred block into the free list now */
+void mpool_consolidate(struct memory_pool *p);
+
+/*
+   Handles are allocations that the pool may move to merge free space.
+   The address of a handle's block is only stable between mpool_pin and
+   the matching mpool_unpin; pins nest.
+
+     struct mpool_handle *h = mpool_halloc(p, 100);
+     char *b = mpool_pin(p, h);
+     ...
+     mpool_unpin(p, h);
+     mpool_hfree(p, h);
+
+   Blocks from mpool_alloc never move.
+ */
+
+/* allocate size bytes behind a new, unpinned handle; NULL if the pool
+   has no room */
+struct mpool_handle *mpool_halloc(struct memory_pool *p, size_t size);
+
+/* pin h and return the current address of its block */
+void *mpool_pin(struct memory_pool *p, struct mpool_handle *h);
+
+void mpool_unpin(struct memory_pool *p, struct mpool_handle *h);
+
+/* free the block and the handle */
+void mpool_hfree(struct memory_pool *p, struct mpool_handle *h);
+
+/* slide unpinned handle blocks down into the free region right before
+   them, merging free regions, until done or budget_ns nanoseconds have
+   passed (0 for no limit) */
+/* a call with a budget moves at least one block if it can, and the next
+   call resumes where it stopped; once a walk reaches the last handle,
+   the next one starts over. Calls without a limit always make a full
+   walk. */
+/* allocations that would otherwise fail call this with no limit */
+/* return the number of bytes moved */
+size_t mpool_compact(struct memory_pool *p, unsigned long long budget_ns);
+
+/* hand the pages of free regions back to the kernel with
+   madvise(MADV_DONTNEED), starting at the end of the pool, until at most
+   keep_bytes of free space is left resident */
+/* inside the pool only runs of MPOOL_TRIM_MIN_RUN bytes or more are
+   released; the free region at the very end is released whatever its
+   size. Released pages keep their addresses and are faulted back in,
+   zeroed (clones: as in their snapshot), when the space is allocated
+   again. */
+/* return the number of bytes released; pages released by an earlier
+   call are counted again */
+size_t mpool_trim(struct memory_pool *p, size_t keep_bytes);
+
+/*
+   Copy-on-write snapshots: build a template in a pool, snapshot it, and
+   create any number of clones that start out identical to it.
+
+     struct memory_pool *t = mpool_create_flags(1 << 30, MPOOL_MEMFD);
+     ... fill t ...
+     struct mpool_snapshot *s = mpool_snapshot(t);
+     struct memory_pool *c = mpool_clone(s);
+
+   A clone maps the snapshot's memfd privately, so it costs one mmap
+   plus a copy of the block records, and pages only take memory of
+   their own once they are written.
+ */
+
+/* the memory and block records of a pool at one point in time */
+struct mpool_snapshot {
+  int fd;                     /* memfd holding the pool memory */
+  size_t size;
+  size_t nalloc;              /* records[0..nalloc) were allocated */
+  size_t nfree;               /* records[nalloc..nalloc+nfree) were free */
+  struct alloc_info *records;
+};
+
+/* take a snapshot of p */
+/* a pool created with MPOOL_MEMFD hands its memfd to its first
+   snapshot and continues on a private mapping of it, at the same
+   address; any other pool, and later snapshots, copy the pool memory
+   into a new memfd */
+/* handles, bins and the deferred cache are not part of a snapshot:
+   handle blocks become plain allocated blocks in clones */
+/* return NULL if memory could not be allocated */
+struct mpool_snapshot *mpool_snapshot(struct memory_pool *p);
+
+/* a new pool with the snapshot's contents; destroy it with mpool_destroy */
+/* return NULL if memory could not be allocated */
+struct memory_pool *mpool_clone(struct mpool_snapshot *snap);
+
+/* free a snapshot; clones made from it stay valid */
+void mpool_snapshot_free(struct mpool_snapshot *snap);
+
+/* fill in stats (walks every list) */
+void mpool_get_stats(struct memory_pool *p, struct mpool_stats *stats);
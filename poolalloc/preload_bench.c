@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* malloc/free churn for comparing allocators, e.g. glibc against
+   libmpool_preload.so (see the preload-compare target) */
+
+/* usage: preload_bench [live blocks] [operations]
+          preload_bench -x command [args...]  */
+
+/* keeps `live` blocks of 16..4096 bytes allocated and replaces a random
+   one per operation; every 16th replacement uses realloc */
+
+/* with -x, runs command instead and reports its wall time and max RSS */
+
+static int run_command(char *argv[]) {
+  struct timespec t0, t1;
+  struct rusage ru;
+  int status;
+  pid_t pid;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  if((pid = fork()) == 0) {
+	execvp(argv[0], argv);
+	perror(argv[0]);
+	_exit(127);
+  }
+
+  if(pid < 0 || wait4(pid, &status, 0, &ru) < 0) {
+	perror("preload_bench");
+	return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  fprintf(stderr, "%s: exit=%d wall_s=%.3f maxrss_kb=%ld\n", argv[0],
+		  WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+		  (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, ru.ru_maxrss);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if(argc > 2 && strcmp(argv[1], "-x") == 0)
+	return run_command(argv + 2);
+
+
+  long live = argc > 1 ? atol(argv[1]) : 1000;
+  long ops = argc > 2 ? atol(argv[2]) : 200000;
+  char **blocks = calloc(live, sizeof(char *));
+  struct timespec t0, t1;
+  struct rusage ru;
+  unsigned seed = 1;
+  long i;
+
+  for(i = 0; i < live; i++)
+	blocks[i] = malloc(16 + rand_r(&seed) % 4081);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  for(i = 0; i < ops; i++) {
+	long k = rand_r(&seed) % live;
+	size_t sz = 16 + rand_r(&seed) % 4081;
+
+	if(i % 16 == 0) {
+	  blocks[k] = realloc(blocks[k], sz);
+	} else {
+	  free(blocks[k]);
+	  blocks[k] = malloc(sz);
+	}
+	memset(blocks[k], (int) i, 16);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  for(i = 0; i < live; i++)
+	free(blocks[i]);
+  free(blocks);
+
+  getrusage(RUSAGE_SELF, &ru);
+  printf("live=%ld ops=%ld Mops/s=%.3f maxrss_kb=%ld\n", live, ops,
+		 ops / ((t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3), ru.ru_maxrss);
+  return 0;
+}
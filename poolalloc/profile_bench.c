@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mpool_profile.h"
+
+/* cost of the sampling profiler on an allocation-heavy loop */
+
+/* usage: profile_bench [folded output file] */
+
+/* the functions are not static so that -rdynamic exports their names */
+
+/* churns blocks of 16..256 bytes, freed with mpool_free_sized, from
+   three call sites; times the loop without a profile and with sampling
+   means of 1MB, 512KB and 64KB, then writes a 64KB profile in folded
+   format */
+
+#define LIVE 16384
+#define OPS 2000000
+
+static void *blocks[LIVE];
+static size_t sizes[LIVE];
+
+void *alloc_small(struct memory_pool *p, size_t *size) {
+  *size = 16 + rand() % 4 * 16;
+  return mpool_alloc(p, *size);
+}
+
+void *alloc_medium(struct memory_pool *p, size_t *size) {
+  *size = 128 + rand() % 8 * 16;
+  return mpool_alloc(p, *size);
+}
+
+void *alloc_buffer(struct memory_pool *p, size_t *size) {
+  *size = 256;
+  return mpool_alloc(p, *size);
+}
+
+double run(struct memory_pool *p) {
+  void *(*sites[])(struct memory_pool *, size_t *) = { alloc_small, alloc_small, alloc_medium, alloc_buffer };
+  struct timespec t0, t1;
+  long i;
+
+  srand(1);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for(i = 0; i < OPS; i++) {
+	int k = rand() % LIVE;
+	if(blocks[k] != NULL)
+	  mpool_free_sized(p, blocks[k], sizes[k]);
+	blocks[k] = sites[rand() % 4](p, &sizes[k]);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / OPS;
+}
+
+int main(int argc, char *argv[]) {
+  struct memory_pool *p = mpool_create(8 << 20);
+  size_t means[] = { 0, 1024 * 1024, 512 * 1024, 64 * 1024 };
+  double best[4] = { 1e30, 1e30, 1e30, 1e30 };
+  unsigned long samples[4] = { 0 };
+  struct mpool_profile *prof = NULL;
+  int i, rep;
+
+  /* warm up the pool and the caches */
+  run(p);
+
+  /* interleave the configurations and keep the best of 7 runs each,
+     the machine is noisy */
+  for(rep = 0; rep < 7; rep++) {
+	for(i = 0; i < 4; i++) {
+	  double ns;
+
+	  if(means[i])
+		prof = mpool_profile_start(p, means[i]);
+
+	  ns = run(p);
+	  if(ns < best[i])
+		best[i] = ns;
+
+	  if(means[i]) {
+		samples[i] = prof->samples;
+		mpool_profile_stop(prof);
+	  }
+	}
+  }
+
+  printf("%-10s %-10s %-10s %s\n", "mean", "ns/op", "overhead", "samples/run");
+  for(i = 0; i < 4; i++)
+	printf("%-10zu %-10.1f %-9.2f%% %lu\n", means[i], best[i], 100 * (best[i] - best[0]) / best[0], samples[i]);
+
+  if(argc > 1) {
+	FILE *out = fopen(argv[1], "w");
+
+	prof = mpool_profile_start(p, 64 * 1024);
+	run(p);
+	if(out == NULL || !mpool_profile_dump(prof, out, MPOOL_PROFILE_FOLDED)) {
+	  perror(argv[1]);
+	  return 1;
+	}
+	fclose(out);
+	mpool_profile_stop(prof);
+  }
+
+  mpool_destroy(p);
+  return 0;
+}
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "mpool_sharded.h"
+
+/* alloc/free throughput of one locked pool against per-CPU shards */
+
+/* usage: sharded_bench [max threads] [operations per thread] */
+
+/* every thread keeps LIVE blocks of 16..256 bytes and replaces a random
+   one per operation; one pool is an mpool_sharded with a single shard,
+   i.e. one pool behind one mutex */
+
+#define LIVE 16
+
+static struct mpool_sharded *pool;
+static long ops;
+static pthread_barrier_t start;
+static struct timespec t_start[1024], t_end[1024];
+
+static double ts_sec(struct timespec *t) {
+  return t->tv_sec + t->tv_nsec / 1e9;
+}
+
+static void *worker(void *arg) {
+  long t = (long) arg;
+  unsigned seed = (unsigned) t + 1;
+  void *blocks[LIVE];
+  long i;
+
+  for(i = 0; i < LIVE; i++)
+	blocks[i] = mpool_sharded_alloc(pool, 16 + rand_r(&seed) % 241);
+
+  pthread_barrier_wait(&start);
+  clock_gettime(CLOCK_MONOTONIC, &t_start[t]);
+
+  for(i = 0; i < ops; i++) {
+	int k = rand_r(&seed) % LIVE;
+	mpool_sharded_free(pool, blocks[k]);
+	blocks[k] = mpool_sharded_alloc(pool, 16 + rand_r(&seed) % 241);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t_end[t]);
+
+  for(i = 0; i < LIVE; i++)
+	mpool_sharded_free(pool, blocks[i]);
+  return NULL;
+}
+
+static double run(unsigned nshards, int nthreads) {
+  pthread_t th[nthreads];
+  double t0, t1;
+  long t;
+
+  pool = mpool_sharded_create((size_t) 64 << 20, nshards);
+  pthread_barrier_init(&start, NULL, nthreads + 1);
+
+  for(t = 0; t < nthreads; t++)
+	pthread_create(&th[t], NULL, worker, (void *) t);
+
+  pthread_barrier_wait(&start);
+  for(t = 0; t < nthreads; t++)
+	pthread_join(th[t], NULL);
+
+  /* from the first thread starting to the last one finishing */
+  t0 = ts_sec(&t_start[0]);
+  t1 = ts_sec(&t_end[0]);
+  for(t = 1; t < nthreads; t++) {
+	if(ts_sec(&t_start[t]) < t0) t0 = ts_sec(&t_start[t]);
+	if(ts_sec(&t_end[t]) > t1) t1 = ts_sec(&t_end[t]);
+  }
+
+  pthread_barrier_destroy(&start);
+  mpool_sharded_destroy(pool);
+
+  return nthreads * ops / (t1 - t0) / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : 64;
+
+  if(max_threads > 1024)
+	max_threads = 1024;
+  int n;
+
+  ops = argc > 2 ? atol(argv[2]) : 4000;
+
+  printf("%ld CPUs\n", sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%-8s %-14s %s\n", "threads", "one_pool_Mops", "sharded_Mops");
+
+  for(n = 1; n <= max_threads; n *= 2)
+	printf("%-8d %-14.2f %.2f\n", n, run(1, n), run(0, n));
+
+  return 0;
+}
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "th_perf.h"
+
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} th_perf_events[TH_PERF_NEVENTS] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "L1d-miss", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+  { "LLC-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "dTLB-miss", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+  { "br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static uint64_t th_perf_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t th_perf_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return th_perf_ns();
+#endif
+}
+
+int th_perf_init(struct th_perf *p) {
+  const char *env = getenv("TH_PERF");
+  struct perf_event_attr attr;
+  int i, n = 0;
+
+  memset(p, 0, sizeof(*p));
+  for(i = 0; i < TH_PERF_NEVENTS; i++) {
+	p->fd[i] = -1;
+	if(env != NULL && strcmp(env, "off") == 0)
+	  continue;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = th_perf_events[i].type;
+	attr.config = th_perf_events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	p->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if(p->fd[i] >= 0)
+	  n++;
+	else if(p->err == 0)
+	  p->err = errno;
+  }
+
+  return n;
+}
+
+void th_perf_reset(struct th_perf *p) {
+  memset(p->count, 0, sizeof(p->count));
+  p->ticks = 0;
+  p->ns = 0;
+}
+
+void th_perf_start(struct th_perf *p) {
+  int i;
+
+  for(i = 0; i < TH_PERF_NEVENTS; i++) {
+	if(p->fd[i] >= 0) {
+	  ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+	  ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+  }
+  p->t0_ns = th_perf_ns();
+  p->t0_ticks = th_perf_ticks();
+}
+
+void th_perf_stop(struct th_perf *p) {
+  uint64_t ticks = th_perf_ticks(), ns = th_perf_ns();
+  uint64_t v[3];
+  int i;
+
+  for(i = 0; i < TH_PERF_NEVENTS; i++) {
+	if(p->fd[i] >= 0)
+	  ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+  }
+
+  p->ticks += ticks - p->t0_ticks;
+  p->ns += ns - p->t0_ns;
+
+  for(i = 0; i < TH_PERF_NEVENTS; i++) {
+	if(p->fd[i] < 0 || read(p->fd[i], v, sizeof(v)) != sizeof(v))
+	  continue;
+	/* v = value, time enabled, time running; scale when the event
+	   shared the PMU with others */
+	if(v[2] > 0 && v[2] < v[1])
+	  v[0] = (uint64_t) ((double) v[0] * v[1] / v[2]);
+	p->count[i] += v[0];
+  }
+}
+
+void th_perf_report(struct th_perf *p, const char *label, unsigned long ops) {
+  char buffer[512];
+  int len, i;
+
+  if(ops == 0)
+	ops = 1;
+
+  len = snprintf(buffer, sizeof(buffer), "%s: %lu ops, %.1f ns/op, %.1f ticks/op", label, ops,
+				 (double) p->ns / ops, (double) p->ticks / ops);
+
+  for(i = 0; i < TH_PERF_NEVENTS && len < (int) sizeof(buffer); i++) {
+	if(p->fd[i] >= 0)
+	  len += snprintf(buffer + len, sizeof(buffer) - len, ", %.2f %s/op", (double) p->count[i] / ops, th_perf_events[i].name);
+  }
+
+  if(p->fd[TH_PERF_CYCLES] >= 0 && p->fd[TH_PERF_INSTRUCTIONS] >= 0 && p->count[TH_PERF_CYCLES] > 0 && len < (int) sizeof(buffer))
+	len += snprintf(buffer + len, sizeof(buffer) - len, ", IPC %.2f", (double) p->count[TH_PERF_INSTRUCTIONS] / p->count[TH_PERF_CYCLES]);
+
+  if(p->fd[TH_PERF_CYCLES] < 0 && p->err != 0 && len < (int) sizeof(buffer))
+	snprintf(buffer + len, sizeof(buffer) - len, " (no counters: %s)", strerror(p->err));
+
+  fprintf(stderr, "PERF: %s\n", buffer);
+}
+
+void th_perf_close(struct th_perf *p) {
+  int i;
+
+  for(i = 0; i < TH_PERF_NEVENTS; i++) {
+	if(p->fd[i] >= 0)
+	  close(p->fd[i]);
+	p->fd[i] = -1;
+  }
+}
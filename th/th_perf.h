@@ -0,0 +1,61 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Hardware counters around a region of a test or benchmark:
+
+     struct th_perf perf;
+     th_perf_init(&perf);
+     th_perf_start(&perf);
+     ... ops operations ...
+     th_perf_stop(&perf);
+     th_perf_report(&perf, "mpool_alloc", ops);
+     th_perf_close(&perf);
+
+   Counters come from perf_event_open and only count user-space
+   events. Events the kernel or container refuses are left out; when
+   none can be opened (or TH_PERF=off is set in the environment) only
+   the time stamp counter, or the monotonic clock where there is none,
+   is recorded. */
+
+enum th_perf_event {
+  TH_PERF_CYCLES,
+  TH_PERF_INSTRUCTIONS,
+  TH_PERF_L1D_MISSES,
+  TH_PERF_LLC_MISSES,
+  TH_PERF_DTLB_MISSES,
+  TH_PERF_BRANCH_MISSES,
+  TH_PERF_NEVENTS
+};
+
+struct th_perf {
+  int fd[TH_PERF_NEVENTS];         /* -1 if the event is not available */
+  uint64_t count[TH_PERF_NEVENTS]; /* accumulated over start/stop pairs, scaled when multiplexed */
+  uint64_t ticks;                  /* accumulated rdtsc ticks (clock ns without a tsc) */
+  uint64_t ns;                     /* accumulated wall-clock ns */
+  uint64_t t0_ticks, t0_ns;
+  int err;                         /* errno of the first event that failed to open, 0 if none */
+};
+
+/* open the counters; return the number of hardware events available */
+int th_perf_init(struct th_perf *p);
+
+/* zero the accumulated counts */
+void th_perf_reset(struct th_perf *p);
+
+/* count from here until th_perf_stop; pairs may be repeated */
+void th_perf_start(struct th_perf *p);
+void th_perf_stop(struct th_perf *p);
+
+/* print the counts divided by ops, in th_check style:
+     PERF: label: 1000 ops, 12.3 ns/op, 40.1 cycles/op, ... */
+void th_perf_report(struct th_perf *p, const char *label, unsigned long ops);
+
+void th_perf_close(struct th_perf *p);
+
+#ifdef __cplusplus
+}
+#endif